@@ -0,0 +1,329 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "cborcodec.hpp"
+
+#include <math.h>
+#include <string.h>
+
+using namespace p44;
+
+#define CBOR_MAX_NESTING 32
+#define CBOR_BREAK 0xFF
+#define CBOR_INDEFINITE 31
+
+// MARK: ===== encoding
+
+void CborCodec::appendHead(string &aCbor, uint8_t aMajorType, uint64_t aValue)
+{
+  uint8_t mt = aMajorType<<5;
+  if (aValue<24) {
+    aCbor += (char)(mt | aValue);
+  }
+  else if (aValue<=0xFF) {
+    aCbor += (char)(mt | 24);
+    aCbor += (char)aValue;
+  }
+  else if (aValue<=0xFFFF) {
+    aCbor += (char)(mt | 25);
+    aCbor += (char)(aValue>>8);
+    aCbor += (char)aValue;
+  }
+  else if (aValue<=0xFFFFFFFF) {
+    aCbor += (char)(mt | 26);
+    for (int s=24; s>=0; s-=8) aCbor += (char)(aValue>>s);
+  }
+  else {
+    aCbor += (char)(mt | 27);
+    for (int s=56; s>=0; s-=8) aCbor += (char)(aValue>>s);
+  }
+}
+
+
+void CborCodec::append(string &aCbor, JsonObjectPtr aObj)
+{
+  if (!aObj || aObj->isType(json_type_null)) {
+    aCbor += (char)0xF6;
+  }
+  else if (aObj->isType(json_type_boolean)) {
+    aCbor += (char)(aObj->boolValue() ? 0xF5 : 0xF4);
+  }
+  else if (aObj->isType(json_type_int)) {
+    int64_t v = aObj->int64Value();
+    if (v>=0) appendHead(aCbor, major_uint, v);
+    else appendHead(aCbor, major_negint, -1-v);
+  }
+  else if (aObj->isType(json_type_double)) {
+    double d = aObj->doubleValue();
+    float f = d;
+    if ((double)f==d || isnan(d)) {
+      // single precision is sufficient
+      uint32_t b;
+      memcpy(&b, &f, sizeof(b));
+      aCbor += (char)0xFA;
+      for (int s=24; s>=0; s-=8) aCbor += (char)(b>>s);
+    }
+    else {
+      uint64_t b;
+      memcpy(&b, &d, sizeof(b));
+      aCbor += (char)0xFB;
+      for (int s=56; s>=0; s-=8) aCbor += (char)(b>>s);
+    }
+  }
+  else if (aObj->isType(json_type_string)) {
+    string s = aObj->stringValue();
+    appendHead(aCbor, major_text, s.size());
+    aCbor += s;
+  }
+  else if (aObj->isType(json_type_array)) {
+    int n = aObj->arrayLength();
+    appendHead(aCbor, major_array, n);
+    for (int i=0; i<n; i++) append(aCbor, aObj->arrayGet(i));
+  }
+  else if (aObj->isType(json_type_object)) {
+    // need to know the number of fields before encoding them
+    string fields;
+    uint64_t n = 0;
+    string key;
+    JsonObjectPtr val;
+    aObj->resetKeyIteration();
+    while (aObj->nextKeyValue(key, val)) {
+      appendHead(fields, major_text, key.size());
+      fields += key;
+      append(fields, val);
+      n++;
+    }
+    appendHead(aCbor, major_map, n);
+    aCbor += fields;
+  }
+  else {
+    aCbor += (char)0xF6; // unknown -> null
+  }
+}
+
+
+string CborCodec::encode(JsonObjectPtr aObj)
+{
+  string cbor;
+  append(cbor, aObj);
+  return cbor;
+}
+
+
+// MARK: ===== decoding
+
+namespace {
+
+  class CborDecoder
+  {
+    const uint8_t *mP;
+    const uint8_t *mEnd;
+
+  public:
+
+    CborDecoder(const uint8_t *aData, size_t aSize) : mP(aData), mEnd(aData+aSize) {};
+
+    bool atEnd() const { return mP>=mEnd; }
+
+    ErrorPtr item(JsonObjectPtr &aObj, int aDepth, bool *aBreakP = NULL);
+
+  private:
+
+    ErrorPtr head(uint8_t &aMajor, uint8_t &aInfo, uint64_t &aArg);
+    ErrorPtr uintBytes(int aNumBytes, uint64_t &aArg);
+    ErrorPtr stringItem(uint8_t aMajor, uint8_t aInfo, uint64_t aLen, string &aStr);
+
+  };
+
+
+  ErrorPtr CborDecoder::uintBytes(int aNumBytes, uint64_t &aArg)
+  {
+    if (mEnd-mP<aNumBytes) return TextError::err("CBOR: truncated data");
+    aArg = 0;
+    while (aNumBytes-->0) aArg = (aArg<<8) | *mP++;
+    return ErrorPtr();
+  }
+
+
+  ErrorPtr CborDecoder::head(uint8_t &aMajor, uint8_t &aInfo, uint64_t &aArg)
+  {
+    if (atEnd()) return TextError::err("CBOR: truncated data");
+    uint8_t ib = *mP++;
+    aMajor = ib>>5;
+    aInfo = ib & 0x1F;
+    aArg = 0;
+    if (aInfo<24) { aArg = aInfo; return ErrorPtr(); }
+    switch (aInfo) {
+      case 24: return uintBytes(1, aArg);
+      case 25: return uintBytes(2, aArg);
+      case 26: return uintBytes(4, aArg);
+      case 27: return uintBytes(8, aArg);
+      case CBOR_INDEFINITE:
+        if (aMajor==CborCodec::major_uint || aMajor==CborCodec::major_negint || aMajor==CborCodec::major_tag) break;
+        return ErrorPtr();
+    }
+    return TextError::err("CBOR: invalid additional info %d", aInfo);
+  }
+
+
+  ErrorPtr CborDecoder::stringItem(uint8_t aMajor, uint8_t aInfo, uint64_t aLen, string &aStr)
+  {
+    if (aInfo!=CBOR_INDEFINITE) {
+      if ((uint64_t)(mEnd-mP)<aLen) return TextError::err("CBOR: truncated string");
+      aStr.append((const char *)mP, (size_t)aLen);
+      mP += aLen;
+      return ErrorPtr();
+    }
+    // indefinite length: sequence of definite length chunks of same major type
+    while (true) {
+      if (atEnd()) return TextError::err("CBOR: truncated string");
+      if (*mP==CBOR_BREAK) { mP++; return ErrorPtr(); }
+      uint8_t major, info;
+      uint64_t len;
+      ErrorPtr err = head(major, info, len);
+      if (Error::notOK(err)) return err;
+      if (major!=aMajor || info==CBOR_INDEFINITE) return TextError::err("CBOR: invalid string chunk");
+      err = stringItem(major, info, len, aStr);
+      if (Error::notOK(err)) return err;
+    }
+  }
+
+
+  static double halfToDouble(uint16_t aHalf)
+  {
+    int exp = (aHalf>>10) & 0x1F;
+    int mant = aHalf & 0x3FF;
+    double val;
+    if (exp==0) val = ldexp(mant, -24);
+    else if (exp!=31) val = ldexp(mant+1024, exp-25);
+    else val = mant==0 ? INFINITY : NAN;
+    return (aHalf & 0x8000) ? -val : val;
+  }
+
+
+  ErrorPtr CborDecoder::item(JsonObjectPtr &aObj, int aDepth, bool *aBreakP)
+  {
+    aObj.reset();
+    if (aDepth>CBOR_MAX_NESTING) return TextError::err("CBOR: nesting too deep");
+    if (aBreakP) {
+      if (atEnd()) return TextError::err("CBOR: truncated data");
+      if (*mP==CBOR_BREAK) { mP++; *aBreakP = true; return ErrorPtr(); }
+      *aBreakP = false;
+    }
+    uint8_t major, info;
+    uint64_t arg;
+    ErrorPtr err = head(major, info, arg);
+    if (Error::notOK(err)) return err;
+    switch (major) {
+      case CborCodec::major_uint:
+        if (arg>INT64_MAX) aObj = JsonObject::newDouble((double)arg);
+        else aObj = JsonObject::newInt64((int64_t)arg);
+        return ErrorPtr();
+      case CborCodec::major_negint:
+        if (arg>INT64_MAX) aObj = JsonObject::newDouble(-1.0-(double)arg);
+        else aObj = JsonObject::newInt64(-1-(int64_t)arg);
+        return ErrorPtr();
+      case CborCodec::major_bytes:
+      case CborCodec::major_text: {
+        string s;
+        err = stringItem(major, info, arg, s);
+        if (Error::isOK(err)) aObj = JsonObject::newString(s);
+        return err;
+      }
+      case CborCodec::major_array: {
+        // Note: every item has at least one byte, so a count larger than the remaining data is invalid
+        if (info!=CBOR_INDEFINITE && arg>(uint64_t)(mEnd-mP)) return TextError::err("CBOR: truncated array");
+        JsonObjectPtr arr = JsonObject::newArray();
+        for (uint64_t i=0; info==CBOR_INDEFINITE || i<arg; i++) {
+          JsonObjectPtr elem;
+          bool brk = false;
+          err = item(elem, aDepth+1, info==CBOR_INDEFINITE ? &brk : NULL);
+          if (Error::notOK(err)) return err;
+          if (brk) break;
+          arr->arrayAppend(elem);
+        }
+        aObj = arr;
+        return ErrorPtr();
+      }
+      case CborCodec::major_map: {
+        if (info!=CBOR_INDEFINITE && arg>(uint64_t)(mEnd-mP)/2) return TextError::err("CBOR: truncated map");
+        JsonObjectPtr obj = JsonObject::newObj();
+        for (uint64_t i=0; info==CBOR_INDEFINITE || i<arg; i++) {
+          JsonObjectPtr key, val;
+          bool brk = false;
+          err = item(key, aDepth+1, info==CBOR_INDEFINITE ? &brk : NULL);
+          if (Error::notOK(err)) return err;
+          if (brk) break;
+          err = item(val, aDepth+1);
+          if (Error::notOK(err)) return err;
+          // JSON only has string keys, other keys are converted to their JSON representation
+          string k;
+          if (key && key->isType(json_type_string)) k = key->stringValue();
+          else k = key ? key->json_str() : "null";
+          obj->add(k.c_str(), val);
+        }
+        aObj = obj;
+        return ErrorPtr();
+      }
+      case CborCodec::major_tag:
+        // tags are ignored, just use the tagged item
+        return item(aObj, aDepth+1);
+      case CborCodec::major_simple:
+      default:
+        if (info==CBOR_INDEFINITE) return TextError::err("CBOR: unexpected break");
+        switch (info) {
+          case 20: aObj = JsonObject::newBool(false); break;
+          case 21: aObj = JsonObject::newBool(true); break;
+          case 25: aObj = JsonObject::newDouble(halfToDouble((uint16_t)arg)); break;
+          case 26: {
+            uint32_t b = (uint32_t)arg;
+            float f;
+            memcpy(&f, &b, sizeof(f));
+            aObj = JsonObject::newDouble(f);
+            break;
+          }
+          case 27: {
+            double d;
+            memcpy(&d, &arg, sizeof(d));
+            aObj = JsonObject::newDouble(d);
+            break;
+          }
+          default: break; // null, undefined and unassigned simple values -> null
+        }
+        return ErrorPtr();
+    }
+  }
+
+} // anonymous namespace
+
+
+JsonObjectPtr CborCodec::decode(const uint8_t *aData, size_t aSize, ErrorPtr &aErr)
+{
+  CborDecoder dec(aData, aSize);
+  JsonObjectPtr obj;
+  aErr = dec.item(obj, 0);
+  if (Error::isOK(aErr) && !dec.atEnd()) {
+    aErr = TextError::err("CBOR: extra data after item");
+  }
+  if (Error::notOK(aErr)) obj.reset();
+  return obj;
+}
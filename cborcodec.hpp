@@ -0,0 +1,76 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44features_cborcodec_hpp__
+#define __p44features_cborcodec_hpp__
+
+#include "p44features_common.hpp"
+
+#include "jsonobject.hpp"
+
+namespace p44 {
+
+  /// minimal CBOR (RFC 8949) codec for the data model of JSON
+  /// @note byte strings decode to JSON strings, tags are ignored, undefined and unknown simple values decode to null
+  class CborCodec
+  {
+  public:
+
+    /// CBOR major types
+    enum {
+      major_uint = 0,
+      major_negint = 1,
+      major_bytes = 2,
+      major_text = 3,
+      major_array = 4,
+      major_map = 5,
+      major_tag = 6,
+      major_simple = 7
+    };
+
+    /// append a CBOR data item head
+    /// @param aCbor string to append the head to
+    /// @param aMajorType the major type (0..7)
+    /// @param aValue the argument (value, length or count)
+    static void appendHead(string &aCbor, uint8_t aMajorType, uint64_t aValue);
+
+    /// append JSON object encoded as CBOR
+    /// @param aCbor string to append the encoded object to
+    /// @param aObj the JSON object, NULL encodes as CBOR null
+    static void append(string &aCbor, JsonObjectPtr aObj);
+
+    /// @param aObj the JSON object
+    /// @return the object encoded as CBOR
+    static string encode(JsonObjectPtr aObj);
+
+    /// decode CBOR into JSON object
+    /// @param aData the CBOR data, must contain exactly one data item
+    /// @param aSize number of bytes in aData
+    /// @param aErr set to error if data is not valid CBOR
+    /// @return decoded object (NULL for CBOR null, or in case of error)
+    static JsonObjectPtr decode(const uint8_t *aData, size_t aSize, ErrorPtr &aErr);
+
+  };
+
+} // namespace p44
+
+#endif /* __p44features_cborcodec_hpp__ */
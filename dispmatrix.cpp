@@ -49,6 +49,20 @@ DispMatrix::DispMatrix(LEDChainArrangementPtr aLedChainArrangement, const string
   installationOffsetX(0),
   installationOffsetY(0)
 {
+  // API
+  mDispatch.registerCommand("stopscroll", boost::bind(&DispMatrix::stopScrollCmd, this, _1));
+  mDispatch.registerCommand("startscroll", boost::bind(&DispMatrix::startScrollCmd, this, _1));
+  mDispatch.registerCommand("scrollstatus", boost::bind(&DispMatrix::scrollStatusCmd, this, _1));
+  mDispatch.registerCommand("fade", boost::bind(&DispMatrix::fadeCmd, this, _1));
+  mDispatch.registerCommand("configure", boost::bind(&DispMatrix::configureCmd, this, _1));
+  // Note: scene must be first, other properties usually need the scene in place
+  mDispatch.registerProperty("scene", boost::bind(&DispMatrix::sceneProp, this, _1));
+  mDispatch.registerProperty("text", boost::bind(&DispMatrix::textProp, this, _1));
+  mDispatch.registerProperty("color", boost::bind(&DispMatrix::colorProp, this, _1));
+  mDispatch.registerProperty("spacing", boost::bind(&DispMatrix::spacingProp, this, _1));
+  mDispatch.registerProperty("bgcolor", boost::bind(&DispMatrix::bgcolorProp, this, _1));
+  mDispatch.registerProperty("offsetx", boost::bind(&DispMatrix::offsetxProp, this, _1));
+  mDispatch.registerProperty("offsety", boost::bind(&DispMatrix::offsetyProp, this, _1));
   // create the root view
   if (ledChainArrangement) {
     // check for commandline-triggered standalone operation, adding views from config
@@ -154,154 +168,190 @@ ErrorPtr DispMatrix::initialize(JsonObjectPtr aInitData)
 
 #define MIN_SCROLL_STEP_INTERVAL (20*MilliSecond)
 
-ErrorPtr DispMatrix::processRequest(ApiRequestPtr aRequest)
+ErrorPtr DispMatrix::stopScrollCmd(ApiRequestPtr aRequest)
+{
+  if (dispScroller) dispScroller->stopScroll();
+  return Error::ok();
+}
+
+
+ErrorPtr DispMatrix::startScrollCmd(ApiRequestPtr aRequest)
 {
-  ErrorPtr err;
   JsonObjectPtr data = aRequest->getRequest();
-  JsonObjectPtr o = data->get("cmd");
-  if (o) {
-    // decode commands
-    string cmd = o->stringValue();
-    if (cmd=="stopscroll") {
-      if (dispScroller) dispScroller->stopScroll();
-      return Error::ok();
-    }
-    else if (cmd=="startscroll") {
-      double stepx = 1;
-      double stepy = 0;
-      long steps = -1; // forever
-      bool roundoffsets = true;
-      MLMicroSeconds interval = 22*MilliSecond;
-      MLMicroSeconds start = Never; // right away
-      if (data->get("stepx", o, true)) {
-        stepx = o->doubleValue();
-      }
-      if (data->get("stepy", o, true)) {
-        stepy = o->doubleValue();
-      }
-      if (data->get("steps", o, true)) {
-        steps = o->int64Value();
-      }
-      if (data->get("interval", o, true)) {
-        interval = o->doubleValue()*Second;
-      }
-      if (data->get("roundoffsets", o, true)) {
-        roundoffsets = o->boolValue();
-      }
-      if (data->get("start", o, false)) {
-        MLMicroSeconds st;
-        if (!o) {
-          // null -> next 10-second boundary in unix time
-          st = (uint64_t)((MainLoop::unixtime()+10*Second)/10/Second)*10*Second;
-        }
-        else {
-          st = o->doubleValue()*Second;
-        }
-        start = MainLoop::unixTimeToMainLoopTime(st);
-      }
-      if (interval<MIN_SCROLL_STEP_INTERVAL) interval = MIN_SCROLL_STEP_INTERVAL;
-      if (dispScroller) dispScroller->startScroll(stepx, stepy, interval, roundoffsets, steps, start);
-      return Error::ok();
-    }
-    else if (cmd=="scrollstatus") {
-      bool last = true;
-      bool purge = false;
-      if (data->get("last", o)) last = o->boolValue();
-      if (data->get("purge", o)) purge = o->boolValue();
-      JsonObjectPtr answer = JsonObject::newObj();
-      answer->add("remainingtime", JsonObject::newDouble((double)getRemainingScrollTime(last, purge)/Second));
-      // - return
-      aRequest->sendResponse(answer, ErrorPtr());
-      return ErrorPtr();
-    }
-    else if (cmd=="fade") {
-      #if ENABLE_ANIMATION
-      int to = 255;
-      MLMicroSeconds t = 300*MilliSecond;
-      if (data->get("to", o, true)) {
-        to = o->int32Value();
-      }
-      if (data->get("t", o, true)) {
-        t = o->doubleValue()*Second;
-      }
-      if (dispScroller) dispScroller->animatorFor("alpha")->animate(to, t);
-      #endif
-      return Error::ok();
-    }
-    else if (cmd=="configure") {
-      if (data->get("view", o)) {
-        string viewLabel = o->stringValue();
-        JsonObjectPtr viewConfig = data->get("config");
-        if (viewConfig) {
-          P44ViewPtr view = rootView->findView(viewLabel);
-          if (view) err = view->configureFromResourceOrObj(viewConfig, FEATURE_NAME "/");
-          return err ? err : Error::ok();
-        }
-      }
-      return TextError::err("missing 'view' and/or 'config'");
-    }
-    return inherited::processRequest(aRequest);
+  JsonObjectPtr o;
+  double stepx = 1;
+  double stepy = 0;
+  long steps = -1; // forever
+  bool roundoffsets = true;
+  MLMicroSeconds interval = 22*MilliSecond;
+  MLMicroSeconds start = Never; // right away
+  if (data->get("stepx", o, true)) {
+    stepx = o->doubleValue();
   }
-  else {
-    // decode properties
-    if (data->get("scene", o, true)) {
-      o = Application::jsonObjOrResource(o, &err, FEATURE_NAME "/");
-      if (!Error::isOK(err)) return err;
-      if (dispScroller) {
-        P44ViewPtr sceneView = dispScroller->getScrolledView();
-        if (sceneView) {
-          // due to offset wraparound according to scrolled view's content size (~=text length)
-          // current offset might be smaller than panel's offsetX right now. This must be
-          // adjusted BEFORE content size changes
-          double ox = dispScroller->getScrollX();
-          double cx = dispScroller->getContentSize().x;
-          while (cx>0 && ox<installationOffsetX) ox += cx;
-          dispScroller->setScrollX(ox);
-          sceneView.reset();
-          dispScroller->setScrolledView(sceneView);
-        }
-        // get new contents view hierarchy
-        err = p44::createViewFromConfig(o, sceneView, dispScroller);
-        if (Error::notOK(err))
-          return err; // abort early, other properties most likely need the scene in place
-        dispScroller->setScrolledView(sceneView);
-      }
-    }
-    if (data->get("text", o, true)) {
-      string msg = o->stringValue();
-      TextViewPtr textview = boost::dynamic_pointer_cast<TextView>(rootView->findView("TEXT"));
-      if (textview) textview->setText(msg);
-    }
-    if (data->get("color", o, true)) {
-      // of the text
-      PixelColor p = webColorToPixel(o->stringValue());
-      TextViewPtr textview = boost::dynamic_pointer_cast<TextView>(rootView->findView("TEXT"));
-      if (textview) textview->setForegroundColor(p);
-    }
-    if (data->get("spacing", o, true)) {
-      // of the text
-      int spacing = o->int32Value();
-      TextViewPtr textview = boost::dynamic_pointer_cast<TextView>(rootView->findView("TEXT"));
-      if (textview) textview->setTextSpacing(spacing);
+  if (data->get("stepy", o, true)) {
+    stepy = o->doubleValue();
+  }
+  if (data->get("steps", o, true)) {
+    steps = o->int64Value();
+  }
+  if (data->get("interval", o, true)) {
+    interval = o->doubleValue()*Second;
+  }
+  if (data->get("roundoffsets", o, true)) {
+    roundoffsets = o->boolValue();
+  }
+  if (data->get("start", o, false)) {
+    MLMicroSeconds st;
+    if (!o) {
+      // null -> next 10-second boundary in unix time
+      st = (uint64_t)((MainLoop::unixtime()+10*Second)/10/Second)*10*Second;
     }
-    if (data->get("bgcolor", o, true)) {
-      // of the entire content view
-      PixelColor p = webColorToPixel(o->stringValue());
-      P44ViewPtr contentView = dispScroller->getScrolledView();
-      if (contentView) contentView->setBackgroundColor(p);
+    else {
+      st = o->doubleValue()*Second;
     }
-    if (data->get("offsetx", o, true)) {
-      // of the scroller, additionally offset by installation offset
-      double offs = o->doubleValue();
-      if (dispScroller) dispScroller->setScrollX(offs+installationOffsetX);
+    start = MainLoop::unixTimeToMainLoopTime(st);
+  }
+  if (interval<MIN_SCROLL_STEP_INTERVAL) interval = MIN_SCROLL_STEP_INTERVAL;
+  if (dispScroller) dispScroller->startScroll(stepx, stepy, interval, roundoffsets, steps, start);
+  return Error::ok();
+}
+
+
+ErrorPtr DispMatrix::scrollStatusCmd(ApiRequestPtr aRequest)
+{
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  bool last = true;
+  bool purge = false;
+  if (data->get("last", o)) last = o->boolValue();
+  if (data->get("purge", o)) purge = o->boolValue();
+  JsonObjectPtr answer = JsonObject::newObj();
+  answer->add("remainingtime", JsonObject::newDouble((double)getRemainingScrollTime(last, purge)/Second));
+  // - return
+  aRequest->sendResponse(answer, ErrorPtr());
+  return ErrorPtr();
+}
+
+
+ErrorPtr DispMatrix::fadeCmd(ApiRequestPtr aRequest)
+{
+  #if ENABLE_ANIMATION
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  int to = 255;
+  MLMicroSeconds t = 300*MilliSecond;
+  if (data->get("to", o, true)) {
+    to = o->int32Value();
+  }
+  if (data->get("t", o, true)) {
+    t = o->doubleValue()*Second;
+  }
+  if (dispScroller) dispScroller->animatorFor("alpha")->animate(to, t);
+  #endif
+  return Error::ok();
+}
+
+
+ErrorPtr DispMatrix::configureCmd(ApiRequestPtr aRequest)
+{
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  ErrorPtr err;
+  if (data->get("view", o)) {
+    string viewLabel = o->stringValue();
+    JsonObjectPtr viewConfig = data->get("config");
+    if (viewConfig) {
+      P44ViewPtr view = rootView->findView(viewLabel);
+      if (view) err = view->configureFromResourceOrObj(viewConfig, FEATURE_NAME "/");
+      return err ? err : Error::ok();
     }
-    if (data->get("offsety", o, true)) {
-      // of the scroller, additionally offset by installation offset
-      double offs = o->doubleValue();
-      if (dispScroller) dispScroller->setScrollY(offs+installationOffsetY);
+  }
+  return TextError::err("missing 'view' and/or 'config'");
+}
+
+
+ErrorPtr DispMatrix::sceneProp(JsonObjectPtr aValue)
+{
+  ErrorPtr err;
+  JsonObjectPtr o = Application::jsonObjOrResource(aValue, &err, FEATURE_NAME "/");
+  if (!Error::isOK(err)) return err;
+  if (dispScroller) {
+    P44ViewPtr sceneView = dispScroller->getScrolledView();
+    if (sceneView) {
+      // due to offset wraparound according to scrolled view's content size (~=text length)
+      // current offset might be smaller than panel's offsetX right now. This must be
+      // adjusted BEFORE content size changes
+      double ox = dispScroller->getScrollX();
+      double cx = dispScroller->getContentSize().x;
+      while (cx>0 && ox<installationOffsetX) ox += cx;
+      dispScroller->setScrollX(ox);
+      sceneView.reset();
+      dispScroller->setScrolledView(sceneView);
     }
-    return err ? err : Error::ok();
+    // get new contents view hierarchy
+    err = p44::createViewFromConfig(o, sceneView, dispScroller);
+    if (Error::notOK(err))
+      return err; // abort early, other properties most likely need the scene in place
+    dispScroller->setScrolledView(sceneView);
   }
+  return err;
+}
+
+
+ErrorPtr DispMatrix::textProp(JsonObjectPtr aValue)
+{
+  string msg = aValue->stringValue();
+  TextViewPtr textview = boost::dynamic_pointer_cast<TextView>(rootView->findView("TEXT"));
+  if (textview) textview->setText(msg);
+  return ErrorPtr();
+}
+
+
+ErrorPtr DispMatrix::colorProp(JsonObjectPtr aValue)
+{
+  // of the text
+  PixelColor p = webColorToPixel(aValue->stringValue());
+  TextViewPtr textview = boost::dynamic_pointer_cast<TextView>(rootView->findView("TEXT"));
+  if (textview) textview->setForegroundColor(p);
+  return ErrorPtr();
+}
+
+
+ErrorPtr DispMatrix::spacingProp(JsonObjectPtr aValue)
+{
+  // of the text
+  int spacing = aValue->int32Value();
+  TextViewPtr textview = boost::dynamic_pointer_cast<TextView>(rootView->findView("TEXT"));
+  if (textview) textview->setTextSpacing(spacing);
+  return ErrorPtr();
+}
+
+
+ErrorPtr DispMatrix::bgcolorProp(JsonObjectPtr aValue)
+{
+  // of the entire content view
+  PixelColor p = webColorToPixel(aValue->stringValue());
+  P44ViewPtr contentView = dispScroller->getScrolledView();
+  if (contentView) contentView->setBackgroundColor(p);
+  return ErrorPtr();
+}
+
+
+ErrorPtr DispMatrix::offsetxProp(JsonObjectPtr aValue)
+{
+  // of the scroller, additionally offset by installation offset
+  double offs = aValue->doubleValue();
+  if (dispScroller) dispScroller->setScrollX(offs+installationOffsetX);
+  return ErrorPtr();
+}
+
+
+ErrorPtr DispMatrix::offsetyProp(JsonObjectPtr aValue)
+{
+  // of the scroller, additionally offset by installation offset
+  double offs = aValue->doubleValue();
+  if (dispScroller) dispScroller->setScrollY(offs+installationOffsetY);
+  return ErrorPtr();
 }
 
 
@@ -59,12 +59,6 @@ namespace p44 {
     /// @return error if any, NULL if ok
     virtual ErrorPtr initialize(JsonObjectPtr aInitData) override;
 
-    /// handle request
-    /// @param aRequest the API request to process
-    /// @return NULL to send nothing at return (but possibly later via aRequest->sendResponse),
-    ///   Error::ok() to just send a empty response, or error to report back
-    virtual ErrorPtr processRequest(ApiRequestPtr aRequest) override;
-
     /// @return status information object for initialized feature, bool false for uninitialized
     virtual JsonObjectPtr status() override;
 
@@ -86,6 +80,20 @@ namespace p44 {
 
     void initOperation();
 
+    ErrorPtr stopScrollCmd(ApiRequestPtr aRequest);
+    ErrorPtr startScrollCmd(ApiRequestPtr aRequest);
+    ErrorPtr scrollStatusCmd(ApiRequestPtr aRequest);
+    ErrorPtr fadeCmd(ApiRequestPtr aRequest);
+    ErrorPtr configureCmd(ApiRequestPtr aRequest);
+
+    ErrorPtr sceneProp(JsonObjectPtr aValue);
+    ErrorPtr textProp(JsonObjectPtr aValue);
+    ErrorPtr colorProp(JsonObjectPtr aValue);
+    ErrorPtr spacingProp(JsonObjectPtr aValue);
+    ErrorPtr bgcolorProp(JsonObjectPtr aValue);
+    ErrorPtr offsetxProp(JsonObjectPtr aValue);
+    ErrorPtr offsetyProp(JsonObjectPtr aValue);
+
   };
   typedef boost::intrusive_ptr<DispMatrix> DispMatrixPtr;
 
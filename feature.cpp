@@ -26,8 +26,18 @@ using namespace p44;
 
 Feature::Feature(const string aName) :
   name(aName),
-  initialized(false)
+  initialized(false),
+  mEventBatching(true),
+  mMainThread(pthread_self()),
+  mStallBudget(DEFAULT_STALL_BUDGET),
+  mStalls(0),
+  mMaxCallbackTime(0)
 {
+  mDispatch.registerCommand("status", boost::bind(&Feature::statusCmd, this, _1));
+  mDispatch.registerCommand("commands", boost::bind(&Feature::commandsCmd, this, _1));
+  mDispatch.registerProperty("logleveloffset", boost::bind(&Feature::setLogLevelOffsetProp, this, _1));
+  mDispatch.registerBoolProperty("eventbatching", mEventBatching);
+  mDispatch.registerTimeProperty("stallbudget", mStallBudget);
 }
 
 
@@ -37,35 +47,83 @@ bool Feature::isInitialized() const
 }
 
 
+bool Feature::inMainThread() const
+{
+  return pthread_equal(pthread_self(), mMainThread);
+}
+
+
 ErrorPtr Feature::processRequest(ApiRequestPtr aRequest)
 {
-  // check status command
   JsonObjectPtr reqData = aRequest->getRequest();
   JsonObjectPtr o;
-  ErrorPtr err;
   if (reqData->get("cmd", o, true)) {
     string cmd = o->stringValue();
-    if (cmd=="status") {
-      aRequest->sendResponse(status(), err);
-      return err;
+    const ApiCommandHandler *handler = mDispatch.findCommand(cmd);
+    if (handler) {
+      return (*handler)(aRequest);
     }
     return FeatureApiError::err("Feature '%s': unknown cmd '%s'", getName().c_str(), cmd.c_str());
   }
   else {
     // decode properties
-    if (reqData->get("logleveloffset", o, true)) {
-      setLogLevelOffset(o->int32Value());
-    }
+    ErrorPtr err = mDispatch.applyProperties(reqData);
     return err ? err : Error::ok();
   }
 }
 
 
+ErrorPtr Feature::validateRequest(JsonObjectPtr aRequest)
+{
+  JsonObjectPtr o;
+  if (aRequest->get("cmd", o, true)) {
+    string cmd = o->stringValue();
+    if (!mDispatch.findCommand(cmd)) {
+      return FeatureApiError::err("Feature '%s': unknown cmd '%s'", getName().c_str(), cmd.c_str());
+    }
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr Feature::statusCmd(ApiRequestPtr aRequest)
+{
+  aRequest->sendResponse(status(), ErrorPtr());
+  return ErrorPtr();
+}
+
+
+ErrorPtr Feature::commandsCmd(ApiRequestPtr aRequest)
+{
+  aRequest->sendResponse(mDispatch.description(), ErrorPtr());
+  return ErrorPtr();
+}
+
+
+ErrorPtr Feature::setLogLevelOffsetProp(JsonObjectPtr aValue)
+{
+  setLogLevelOffset(aValue->int32Value());
+  return ErrorPtr();
+}
+
+
 JsonObjectPtr Feature::status()
 {
   if (isInitialized()) {
     JsonObjectPtr status = JsonObject::newObj();
     status->add("logleveloffset", JsonObject::newInt32(getLogLevelOffset()));
+    status->add("eventbatching", JsonObject::newBool(mEventBatching));
+    status->add("stallbudget", JsonObject::newDouble((double)mStallBudget/Second));
+    status->add("stalls", JsonObject::newInt64(mStalls));
+    status->add("maxcallbacktime", JsonObject::newDouble((double)mMaxCallbackTime/Second));
+    if (!mMaxCallbackSite.empty()) status->add("maxcallbacksite", JsonObject::newString(mMaxCallbackSite));
+    if (!mStallSites.empty()) {
+      JsonObjectPtr sites = JsonObject::newObj();
+      for (StallSitesMap::iterator pos = mStallSites.begin(); pos!=mStallSites.end(); ++pos) {
+        sites->add(pos->first.c_str(), JsonObject::newInt64(pos->second));
+      }
+      status->add("stallsites", sites);
+    }
     return status;
   }
   // not initialized
@@ -77,11 +135,31 @@ void Feature::sendEventMessage(JsonObjectPtr aMessage)
 {
   if (!aMessage) aMessage = JsonObject::newObj();
   aMessage->add("feature", JsonObject::newString(getName()));
-  FeatureApi::sharedApi()->sendEventMessage(aMessage);
+  FeatureApi::sharedApi()->sendEventMessage(aMessage, !mEventBatching);
+}
+
+
+bool Feature::eventWanted(const string aEventType)
+{
+  return FeatureApi::sharedApi()->wantsEvent(getName(), aEventType);
 }
 
 
 
+void Feature::callbackFinished(const char *aCallSite, MLMicroSeconds aDuration, bool aNestedStall)
+{
+  if (aDuration>mMaxCallbackTime) {
+    mMaxCallbackTime = aDuration;
+    mMaxCallbackSite = aCallSite;
+  }
+  if (mStallBudget>0 && aDuration>mStallBudget && !aNestedStall) {
+    mStalls++;
+    mStallSites[aCallSite]++;
+    OLOG(LOG_WARNING, "mainloop stall: %s ran for %.1f mS (budget %.1f mS)", aCallSite, (double)aDuration/MilliSecond, (double)mStallBudget/MilliSecond);
+  }
+}
+
+
 void Feature::reset()
 {
   initialized = false;
@@ -94,6 +172,29 @@ ErrorPtr Feature::runTool()
 }
 
 
+// MARK: - FeatureStallGuard
+
+FeatureStallGuard::FeatureStallGuard(Feature &aFeature, const char *aCallSite) :
+  mFeature(aFeature),
+  mCallSite(aCallSite),
+  mStarted(Never),
+  mStallsAtStart(aFeature.mStalls)
+{
+  if (pthread_equal(pthread_self(), mFeature.mMainThread)) {
+    mStarted = MainLoop::now();
+  }
+}
+
+
+FeatureStallGuard::~FeatureStallGuard()
+{
+  if (mStarted!=Never) {
+    mFeature.callbackFinished(mCallSite, MainLoop::now()-mStarted, mFeature.mStalls!=mStallsAtStart);
+  }
+}
+
+
+
 // MARK: - Feature scripting object
 
 #if ENABLE_P44SCRIPT
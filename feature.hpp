@@ -25,8 +25,12 @@
 
 #include "featureapi.hpp"
 
+#include <pthread.h>
+
 namespace p44 {
 
+  #define DEFAULT_STALL_BUDGET (50*MilliSecond) ///< feature callbacks running longer than this are reported as mainloop stalls
+
   class Feature;
   typedef boost::intrusive_ptr<Feature> FeaturePtr;
 
@@ -35,6 +39,17 @@ namespace p44 {
 
     bool initialized;
     string name;
+    bool mEventBatching; ///< if cleared, events of this feature are never delayed by client side event batching
+
+    friend class FeatureStallGuard;
+
+    pthread_t mMainThread; ///< the thread running the mainloop the feature was created in
+    MLMicroSeconds mStallBudget; ///< max time a callback may run, 0 = no stall detection
+    long mStalls; ///< number of callbacks exceeding mStallBudget
+    MLMicroSeconds mMaxCallbackTime; ///< longest callback run time seen
+    string mMaxCallbackSite; ///< where the longest callback was
+    typedef std::map<string, long> StallSitesMap;
+    StallSitesMap mStallSites; ///< number of stalls per call site
 
   public:
 
@@ -57,12 +72,22 @@ namespace p44 {
     /// @return true if feature is initialized
     bool isInitialized() const;
 
+    /// @return true if called from the thread running the mainloop the feature was created in
+    bool inMainThread() const;
+
     /// handle request
     /// @param aRequest the API request to process
     /// @return NULL to send nothing at return (but possibly later via aRequest->sendResponse),
     ///   Error::ok() to just send a empty response, or error to report back
+    /// @note base class dispatches commands and properties registered in mDispatch
     virtual ErrorPtr processRequest(ApiRequestPtr aRequest);
 
+    /// check if a request could be processed, without actually processing it
+    /// @param aRequest the request data
+    /// @return error if request contains an unknown command, NULL otherwise
+    /// @note base class checks commands against those registered in mDispatch
+    virtual ErrorPtr validateRequest(JsonObjectPtr aRequest);
+
     /// @return status information object for initialized feature, bool false for uninitialized
     virtual JsonObjectPtr status();
 
@@ -70,6 +95,11 @@ namespace p44 {
     /// @return error if tool fails, ok otherwise
     virtual ErrorPtr runTool();
 
+    /// called from the mainloop when API client connections or event subscriptions have changed
+    /// @note features that must know whether events are wanted outside the main thread
+    ///   can evaluate eventWanted() here and cache the result
+    virtual void eventSubscriptionsChanged() {};
+
     #if ENABLE_P44SCRIPT
     /// @return a new script object representing this feature. Derived device classes might return different types of device object.
     virtual ScriptObjPtr newFeatureObj();
@@ -77,6 +107,8 @@ namespace p44 {
 
   protected:
 
+    ApiDispatchTable mDispatch; ///< commands and properties of this feature, derived classes register theirs in their constructor
+
     void setInitialized() { initialized = true; }
 
     /// send event message
@@ -84,8 +116,46 @@ namespace p44 {
     /// @note event messages are messages sent by a feature without a preceeding request
     void sendEventMessage(JsonObjectPtr aMessage);
 
+    /// check if an event of a given type would be delivered to anyone
+    /// @param aEventType the event type (value of "event" field, or name of the first field in the message)
+    /// @return true if a client has subscribed to this event, or scripts listen to feature events
+    /// @note use this to avoid building expensive event messages nobody wants. Must only be called
+    ///   from the main thread, see eventSubscriptionsChanged()
+    bool eventWanted(const string aEventType);
+
+  private:
+
+    ErrorPtr statusCmd(ApiRequestPtr aRequest);
+    ErrorPtr commandsCmd(ApiRequestPtr aRequest);
+    ErrorPtr setLogLevelOffsetProp(JsonObjectPtr aValue);
+
+    void callbackFinished(const char *aCallSite, MLMicroSeconds aDuration, bool aNestedStall);
+
+  };
+
+
+  /// measures the run time of a feature callback until it goes out of scope, and reports it to the feature
+  /// when it exceeds the feature's stall budget
+  /// @note when guards are nested, only the innermost callback exceeding the budget is reported
+  /// @note callbacks running in other threads than the feature's mainloop thread do not stall it and are not measured
+  class FeatureStallGuard
+  {
+    Feature &mFeature;
+    const char *mCallSite;
+    MLMicroSeconds mStarted;
+    long mStallsAtStart;
+
+  public:
+
+    /// @param aFeature the feature the callback belongs to
+    /// @param aCallSite name of the callback, must remain valid for the lifetime of the guard
+    FeatureStallGuard(Feature &aFeature, const char *aCallSite);
+    ~FeatureStallGuard();
   };
 
+  /// place at the beginning of a feature method (callback) which might block the mainloop
+  #define FEATURE_STALL_GUARD FeatureStallGuard stallGuard(*this, __func__)
+
 
   #if ENABLE_P44SCRIPT
   namespace P44Script {
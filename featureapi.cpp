@@ -59,6 +59,7 @@
 #endif
 
 
+#include "cborcodec.hpp"
 #include "extutils.hpp"
 #include "macaddress.hpp"
 #include "application.hpp"
@@ -66,12 +67,596 @@
 using namespace p44;
 
 
+// MARK: ===== ApiDispatchTable
+
+void ApiDispatchTable::registerCommand(const string aName, ApiCommandHandler aHandler)
+{
+  EntryPtr e = mCommands.find(aName);
+  if (!e) {
+    e = EntryPtr(new Entry);
+    e->name = aName;
+    mCommands.insert(e);
+  }
+  e->command = aHandler;
+}
+
+
+void ApiDispatchTable::registerProperty(const string aName, ApiPropertyHandler aHandler)
+{
+  EntryPtr e = mProperties.find(aName);
+  if (!e) {
+    e = EntryPtr(new Entry);
+    e->name = aName;
+    e->order = mProperties.size();
+    mProperties.insert(e);
+  }
+  e->property = aHandler; // re-registering keeps the original order
+}
+
+
+static ErrorPtr setBoolProperty(bool *aVarP, JsonObjectPtr aValue)
+{
+  *aVarP = aValue->boolValue();
+  return ErrorPtr();
+}
+
+static ErrorPtr setIntProperty(int *aVarP, JsonObjectPtr aValue)
+{
+  *aVarP = aValue->int32Value();
+  return ErrorPtr();
+}
+
+static ErrorPtr setDoubleProperty(double *aVarP, JsonObjectPtr aValue)
+{
+  *aVarP = aValue->doubleValue();
+  return ErrorPtr();
+}
+
+static ErrorPtr setTimeProperty(MLMicroSeconds *aVarP, JsonObjectPtr aValue)
+{
+  *aVarP = aValue->doubleValue()*Second;
+  return ErrorPtr();
+}
+
+
+void ApiDispatchTable::registerBoolProperty(const string aName, bool &aVar)
+{
+  registerProperty(aName, boost::bind(&setBoolProperty, &aVar, _1));
+}
+
+void ApiDispatchTable::registerIntProperty(const string aName, int &aVar)
+{
+  registerProperty(aName, boost::bind(&setIntProperty, &aVar, _1));
+}
+
+void ApiDispatchTable::registerDoubleProperty(const string aName, double &aVar)
+{
+  registerProperty(aName, boost::bind(&setDoubleProperty, &aVar, _1));
+}
+
+void ApiDispatchTable::registerTimeProperty(const string aName, MLMicroSeconds &aVar)
+{
+  registerProperty(aName, boost::bind(&setTimeProperty, &aVar, _1));
+}
+
+
+const ApiCommandHandler* ApiDispatchTable::findCommand(const string &aName) const
+{
+  EntryPtr e = mCommands.find(aName);
+  if (!e) return NULL;
+  return &(e->command);
+}
+
+
+ApiDispatchTable::EntryPtr ApiDispatchTable::findProperty(const string &aName) const
+{
+  return mProperties.find(aName);
+}
+
+
+typedef std::pair<size_t, std::pair<ApiPropertyHandler, JsonObjectPtr> > PropertyAssignment;
+
+static bool assignmentOrderLess(const PropertyAssignment &aA, const PropertyAssignment &aB)
+{
+  return aA.first<aB.first;
+}
+
+
+ErrorPtr ApiDispatchTable::applyProperties(JsonObjectPtr aData) const
+{
+  if (!aData || !aData->isType(json_type_object)) return ErrorPtr();
+  // look up the fields actually present in the request only (usually very few, compared to the registered properties)
+  std::vector<PropertyAssignment> assignments;
+  string key;
+  JsonObjectPtr val;
+  aData->resetKeyIteration();
+  while (aData->nextKeyValue(key, val)) {
+    if (!val || val->isType(json_type_null)) continue; // null values are ignored
+    EntryPtr e = findProperty(key);
+    if (!e) continue; // not a property (e.g. "cmd", "feature", command parameters)
+    assignments.push_back(PropertyAssignment(e->order, std::make_pair(e->property, val)));
+  }
+  // apply in registration order, independently of the field order in the request
+  std::sort(assignments.begin(), assignments.end(), assignmentOrderLess);
+  for (std::vector<PropertyAssignment>::iterator pos = assignments.begin(); pos!=assignments.end(); ++pos) {
+    ErrorPtr err = pos->second.first(pos->second.second);
+    if (Error::notOK(err)) return err;
+  }
+  return ErrorPtr();
+}
+
+
+JsonObjectPtr ApiDispatchTable::description() const
+{
+  // list names alphabetically
+  std::set<string> names;
+  for (EntryStore::const_iterator pos = mCommands.begin(); pos!=mCommands.end(); ++pos) names.insert((*pos)->name);
+  JsonObjectPtr cmds = JsonObject::newArray();
+  for (std::set<string>::iterator pos = names.begin(); pos!=names.end(); ++pos) cmds->arrayAppend(JsonObject::newString(*pos));
+  names.clear();
+  for (EntryStore::const_iterator pos = mProperties.begin(); pos!=mProperties.end(); ++pos) names.insert((*pos)->name);
+  JsonObjectPtr props = JsonObject::newArray();
+  for (std::set<string>::iterator pos = names.begin(); pos!=names.end(); ++pos) props->arrayAppend(JsonObject::newString(*pos));
+  JsonObjectPtr desc = JsonObject::newObj();
+  desc->add("commands", cmds);
+  desc->add("properties", props);
+  return desc;
+}
+
+
+
+// MARK: ===== EventSubscription
+
+#define DEFAULT_BATCH_MAX_EVENTS 50
+#define MAX_BATCH_WINDOW (1*Second)
+#define DEFAULT_QUEUE_LIMIT (256*1024)
+#define MIN_QUEUE_LIMIT (4*1024)
+#define HARD_QUEUE_LIMIT_FACTOR 4 ///< if non-droppable messages exceed the queue limit by this factor, the client is disconnected
+
+EventSubscription::EventSubscription() :
+  mEnabled(true),
+  mBatchWindow(0),
+  mBatchMaxEvents(DEFAULT_BATCH_MAX_EVENTS),
+  mQueueLimit(DEFAULT_QUEUE_LIMIT),
+  mOverflowPolicy(overflow_dropoldest)
+{
+}
+
+
+static const char *overflowPolicyNames[] = { "dropoldest", "dropnewest", "coalesce" };
+
+
+static ErrorPtr getNameSet(JsonObjectPtr aParams, const char *aKey, EventSubscription::NameSet &aNameSet)
+{
+  aNameSet.clear();
+  JsonObjectPtr o;
+  if (!aParams->get(aKey, o, true)) return ErrorPtr(); // none -> empty set = no restriction
+  if (o->isType(json_type_string)) {
+    aNameSet.insert(o->stringValue());
+  }
+  else if (o->isType(json_type_array)) {
+    for (int i=0; i<o->arrayLength(); i++) {
+      JsonObjectPtr n = o->arrayGet(i);
+      if (!n || !n->isType(json_type_string)) return FeatureApiError::err("'%s' must only contain strings", aKey);
+      aNameSet.insert(n->stringValue());
+    }
+  }
+  else {
+    return FeatureApiError::err("'%s' must be a string or an array of strings", aKey);
+  }
+  return ErrorPtr();
+}
+
+
+static JsonObjectPtr nameSetToJson(const EventSubscription::NameSet &aNameSet)
+{
+  JsonObjectPtr arr = JsonObject::newArray();
+  for (EventSubscription::NameSet::const_iterator pos = aNameSet.begin(); pos!=aNameSet.end(); ++pos) {
+    arr->arrayAppend(JsonObject::newString(*pos));
+  }
+  return arr;
+}
+
+
+ErrorPtr EventSubscription::configure(JsonObjectPtr aParams)
+{
+  ErrorPtr err;
+  mEnabled = true;
+  err = getNameSet(aParams, "features", mFeatures);
+  if (Error::isOK(err)) err = getNameSet(aParams, "events", mEventTypes);
+  if (Error::isOK(err)) err = getNameSet(aParams, "fields", mFields);
+  if (Error::isOK(err)) {
+    JsonObjectPtr o;
+    mBatchWindow = 0;
+    if (aParams->get("batchwindow", o, true)) {
+      mBatchWindow = o->doubleValue()*Second;
+      if (mBatchWindow<0) mBatchWindow = 0;
+      if (mBatchWindow>MAX_BATCH_WINDOW) mBatchWindow = MAX_BATCH_WINDOW;
+    }
+    mBatchMaxEvents = DEFAULT_BATCH_MAX_EVENTS;
+    if (aParams->get("batchsize", o, true)) {
+      mBatchMaxEvents = o->int32Value();
+      if (mBatchMaxEvents<1) mBatchMaxEvents = 1;
+    }
+    mQueueLimit = DEFAULT_QUEUE_LIMIT;
+    if (aParams->get("queuelimit", o, true)) {
+      int64_t l = o->int64Value();
+      mQueueLimit = l<MIN_QUEUE_LIMIT ? MIN_QUEUE_LIMIT : (size_t)l;
+    }
+    mOverflowPolicy = overflow_dropoldest;
+    if (aParams->get("overflow", o, true)) {
+      string p = o->stringValue();
+      int i;
+      for (i=0; i<=overflow_coalesce; i++) {
+        if (p==overflowPolicyNames[i]) { mOverflowPolicy = (OverflowPolicy)i; break; }
+      }
+      if (i>overflow_coalesce) err = FeatureApiError::err("unknown overflow policy '%s'", p.c_str());
+    }
+  }
+  return err;
+}
+
+
+JsonObjectPtr EventSubscription::description() const
+{
+  JsonObjectPtr desc = JsonObject::newObj();
+  desc->add("subscribed", JsonObject::newBool(mEnabled));
+  if (mEnabled) {
+    if (!mFeatures.empty()) desc->add("features", nameSetToJson(mFeatures));
+    if (!mEventTypes.empty()) desc->add("events", nameSetToJson(mEventTypes));
+    if (!mFields.empty()) desc->add("fields", nameSetToJson(mFields));
+    if (mBatchWindow>0) {
+      desc->add("batchwindow", JsonObject::newDouble((double)mBatchWindow/Second));
+      desc->add("batchsize", JsonObject::newInt32(mBatchMaxEvents));
+    }
+  }
+  desc->add("queuelimit", JsonObject::newInt64(mQueueLimit));
+  desc->add("overflow", JsonObject::newString(overflowPolicyNames[mOverflowPolicy]));
+  return desc;
+}
+
+
+bool EventSubscription::matches(const string &aFeature, const string &aEventType) const
+{
+  if (!mEnabled) return false;
+  if (!mFeatures.empty() && mFeatures.find(aFeature)==mFeatures.end()) return false;
+  if (!mEventTypes.empty() && mEventTypes.find(aEventType)==mEventTypes.end()) return false;
+  return true;
+}
+
+
+JsonObjectPtr EventSubscription::project(JsonObjectPtr aEventMessage) const
+{
+  if (!aEventMessage || !aEventMessage->isType(json_type_object)) return aEventMessage;
+  JsonObjectPtr projected = JsonObject::newObj();
+  string key;
+  JsonObjectPtr val;
+  aEventMessage->resetKeyIteration();
+  while (aEventMessage->nextKeyValue(key, val)) {
+    if (key=="feature" || mFields.find(key)!=mFields.end()) {
+      // always include the feature, and all explicitly subscribed top level fields
+      projected->add(key.c_str(), val);
+    }
+    else if (val && val->isType(json_type_object)) {
+      // check for subscribed "field.subfield"
+      JsonObjectPtr sub;
+      string subkey;
+      JsonObjectPtr subval;
+      val->resetKeyIteration();
+      while (val->nextKeyValue(subkey, subval)) {
+        if (mFields.find(key+"."+subkey)!=mFields.end()) {
+          if (!sub) sub = JsonObject::newObj();
+          sub->add(subkey.c_str(), subval);
+        }
+      }
+      if (sub) projected->add(key.c_str(), sub);
+    }
+  }
+  return projected;
+}
+
+
+
+// MARK: ===== FeatureApiConnection
+
+FeatureApiConnection::FeatureApiConnection(JsonCommPtr aJsonComm, int aConnectionId) :
+  mJsonComm(aJsonComm),
+  mConnectionId(aConnectionId),
+  mEncoding(encoding_json),
+  mFrontSent(0),
+  mQueuedBytes(0),
+  mQueueHighWater(0),
+  mDroppedEvents(0),
+  mCoalescedEvents(0),
+  mBatchedEvents(0)
+{
+}
+
+
+FeatureApiConnection::~FeatureApiConnection()
+{
+}
+
+
+bool FeatureApiConnection::isOpen()
+{
+  return mJsonComm && mJsonComm->connected();
+}
+
+
+void FeatureApiConnection::close()
+{
+  mBatchTicket.cancel();
+  mBatch.clear();
+  mBatchedEvents = 0;
+  if (mJsonComm) {
+    mJsonComm->setTransmitHandler(NoOP);
+    mJsonComm->closeConnection();
+  }
+  mSendQueue.clear();
+  mFrontSent = 0;
+  mQueuedBytes = 0;
+  mReceiveBuffer.clear();
+}
+
+
+JsonObjectPtr FeatureApiConnection::status()
+{
+  JsonObjectPtr st = JsonObject::newObj();
+  st->add("id", JsonObject::newInt32(mConnectionId));
+  st->add("encoding", JsonObject::newString(encodingName(mEncoding)));
+  st->add("subscription", mSubscription.description());
+  st->add("queuedmessages", JsonObject::newInt64(mSendQueue.size()));
+  st->add("queuedbytes", JsonObject::newInt64(mQueuedBytes));
+  st->add("queuehighwater", JsonObject::newInt64(mQueueHighWater));
+  st->add("droppedevents", JsonObject::newInt64(mDroppedEvents));
+  st->add("coalescedevents", JsonObject::newInt64(mCoalescedEvents));
+  return st;
+}
+
+
+#define FRAME_HEADER_SIZE 4
+#define MAX_FRAME_SIZE (1024*1024)
+
+static const char *encodingNames[FeatureApiConnection::numEncodings] = { "json", "cbor" };
+
+const char *FeatureApiConnection::encodingName(Encoding aEncoding)
+{
+  if (aEncoding>=numEncodings) return "unknown";
+  return encodingNames[aEncoding];
+}
+
+
+string FeatureApiConnection::encode(JsonObjectPtr aMessage, Encoding aEncoding)
+{
+  if (aEncoding==encoding_cbor) return CborCodec::encode(aMessage);
+  return aMessage ? aMessage->json_str() : "null";
+}
+
+
+string FeatureApiConnection::frame(const string &aPayload) const
+{
+  if (mEncoding==encoding_json) return aPayload + "\n";
+  // binary: 4 byte big endian length prefix
+  string framed;
+  framed.reserve(FRAME_HEADER_SIZE+aPayload.size());
+  uint32_t len = (uint32_t)aPayload.size();
+  for (int s=24; s>=0; s-=8) framed += (char)(len>>s);
+  framed += aPayload;
+  return framed;
+}
+
+
+void FeatureApiConnection::setEncoding(Encoding aEncoding)
+{
+  if (aEncoding==mEncoding) return;
+  sendBatch(); // batch must be completed in the old encoding
+  mEncoding = aEncoding;
+  mReceiveBuffer.clear();
+  if (mJsonComm) {
+    // take over receiving from JsonComm
+    mJsonComm->setReceiveHandler(boost::bind(&FeatureApiConnection::binaryDataReceived, this, _1));
+  }
+  SOLOG(*FeatureApi::sharedApi(), LOG_NOTICE, "connection #%d: switched to %s encoding", mConnectionId, encodingName(mEncoding));
+}
+
+
+void FeatureApiConnection::binaryDataReceived(ErrorPtr aError)
+{
+  if (Error::notOK(aError)) return; // connection status handler will deal with it
+  ErrorPtr err;
+  size_t n = mJsonComm->numBytesReady();
+  if (n>0) {
+    size_t had = mReceiveBuffer.size();
+    mReceiveBuffer.resize(had+n);
+    n = mJsonComm->receiveBytes(n, (uint8_t *)&mReceiveBuffer[had], err);
+    mReceiveBuffer.resize(had+n);
+    if (Error::notOK(err)) return;
+  }
+  // process all complete frames
+  FeatureApiConnectionPtr keepAlive = FeatureApiConnectionPtr(this); // processing might close the connection
+  while (mReceiveBuffer.size()>=FRAME_HEADER_SIZE) {
+    const uint8_t *p = (const uint8_t *)mReceiveBuffer.data();
+    uint32_t len = ((uint32_t)p[0]<<24) | ((uint32_t)p[1]<<16) | ((uint32_t)p[2]<<8) | p[3];
+    if (len>MAX_FRAME_SIZE) {
+      SOLOG(*FeatureApi::sharedApi(), LOG_WARNING, "connection #%d: invalid frame size %u -> closing", mConnectionId, len);
+      close();
+      return;
+    }
+    if (mReceiveBuffer.size()<FRAME_HEADER_SIZE+len) break; // frame not yet complete
+    JsonObjectPtr request = CborCodec::decode(p+FRAME_HEADER_SIZE, len, err);
+    mReceiveBuffer.erase(0, FRAME_HEADER_SIZE+len);
+    FeatureApi::sharedApi()->apiRequestHandler(keepAlive, err, request);
+    if (!isOpen()) return;
+  }
+}
+
+
+void FeatureApiConnection::sendMessage(JsonObjectPtr aMessage)
+{
+  sendText(frame(encode(aMessage, mEncoding)));
+}
+
+
+void FeatureApiConnection::sendText(const string &aMessageText, bool aDroppable, const string &aKey)
+{
+  if (!isOpen()) return;
+  QueuedMessage msg;
+  msg.text = aMessageText;
+  msg.key = aKey;
+  msg.droppable = aDroppable;
+  if (mQueuedBytes+msg.text.size()>mSubscription.mQueueLimit) {
+    if (!msg.droppable) {
+      if (mQueuedBytes+msg.text.size()>HARD_QUEUE_LIMIT_FACTOR*mSubscription.mQueueLimit) {
+        SOLOG(*FeatureApi::sharedApi(), LOG_WARNING, "connection #%d: client does not read its answers, %zu bytes queued -> closing", mConnectionId, mQueuedBytes);
+        close();
+        return;
+      }
+      // answers are always queued, even beyond the limit
+    }
+    else if (!makeRoomFor(msg)) {
+      return; // event dropped or coalesced
+    }
+  }
+  bool wasEmpty = mSendQueue.empty();
+  mQueuedBytes += msg.text.size();
+  if (mQueuedBytes>mQueueHighWater) mQueueHighWater = mQueuedBytes;
+  mSendQueue.push_back(msg);
+  // if there was pending data, we're already waiting for the socket to become writable
+  if (wasEmpty) transmitPending();
+}
+
+
+bool FeatureApiConnection::makeRoomFor(const QueuedMessage &aMsg)
+{
+  // Note: the first message might be partially sent already, so it must not be touched
+  SendQueue::iterator first = mSendQueue.begin();
+  if (first!=mSendQueue.end() && mFrontSent>0) ++first;
+  if (mSubscription.mOverflowPolicy==EventSubscription::overflow_coalesce && !aMsg.key.empty()) {
+    // replace the most recent queued event with the same key
+    for (SendQueue::reverse_iterator pos = mSendQueue.rbegin(); pos!=mSendQueue.rend() && pos.base()!=first; ++pos) {
+      if (pos->droppable && pos->key==aMsg.key) {
+        mQueuedBytes -= pos->text.size();
+        mQueuedBytes += aMsg.text.size();
+        pos->text = aMsg.text;
+        mCoalescedEvents++;
+        return false; // replaced queued message, new one must not be queued again
+      }
+    }
+    // nothing to coalesce with: drop oldest
+  }
+  if (mSubscription.mOverflowPolicy!=EventSubscription::overflow_dropnewest) {
+    // drop oldest events until the new one fits
+    SendQueue::iterator pos = first;
+    while (pos!=mSendQueue.end() && mQueuedBytes+aMsg.text.size()>mSubscription.mQueueLimit) {
+      if (pos->droppable) {
+        mQueuedBytes -= pos->text.size();
+        pos = mSendQueue.erase(pos);
+        mDroppedEvents++;
+      }
+      else {
+        ++pos;
+      }
+    }
+    if (mQueuedBytes+aMsg.text.size()<=mSubscription.mQueueLimit) return true;
+  }
+  // no room: drop the new event
+  mDroppedEvents++;
+  return false;
+}
+
+
+void FeatureApiConnection::sendEvent(const string &aEventText, const string &aKey, bool aImmediate)
+{
+  if (mSubscription.mBatchWindow<=0 || aImmediate) {
+    // send now (but not before events already waiting in a batch)
+    sendBatch();
+    sendText(frame(aEventText), true, aKey);
+    return;
+  }
+  // collect into batch
+  if (mEncoding==encoding_json && mBatchedEvents>0) mBatch += ",";
+  mBatch += aEventText;
+  mBatchedEvents++;
+  if (mBatchedEvents>=mSubscription.mBatchMaxEvents) {
+    sendBatch();
+  }
+  else if (mBatchedEvents==1) {
+    // first event of a new batch starts the batch window
+    mBatchTicket.executeOnce(boost::bind(&FeatureApiConnection::sendBatch, this), mSubscription.mBatchWindow);
+  }
+}
+
+
+void FeatureApiConnection::sendBatch()
+{
+  mBatchTicket.cancel();
+  if (mBatchedEvents==0) return;
+  string payload;
+  if (mEncoding==encoding_json) {
+    payload = "[" + mBatch + "]";
+  }
+  else {
+    // encoded CBOR items can simply be concatenated after an array head
+    CborCodec::appendHead(payload, CborCodec::major_array, mBatchedEvents);
+    payload += mBatch;
+  }
+  sendText(frame(payload), true); // batches can be dropped, but not coalesced
+  mBatch.clear();
+  mBatchedEvents = 0;
+}
+
+
+void FeatureApiConnection::transmitPending()
+{
+  while (!mSendQueue.empty()) {
+    const string &text = mSendQueue.front().text;
+    size_t remaining = text.size()-mFrontSent;
+    ErrorPtr err;
+    size_t sent = mJsonComm->transmitBytes(remaining, (const uint8_t *)text.c_str()+mFrontSent, err);
+    if (Error::notOK(err)) {
+      SOLOG(*FeatureApi::sharedApi(), LOG_WARNING, "connection #%d: error sending: %s -> closing", mConnectionId, err->text());
+      close();
+      return;
+    }
+    mQueuedBytes -= sent;
+    if (sent<remaining) {
+      // socket does not take more right now
+      mFrontSent += sent;
+      break;
+    }
+    mSendQueue.pop_front();
+    mFrontSent = 0;
+  }
+  if (mSendQueue.empty()) {
+    // all sent, no need to get notified about writability
+    mJsonComm->setTransmitHandler(NoOP);
+  }
+  else {
+    // socket did not take everything: continue when it is writable again
+    mJsonComm->setTransmitHandler(boost::bind(&FeatureApiConnection::readyForTransmit, this, _1));
+  }
+}
+
+
+void FeatureApiConnection::readyForTransmit(ErrorPtr aError)
+{
+  if (Error::notOK(aError)) {
+    SOLOG(*FeatureApi::sharedApi(), LOG_WARNING, "connection #%d: transmit error: %s", mConnectionId, aError->text());
+    return;
+  }
+  if (!mSendQueue.empty()) transmitPending();
+}
+
+
+
 // MARK: ===== FeatureApiRequest
 
-FeatureApiRequest::FeatureApiRequest(JsonObjectPtr aRequest, JsonCommPtr aConnection) :
+FeatureApiRequest::FeatureApiRequest(JsonObjectPtr aRequest, FeatureApiConnectionPtr aConnection) :
   inherited(aRequest),
   mConnection(aConnection)
 {
+  if (aRequest) aRequest->get("id", mId, true);
 }
 
 
@@ -86,6 +671,15 @@ void FeatureApiRequest::sendResponse(JsonObjectPtr aResponse, ErrorPtr aError)
     aResponse = JsonObject::newObj();
     aResponse->add("Error", JsonObject::newString(aError->description()));
   }
+  if (mId) {
+    // echo the correlation id, so client can match out-of-order answers to pipelined requests
+    if (!aResponse || !aResponse->isType(json_type_object)) {
+      JsonObjectPtr wrapped = JsonObject::newObj();
+      wrapped->add("result", aResponse);
+      aResponse = wrapped;
+    }
+    aResponse->add("id", mId);
+  }
   if (mConnection) mConnection->sendMessage(aResponse);
   SOLOG(*FeatureApi::sharedApi(), LOG_INFO,"answer: %s", aResponse->c_strValue());
 }
@@ -153,8 +747,24 @@ FeatureApiPtr FeatureApi::sharedApi()
 }
 
 
-FeatureApi::FeatureApi()
+FeatureApi::FeatureApi() :
+  mNextConnectionId(1)
 {
+  mGlobalCommands.registerCommand("nop", boost::bind(&FeatureApi::nop, this, _1));
+  mGlobalCommands.registerCommand("commands", boost::bind(&FeatureApi::commands, this, _1));
+  #if ENABLE_LEGACY_FEATURE_SCRIPTS
+  mGlobalCommands.registerCommand("call", boost::bind(&FeatureApi::call, this, _1));
+  #endif
+  mGlobalCommands.registerCommand("init", boost::bind(&FeatureApi::init, this, _1));
+  mGlobalCommands.registerCommand("reset", boost::bind(&FeatureApi::reset, this, _1));
+  mGlobalCommands.registerCommand("now", boost::bind(&FeatureApi::now, this, _1));
+  mGlobalCommands.registerCommand("status", boost::bind(&FeatureApi::status, this, _1));
+  mGlobalCommands.registerCommand("ping", boost::bind(&FeatureApi::ping, this, _1));
+  mGlobalCommands.registerCommand("metrics", boost::bind(&FeatureApi::metrics, this, _1));
+  mGlobalCommands.registerCommand("subscribe", boost::bind(&FeatureApi::subscribe, this, _1, true));
+  mGlobalCommands.registerCommand("unsubscribe", boost::bind(&FeatureApi::subscribe, this, _1, false));
+  mGlobalCommands.registerCommand("encoding", boost::bind(&FeatureApi::encoding, this, _1));
+  mGlobalCommands.registerCommand("batch", boost::bind(&FeatureApi::batch, this, _1));
 }
 
 
@@ -343,26 +953,54 @@ FeaturePtr FeatureApi::getFeature(const string aFeatureName)
 void FeatureApi::addFeature(FeaturePtr aFeature)
 {
   mFeatureMap[aFeature->getName()] = aFeature;
+  subscriptionsChanged();
 }
 
 
 SocketCommPtr FeatureApi::apiConnectionHandler(SocketCommPtr aServerSocketComm)
 {
   JsonCommPtr conn = JsonCommPtr(new JsonComm(MainLoop::currentMainLoop()));
-  conn->setMessageHandler(boost::bind(&FeatureApi::apiRequestHandler, this, conn, _1, _2));
+  FeatureApiConnectionPtr apiConn = FeatureApiConnectionPtr(new FeatureApiConnection(conn, mNextConnectionId++));
+  conn->setMessageHandler(boost::bind(&FeatureApi::apiRequestHandler, this, apiConn, _1, _2));
+  conn->setConnectionStatusHandler(boost::bind(&FeatureApi::apiConnectionStatusHandler, this, apiConn, _1, _2));
   conn->setClearHandlersAtClose(); // close must break retain cycles so this object won't cause a mem leak
-
-  mConnection = conn;
+  // register, so it gets events along with all other clients
+  mConnections.push_back(apiConn);
+  subscriptionsChanged();
+  OLOG(LOG_NOTICE, "API client connection #%d opened, %zu clients connected now", apiConn->getConnectionId(), mConnections.size());
   return conn;
 }
 
 
-void FeatureApi::apiRequestHandler(JsonCommPtr aConnection, ErrorPtr aError, JsonObjectPtr aRequest)
+void FeatureApi::apiConnectionStatusHandler(FeatureApiConnectionPtr aConnection, SocketCommPtr aSocketComm, ErrorPtr aError)
+{
+  if (Error::notOK(aError)) {
+    // connection closed or failed: unregister
+    mConnections.remove(aConnection);
+    subscriptionsChanged();
+    OLOG(LOG_NOTICE, "API client connection #%d closed (%s), %zu clients connected now", aConnection->getConnectionId(), aError->text(), mConnections.size());
+  }
+}
+
+
+void FeatureApi::apiRequestHandler(FeatureApiConnectionPtr aConnection, ErrorPtr aError, JsonObjectPtr aRequest)
 {
+  if (Error::isOK(aError) && (!aRequest || !aRequest->isType(json_type_object))) {
+    // valid JSON/CBOR, but not a request (e.g. a CBOR null decodes to no object at all)
+    aError = FeatureApiError::err("request must be a JSON object");
+  }
   if (Error::isOK(aError)) {
-    OLOG(LOG_INFO,"request: %s", aRequest->c_strValue());
-    ApiRequestPtr req = ApiRequestPtr(new FeatureApiRequest(aRequest, aConnection));
+    OLOG(LOG_INFO,"request on connection #%d: %s", aConnection->getConnectionId(), aRequest->c_strValue());
+    FeatureApiRequestPtr req = FeatureApiRequestPtr(new FeatureApiRequest(aRequest, aConnection));
     aError = processRequest(req);
+    if (req->getId()) {
+      // pipelining client: every request gets exactly one answer, including the error or an empty one
+      if (aError) {
+        if (aError->isOK()) aError.reset();
+        req->sendResponse(JsonObject::newObj(), aError);
+      }
+      return;
+    }
   }
   if (!Error::isOK(aError)) {
     // error
@@ -412,7 +1050,17 @@ ErrorPtr FeatureApi::processRequest(ApiRequestPtr aRequest)
       return FeatureApiError::err("feature '%s' is not yet initialized", featurename.c_str());
     }
     // let feature handle it
-    ErrorPtr err = f->second->processRequest(aRequest);
+    // Note: only the synchronous part is timed, this is what blocks the mainloop
+    string op = "properties";
+    if (reqData->get("cmd", o, true)) op = o->stringValue();
+    string site = "request " + op;
+    MLMicroSeconds started = MainLoop::now();
+    ErrorPtr err;
+    {
+      FeatureStallGuard stallGuard(*(f->second), site.c_str());
+      err = f->second->processRequest(aRequest);
+    }
+    mMetrics.record(featurename, op, MainLoop::now()-started, Error::notOK(err));
     if (!Error::isOK(err)) {
       err->prefixMessage("Feature '%s' cannot process request: ", featurename.c_str());
     }
@@ -441,42 +1089,80 @@ ErrorPtr FeatureApi::processRequest(ApiRequestPtr aRequest)
       return FeatureApiError::err("missing 'feature' or 'cmd' attribute");
     }
     string cmd = o->stringValue();
-    if (cmd=="nop") {
-      // no operation (e.g. script steps that only wait)
-      return Error::ok();
-    }
-    #if ENABLE_LEGACY_FEATURE_SCRIPTS
-    if (cmd=="call") {
-      return call(aRequest);
-    }
-    #endif
-    if (cmd=="init") {
-      return init(aRequest);
-    }
-    else if (cmd=="reset") {
-      return reset(aRequest);
-    }
-    else if (cmd=="now") {
-      return now(aRequest);
-    }
-    else if (cmd=="status") {
-      return status(aRequest);
-    }
-    else if (cmd=="ping") {
-      return ping(aRequest);
+    const ApiCommandHandler *handler = mGlobalCommands.findCommand(cmd);
+    if (handler) {
+      MLMicroSeconds started = MainLoop::now();
+      ErrorPtr err = (*handler)(aRequest);
+      mMetrics.record(GLOBAL_METRICS_NAME, cmd, MainLoop::now()-started, Error::notOK(err));
+      return err;
     }
     #if ENABLE_P44SCRIPT
-    else if (mUnhandledRequestSource.hasSinks()) {
+    if (mUnhandledRequestSource.hasSinks()) {
       OLOG(LOG_NOTICE, "call for internally unknown cmd '%s' -> let script check", cmd.c_str());
       // let scripted feature handler process unknown command
       mUnhandledRequestSource.sendEvent(new FeatureRequestObj(aRequest));
       return ErrorPtr(); // no default response, event handler must send it
     }
     #endif
-    else {
-      return FeatureApiError::err("unknown global command '%s'", cmd.c_str());
+    return FeatureApiError::err("unknown global command '%s'", cmd.c_str());
+  }
+}
+
+
+ErrorPtr FeatureApi::validateRequest(JsonObjectPtr aRequest)
+{
+  if (!aRequest || !aRequest->isType(json_type_object)) {
+    return FeatureApiError::err("request must be a JSON object");
+  }
+  JsonObjectPtr o;
+  if (aRequest->get("feature", o, true)) {
+    if (!o->isType(json_type_string)) {
+      return FeatureApiError::err("'feature' attribute must be a string");
+    }
+    string featurename = o->stringValue();
+    FeatureMap::iterator f = mFeatureMap.find(featurename);
+    if (f==mFeatureMap.end()) {
+      #if ENABLE_P44SCRIPT
+      if (mUnhandledRequestSource.hasSinks()) return ErrorPtr(); // script might handle it
+      #endif
+      return FeatureApiError::err("unknown feature '%s'", featurename.c_str());
+    }
+    if (!f->second->isInitialized()) {
+      return FeatureApiError::err("feature '%s' is not yet initialized", featurename.c_str());
     }
+    return f->second->validateRequest(aRequest);
+  }
+  #if ENABLE_P44SCRIPT
+  if (aRequest->get("run") || aRequest->get("event")) return ErrorPtr();
+  #endif
+  if (!aRequest->get("cmd", o, true)) {
+    return FeatureApiError::err("missing 'feature' or 'cmd' attribute");
+  }
+  string cmd = o->stringValue();
+  if (cmd=="batch") {
+    return FeatureApiError::err("batch requests cannot be nested");
+  }
+  if (!mGlobalCommands.findCommand(cmd)) {
+    #if ENABLE_P44SCRIPT
+    if (mUnhandledRequestSource.hasSinks()) return ErrorPtr(); // script might handle it
+    #endif
+    return FeatureApiError::err("unknown global command '%s'", cmd.c_str());
   }
+  return ErrorPtr();
+}
+
+
+ErrorPtr FeatureApi::nop(ApiRequestPtr aRequest)
+{
+  // no operation (e.g. script steps that only wait)
+  return Error::ok();
+}
+
+
+ErrorPtr FeatureApi::commands(ApiRequestPtr aRequest)
+{
+  aRequest->sendResponse(mGlobalCommands.description(), ErrorPtr());
+  return ErrorPtr();
 }
 
 
@@ -512,7 +1198,12 @@ ErrorPtr FeatureApi::init(ApiRequestPtr aRequest)
     if (initData) {
       featureFound = true;
       SOLOG(*(f->second), LOG_NOTICE, "initializing...");
-      err = f->second->initialize(initData);
+      MLMicroSeconds started = MainLoop::now();
+      {
+        FeatureStallGuard stallGuard(*(f->second), "initialize");
+        err = f->second->initialize(initData);
+      }
+      mMetrics.record(f->first, "init", MainLoop::now()-started, Error::notOK(err));
       SOLOG(*(f->second), LOG_NOTICE, "initialized: err=%s", Error::text(err));
       if (!Error::isOK(err)) {
         err->prefixMessage("Feature '%s' init failed: ", f->first.c_str());
@@ -550,7 +1241,9 @@ ErrorPtr FeatureApi::status(ApiRequestPtr aRequest)
   // - list initialized features
   JsonObjectPtr features = JsonObject::newObj();
   for (FeatureMap::iterator f = mFeatureMap.begin(); f!=mFeatureMap.end(); ++f) {
+    MLMicroSeconds started = MainLoop::now();
     features->add(f->first.c_str(), f->second->status());
+    mMetrics.record(f->first, "status()", MainLoop::now()-started, false);
   }
   answer->add("features", features);
   // - grid coordinate
@@ -560,12 +1253,34 @@ ErrorPtr FeatureApi::status(ApiRequestPtr aRequest)
   answer->add("ipv4", JsonObject::newString(ipv4ToString(ipv4Address())));
   answer->add("now", JsonObject::newInt64((double)MainLoop::unixtime()/Second));
   answer->add("version", JsonObject::newString(Application::sharedApplication()->version()));
+  // - API clients
+  answer->add("apiclients", JsonObject::newInt64(mConnections.size()));
+  JsonObjectPtr conns = JsonObject::newArray();
+  for (ApiConnectionsList::iterator pos = mConnections.begin(); pos!=mConnections.end(); ++pos) {
+    conns->arrayAppend((*pos)->status());
+  }
+  answer->add("apiconnections", conns);
+  // - request metrics summary (per feature totals)
+  answer->add("metrics", mMetrics.json(false));
   // - return
   aRequest->sendResponse(answer, ErrorPtr());
   return ErrorPtr();
 }
 
 
+ErrorPtr FeatureApi::metrics(ApiRequestPtr aRequest)
+{
+  JsonObjectPtr answer = mMetrics.json(true);
+  JsonObjectPtr o;
+  if (aRequest->getRequest()->get("reset", o) && o->boolValue()) {
+    OLOG(LOG_NOTICE, "request metrics reset");
+    mMetrics.reset();
+  }
+  aRequest->sendResponse(answer, ErrorPtr());
+  return ErrorPtr();
+}
+
+
 ErrorPtr FeatureApi::ping(ApiRequestPtr aRequest)
 {
   JsonObjectPtr answer = JsonObject::newObj();
@@ -575,6 +1290,147 @@ ErrorPtr FeatureApi::ping(ApiRequestPtr aRequest)
 }
 
 
+ErrorPtr FeatureApi::subscribe(ApiRequestPtr aRequest, bool aSubscribe)
+{
+  FeatureApiRequest* req = dynamic_cast<FeatureApiRequest*>(aRequest.get());
+  if (!req || !req->getConnection()) {
+    return FeatureApiError::err("event subscriptions are only available on API client connections");
+  }
+  EventSubscription& sub = req->getConnection()->subscription();
+  if (aSubscribe) {
+    ErrorPtr err = sub.configure(aRequest->getRequest());
+    if (Error::notOK(err)) return err;
+  }
+  else {
+    sub.mEnabled = false;
+  }
+  subscriptionsChanged();
+  aRequest->sendResponse(sub.description(), ErrorPtr());
+  return ErrorPtr();
+}
+
+
+ErrorPtr FeatureApi::encoding(ApiRequestPtr aRequest)
+{
+  FeatureApiRequest* req = dynamic_cast<FeatureApiRequest*>(aRequest.get());
+  if (!req || !req->getConnection()) {
+    return FeatureApiError::err("encoding can only be set on API client connections");
+  }
+  FeatureApiConnectionPtr conn = req->getConnection();
+  JsonObjectPtr o;
+  if (!aRequest->getRequest()->get("encoding", o, true)) {
+    return FeatureApiError::err("missing 'encoding'");
+  }
+  string encName = o->stringValue();
+  int enc;
+  for (enc=0; enc<FeatureApiConnection::numEncodings; enc++) {
+    if (encName==FeatureApiConnection::encodingName((FeatureApiConnection::Encoding)enc)) break;
+  }
+  if (enc>=FeatureApiConnection::numEncodings) {
+    return FeatureApiError::err("unknown encoding '%s'", encName.c_str());
+  }
+  if (enc!=conn->getEncoding() && conn->getEncoding()!=FeatureApiConnection::encoding_json) {
+    return FeatureApiError::err("cannot switch back from %s encoding", FeatureApiConnection::encodingName(conn->getEncoding()));
+  }
+  // answer in current encoding, then switch
+  JsonObjectPtr ans = JsonObject::newObj();
+  ans->add("encoding", JsonObject::newString(encName));
+  aRequest->sendResponse(ans, ErrorPtr());
+  conn->setEncoding((FeatureApiConnection::Encoding)enc);
+  return ErrorPtr();
+}
+
+
+namespace {
+
+  /// state of a batch request while its sub-requests are running
+  class ApiBatch : public P44Obj
+  {
+  public:
+    ApiRequestPtr mRequest; ///< the batch request, to be answered when all sub-requests are done
+    std::vector<JsonObjectPtr> mResults; ///< results of the sub-requests
+    std::vector<bool> mDone; ///< set for sub-requests already answered
+    size_t mPending; ///< number of sub-requests not yet answered (+1 while still starting sub-requests)
+  };
+  typedef boost::intrusive_ptr<ApiBatch> ApiBatchPtr;
+
+} // anonymous namespace
+
+
+static void batchPendingDone(ApiBatchPtr aBatch)
+{
+  if (--aBatch->mPending>0) return;
+  // all sub-requests done: answer with array of all results
+  JsonObjectPtr results = JsonObject::newArray();
+  for (size_t i=0; i<aBatch->mResults.size(); i++) {
+    results->arrayAppend(aBatch->mResults[i]);
+  }
+  aBatch->mRequest->sendResponse(results, ErrorPtr());
+}
+
+
+static void batchItemDone(ApiBatchPtr aBatch, size_t aIndex, JsonObjectPtr aResponse, ErrorPtr aError)
+{
+  if (aBatch->mDone[aIndex]) return; // only the first answer counts
+  aBatch->mDone[aIndex] = true;
+  if (Error::notOK(aError)) {
+    aResponse = JsonObject::newObj();
+    aResponse->add("Error", JsonObject::newString(aError->description()));
+  }
+  aBatch->mResults[aIndex] = aResponse;
+  batchPendingDone(aBatch);
+}
+
+
+ErrorPtr FeatureApi::batch(ApiRequestPtr aRequest)
+{
+  JsonObjectPtr reqs;
+  if (!aRequest->getRequest()->get("requests", reqs, true) || !reqs->isType(json_type_array)) {
+    return FeatureApiError::err("'requests' must be an array of requests");
+  }
+  size_t n = reqs->arrayLength();
+  JsonObjectPtr o;
+  if (aRequest->getRequest()->get("atomic", o, true) && o->boolValue()) {
+    // all or nothing: check all requests before running any of them
+    for (size_t i=0; i<n; i++) {
+      ErrorPtr err = validateRequest(reqs->arrayGet((int)i));
+      if (Error::notOK(err)) {
+        err->prefixMessage("batch not executed, request #%zu invalid: ", i);
+        return err;
+      }
+    }
+  }
+  ApiBatchPtr batch = ApiBatchPtr(new ApiBatch);
+  batch->mRequest = aRequest;
+  batch->mResults.resize(n);
+  batch->mDone.resize(n, false);
+  batch->mPending = n+1; // prevent answering before all sub-requests are started
+  // run all sub-requests now, within this mainloop cycle
+  for (size_t i=0; i<n; i++) {
+    JsonObjectPtr sub = reqs->arrayGet((int)i);
+    ErrorPtr err;
+    if (!sub || !sub->isType(json_type_object)) {
+      err = FeatureApiError::err("request must be a JSON object");
+    }
+    else if (!sub->get("feature") && sub->get("cmd", o, true) && o->stringValue()=="batch") {
+      err = FeatureApiError::err("batch requests cannot be nested");
+    }
+    else {
+      OLOG(LOG_INFO, "batch request #%zu: %s", i, sub->c_strValue());
+      err = processRequest(ApiRequestPtr(new APICallbackRequest(sub, boost::bind(&batchItemDone, batch, i, _1, _2))));
+      if (!err) continue; // answer is (or was already) delivered via callback
+      if (err->isOK()) {
+        batchItemDone(batch, i, JsonObject::newObj(), ErrorPtr()); // empty answer
+        continue;
+      }
+    }
+    batchItemDone(batch, i, JsonObjectPtr(), err);
+  }
+  batchPendingDone(batch);
+  return ErrorPtr();
+}
+
+
 void FeatureApi::start(const string aApiPort, int aProtocolFamily)
 {
   mApiServer = SocketCommPtr(new SocketComm(MainLoop::currentMainLoop()));
@@ -585,10 +1441,10 @@ void FeatureApi::start(const string aApiPort, int aProtocolFamily)
 }
 
 
-void FeatureApi::sendEventMessage(JsonObjectPtr aEventMessage)
+void FeatureApi::sendEventMessage(JsonObjectPtr aEventMessage, bool aImmediate)
 {
   sendEventMessageInternally(aEventMessage);
-  sendEventMessageToApiClient(aEventMessage);
+  sendEventMessageToApiClient(aEventMessage, aImmediate);
 }
 
 
@@ -602,19 +1458,86 @@ void FeatureApi::sendEventMessageInternally(JsonObjectPtr aEventMessage)
 }
 
 
-void FeatureApi::sendEventMessageToApiClient(JsonObjectPtr aEventMessage)
+string FeatureApi::eventType(JsonObjectPtr aEventMessage)
+{
+  if (!aEventMessage || !aEventMessage->isType(json_type_object)) return "";
+  JsonObjectPtr o;
+  if (aEventMessage->get("event", o, true) && o->isType(json_type_string)) return o->stringValue();
+  string key;
+  aEventMessage->resetKeyIteration();
+  while (aEventMessage->nextKeyValue(key, o)) {
+    if (key!="feature") return key;
+  }
+  return "";
+}
+
+
+bool FeatureApi::wantsEvent(const string &aFeature, const string &aEventType)
+{
+  #if ENABLE_P44SCRIPT
+  if (mFeatureEventSource.hasSinks()) return true; // scripts might want to see it
+  #endif
+  for (ApiConnectionsList::iterator pos = mConnections.begin(); pos!=mConnections.end(); ++pos) {
+    if ((*pos)->subscription().matches(aFeature, aEventType)) return true;
+  }
+  return false;
+}
+
+
+void FeatureApi::subscriptionsChanged()
+{
+  // deferred, so changes made later in the same mainloop cycle (e.g. scripts registering as event sinks) are covered, too
+  mSubscriptionsTicket.executeOnce(boost::bind(&FeatureApi::notifySubscriptionsChanged, this, _1));
+}
+
+
+void FeatureApi::notifySubscriptionsChanged(MLTimer &aTimer)
+{
+  for (FeatureMap::iterator f = mFeatureMap.begin(); f!=mFeatureMap.end(); ++f) {
+    f->second->eventSubscriptionsChanged();
+  }
+}
+
+
+void FeatureApi::sendEventMessageToApiClient(JsonObjectPtr aEventMessage, bool aImmediate)
 {
-  if (!mConnection) {
+  if (mConnections.empty()) {
     OLOG(LOG_INFO, "no API connection, event message not sent out: %s", JsonObject::text(aEventMessage));
     return;
   }
-  ErrorPtr err = mConnection->sendMessage(aEventMessage);
-  if (Error::notOK(err)) {
-    OLOG(LOG_ERR, "Error sending message: %s", err->text());
-  }
-  else {
-    OLOG(LOG_INFO,"event message: %s", aEventMessage->c_strValue());
+  string featureName;
+  JsonObjectPtr o;
+  if (aEventMessage && aEventMessage->get("feature", o, true)) featureName = o->stringValue();
+  string evType = eventType(aEventMessage);
+  string key = featureName + ":" + evType;
+  // serialize complete message only once per encoding for all clients not needing projection
+  string encoded[FeatureApiConnection::numEncodings];
+  // Note: iterate over a copy, as a failing send might close and unregister the connection
+  ApiConnectionsList conns = mConnections;
+  int numSent = 0;
+  for (ApiConnectionsList::iterator pos = conns.begin(); pos!=conns.end(); ++pos) {
+    FeatureApiConnectionPtr conn = *pos;
+    if (!conn->isOpen()) {
+      // closed without us getting notified: forget it
+      mConnections.remove(conn);
+      subscriptionsChanged();
+      continue;
+    }
+    const EventSubscription& sub = conn->subscription();
+    if (!sub.matches(featureName, evType)) continue; // not subscribed
+    if (sub.projects()) {
+      conn->sendEvent(FeatureApiConnection::encode(sub.project(aEventMessage), conn->getEncoding()), key, aImmediate);
+    }
+    else {
+      string &msg = encoded[conn->getEncoding()];
+      if (msg.empty()) {
+        msg = FeatureApiConnection::encode(aEventMessage, conn->getEncoding());
+      }
+      conn->sendEvent(msg, key, aImmediate);
+    }
+    numSent++;
   }
+  OLOG(LOG_INFO,"event message sent to %d clients: %s", numSent, JsonObject::text(aEventMessage));
 }
 
 
@@ -719,7 +1642,7 @@ void FeatureApi::addFeaturesFromCommandLine(
   if (a->getIntOption("wifitrack", doStart)) {
     int rtdbo = 0;
     a->getIntOption("wifidboffs",rtdbo);
-    sharedApi()->addFeature(FeaturePtr(new WifiTrack(a->getOption("wifimonif",""), rtdbo, doStart)));
+    sharedApi()->addFeature(FeaturePtr(new WifiTrack(a->getOption("wifimonif",""), rtdbo, a->getOption("wifinative"), doStart)));
   }
   #endif
   #if ENABLE_FEATURE_HERMEL
@@ -837,6 +1760,7 @@ static void featureevent_func(BuiltinFunctionContextPtr f)
   if (f->numArgs()==0) {
     // return placeholder for incoming feature events
     f->finish(new OneShotEventNullValue(dynamic_cast<EventSource *>(&(FeatureApi::sharedApi()->mFeatureEventSource)), "feature event"));
+    FeatureApi::sharedApi()->subscriptionsChanged(); // scripts might be listening now
     return;
   }
   // send a feature API event message (to API client)
@@ -27,6 +27,12 @@
 
 #include "jsoncomm.hpp"
 #include "p44script.hpp"
+#include "featuremetrics.hpp"
+#include "hashstore.hpp"
+
+#include <set>
+#include <list>
+#include <map>
 #if ENABLE_LEDARRANGEMENT
   #include "ledchaincomm.hpp"
 #endif
@@ -46,6 +52,9 @@ namespace p44 {
   class Feature;
   typedef boost::intrusive_ptr<Feature> FeaturePtr;
 
+  class FeatureApiConnection;
+  typedef boost::intrusive_ptr<FeatureApiConnection> FeatureApiConnectionPtr;
+
 
   /// abstract API request base class
   class ApiRequest : public P44Obj
@@ -69,23 +78,275 @@ namespace p44 {
   };
 
 
+  typedef boost::function<ErrorPtr (ApiRequestPtr aRequest)> ApiCommandHandler;
+  typedef boost::function<ErrorPtr (JsonObjectPtr aValue)> ApiPropertyHandler;
+
+  /// table of API commands and properties, looked up in constant time in open addressing hash tables
+  class ApiDispatchTable
+  {
+    class Entry : public P44Obj
+    {
+    public:
+      string name;
+      ApiCommandHandler command;
+      ApiPropertyHandler property;
+      size_t order; ///< registration order of properties
+    };
+    typedef boost::intrusive_ptr<Entry> EntryPtr;
+
+    /// key operations for storing entries in a HashStore, keyed by name
+    struct EntryKeyOps
+    {
+      typedef string Key;
+      static Key key(const Entry &aEntry) { return aEntry.name; }
+      static uint32_t hash(const Key &aKey) { return hashBytes(aKey.c_str(), aKey.size()); }
+      static bool matches(const Entry &aEntry, const Key &aKey) { return aEntry.name==aKey; }
+      static bool less(const Entry &aA, const Entry &aB) { return aA.name<aB.name; }
+    };
+    typedef HashStore<Entry, EntryKeyOps> EntryStore;
+
+    EntryStore mCommands;
+    EntryStore mProperties;
+
+    EntryPtr findProperty(const string &aName) const;
+
+  public:
+
+    /// register a command
+    /// @param aName the command name (value of "cmd" in requests)
+    /// @param aHandler the handler to call for the command. Registering a name again replaces the previous handler.
+    void registerCommand(const string aName, ApiCommandHandler aHandler);
+
+    /// register a property
+    /// @param aName the property name (field name in requests without "cmd")
+    /// @param aHandler the handler to call with the (non-null) property value
+    /// @note when a request sets multiple properties, these are applied in registration order.
+    ///   Registering a name again replaces the previous handler, but keeps the original order.
+    void registerProperty(const string aName, ApiPropertyHandler aHandler);
+
+    /// register simple properties directly setting a variable
+    /// @param aName the property name
+    /// @param aVar the variable to set. Must live as long as the dispatch table
+    void registerBoolProperty(const string aName, bool &aVar);
+    void registerIntProperty(const string aName, int &aVar);
+    void registerDoubleProperty(const string aName, double &aVar);
+    /// @note value is in seconds in the API
+    void registerTimeProperty(const string aName, MLMicroSeconds &aVar);
+
+    /// find command
+    /// @param aName the command name
+    /// @return pointer to the handler, NULL if command is unknown
+    const ApiCommandHandler* findCommand(const string &aName) const;
+
+    /// apply all known properties found in a request, in registration order
+    /// @param aData the request data
+    /// @return error from the first failing property handler (remaining properties are not applied), NULL if ok
+    /// @note null values and unknown fields are ignored
+    ErrorPtr applyProperties(JsonObjectPtr aData) const;
+
+    /// @return object with "commands" and "properties" arrays listing the registered names
+    JsonObjectPtr description() const;
+
+  };
+
+
+  /// event subscription of an API client
+  class EventSubscription
+  {
+  public:
+
+    typedef std::set<string> NameSet;
+
+    bool mEnabled; ///< if not set, client does not get any events
+    NameSet mFeatures; ///< names of features to get events from, empty for all
+    NameSet mEventTypes; ///< event types to get, empty for all
+    NameSet mFields; ///< fields to include in events (top level or "field.subfield"), empty for complete events
+    MLMicroSeconds mBatchWindow; ///< if >0, events are collected for this time and then sent as one JSON array
+    int mBatchMaxEvents; ///< when this many events are collected, batch is sent before batch window ends
+
+    /// what to do with events when the send queue of a client is full
+    typedef enum {
+      overflow_dropoldest, ///< drop the oldest queued events to make room for the new one
+      overflow_dropnewest, ///< drop the new event
+      overflow_coalesce, ///< new event replaces a queued event of the same feature and type (drop oldest if none)
+    } OverflowPolicy;
+    size_t mQueueLimit; ///< max number of bytes queued for sending before events are dropped
+    OverflowPolicy mOverflowPolicy; ///< policy for handling send queue overflow
+
+    EventSubscription();
+
+    /// configure from API request parameters
+    /// @param aParams object with optional "features", "events" and "fields" (each string or array of strings),
+    ///   optional "batchwindow" (seconds) and "batchsize" (max number of events per batch),
+    ///   and optional "queuelimit" (bytes) and "overflow" ("dropoldest", "dropnewest" or "coalesce")
+    /// @return error if parameters are invalid
+    ErrorPtr configure(JsonObjectPtr aParams);
+
+    /// @return description of the subscription, suitable for API answers and status
+    JsonObjectPtr description() const;
+
+    /// check if an event is subscribed
+    /// @param aFeature name of the feature sending the event
+    /// @param aEventType the event type (see FeatureApi::eventType())
+    /// @return true if event matches this subscription
+    bool matches(const string &aFeature, const string &aEventType) const;
+
+    /// @return true if this subscription only wants some fields of the events
+    bool projects() const { return !mFields.empty(); }
+
+    /// @param aEventMessage the complete event message
+    /// @return new event message object containing only the subscribed fields
+    JsonObjectPtr project(JsonObjectPtr aEventMessage) const;
+
+  };
+
+
+  /// a single client connection to the TCP feature API
+  class FeatureApiConnection : public P44Obj
+  {
+    friend class FeatureApi;
+
+  public:
+
+    /// message encodings
+    typedef enum {
+      encoding_json, ///< JSON text messages, separated by line ends (default)
+      encoding_cbor, ///< CBOR messages, each prefixed by its length as 4-byte big endian number
+      numEncodings
+    } Encoding;
+
+  private:
+
+    JsonCommPtr mJsonComm; ///< the JSON connection, used for receiving requests and as socket for sending
+    int mConnectionId; ///< sequential number for identifying the connection in logs and status
+    Encoding mEncoding; ///< current encoding of messages in both directions
+    string mReceiveBuffer; ///< received bytes not yet forming a complete frame (binary encodings only)
+
+    /// a message waiting to be sent
+    typedef struct {
+      string text; ///< serialized message including line terminator
+      string key; ///< coalescing key (feature:eventtype), empty if message cannot be coalesced
+      bool droppable; ///< set for events, which can be dropped or coalesced when the queue is full
+    } QueuedMessage;
+    typedef std::list<QueuedMessage> SendQueue;
+    SendQueue mSendQueue; ///< serialized messages not yet (completely) accepted by the socket
+    size_t mFrontSent; ///< number of bytes of the first message in mSendQueue already sent
+    size_t mQueuedBytes; ///< number of bytes in mSendQueue not yet sent
+    // send queue statistics
+    size_t mQueueHighWater; ///< max number of bytes ever queued
+    long mDroppedEvents; ///< number of events dropped due to queue overflow
+    long mCoalescedEvents; ///< number of events replaced by newer ones due to queue overflow
+
+    EventSubscription mSubscription; ///< the events this client wants to get
+    string mBatch; ///< encoded events collected for sending as a batch
+    int mBatchedEvents; ///< number of events in mBatch
+    MLTicket mBatchTicket; ///< timer for sending the batch at the end of the batch window
+
+  public:
+
+    FeatureApiConnection(JsonCommPtr aJsonComm, int aConnectionId);
+    virtual ~FeatureApiConnection();
+
+    /// @return the connection id
+    int getConnectionId() const { return mConnectionId; }
+
+    /// @return true if the connection is still open
+    bool isOpen();
+
+    /// send a JSON message to this client
+    /// @param aMessage the message to send
+    void sendMessage(JsonObjectPtr aMessage);
+
+    /// @return current message encoding
+    Encoding getEncoding() const { return mEncoding; }
+
+    /// switch message encoding for both directions
+    /// @param aEncoding the new encoding
+    /// @note messages already queued for sending remain in the previous encoding, so switching
+    ///   right after queuing the answer to the switch request delivers that answer in the old encoding.
+    /// @note switching back from a binary encoding to JSON is not possible.
+    void setEncoding(Encoding aEncoding);
+
+    /// @param aEncoding an encoding
+    /// @return name of the encoding
+    static const char *encodingName(Encoding aEncoding);
+
+    /// @param aMessage the message to encode
+    /// @param aEncoding the encoding to use
+    /// @return encoded message, without framing
+    static string encode(JsonObjectPtr aMessage, Encoding aEncoding);
+
+    /// @param aPayload encoded message
+    /// @return the message with framing for the current encoding (line end for JSON, length prefix for binary encodings)
+    string frame(const string &aPayload) const;
+
+    /// send an already serialized message to this client
+    /// @param aMessageText the serialized message, including framing
+    /// @param aDroppable if set, the message may be dropped when the send queue is full
+    /// @param aKey coalescing key, messages with the same key may replace each other when the queue is full
+    /// @note sending never blocks: what the socket does not accept right now is queued
+    ///   and sent later from the mainloop when the socket becomes writable again
+    void sendText(const string &aMessageText, bool aDroppable = false, const string &aKey = "");
+
+    /// send an event to this client, possibly collecting it into a batch
+    /// @param aEventText the event message encoded in the current encoding, without framing
+    /// @param aKey coalescing key for the event (feature:eventtype)
+    /// @param aImmediate if set, the event is sent immediately even if the client has batching enabled
+    ///   (any already collected batch is sent before, to maintain event order)
+    void sendEvent(const string &aEventText, const string &aKey, bool aImmediate);
+
+    /// send collected batch of events now (if any)
+    void sendBatch();
+
+    /// @return number of bytes queued but not yet sent
+    size_t bufferedBytes() const { return mQueuedBytes; }
+
+    /// @return status of the connection (id, subscription, send queue statistics)
+    JsonObjectPtr status();
+
+    /// @return the event subscription of this client
+    EventSubscription& subscription() { return mSubscription; }
+
+    /// close the connection
+    void close();
+
+  private:
+
+    bool makeRoomFor(const QueuedMessage &aMsg);
+    void binaryDataReceived(ErrorPtr aError);
+    void transmitPending();
+    void readyForTransmit(ErrorPtr aError);
+
+  };
+
+
   /// direct TCP API request
   class FeatureApiRequest : public ApiRequest
   {
     typedef ApiRequest inherited;
-    JsonCommPtr mConnection;
+    FeatureApiConnectionPtr mConnection;
+    JsonObjectPtr mId; ///< correlation id from the request, echoed in the response
 
   public:
 
-    FeatureApiRequest(JsonObjectPtr aRequest, JsonCommPtr aConnection);
+    FeatureApiRequest(JsonObjectPtr aRequest, FeatureApiConnectionPtr aConnection);
     virtual ~FeatureApiRequest();
 
     /// send response
     /// @param aResponse JSON response to send
     /// @param aError error to report back
+    /// @note if the request had an "id" field, it is added to object responses, and other responses
+    ///   are wrapped into an object with "id" and "result" fields
     virtual void sendResponse(JsonObjectPtr aResponse, ErrorPtr aError) override;
 
+    /// @return the correlation id of the request, NULL if none
+    JsonObjectPtr getId() { return mId; }
+
+    /// @return the connection this request was received on
+    FeatureApiConnectionPtr getConnection() { return mConnection; }
+
   };
+  typedef boost::intrusive_ptr<FeatureApiRequest> FeatureApiRequestPtr;
 
 
   /// internal request
@@ -146,9 +407,13 @@ namespace p44 {
   class FeatureApi : public P44LoggingObj
   {
     friend class FeatureApiRequest;
+    friend class FeatureApiConnection;
 
     SocketCommPtr mApiServer;
-    JsonCommPtr mConnection;
+
+    typedef std::list<FeatureApiConnectionPtr> ApiConnectionsList;
+    ApiConnectionsList mConnections; ///< currently connected API clients
+    int mNextConnectionId;
 
     typedef std::map<string, FeaturePtr> FeatureMap;
     FeatureMap mFeatureMap;
@@ -156,6 +421,12 @@ namespace p44 {
     string mDevicelabel;
 
     MLTicket mScriptTicket;
+    MLTicket mSubscriptionsTicket;
+
+    ApiDispatchTable mGlobalCommands; ///< commands not addressed to a feature
+
+    #define GLOBAL_METRICS_NAME "global" ///< pseudo feature name for metrics of global commands
+    FeatureMetrics mMetrics; ///< request counts and latencies per feature and command
 
   public:
 
@@ -234,7 +505,27 @@ namespace p44 {
     void start(const string aApiPort, int aProtocolFamily);
 
     /// send (event) message to API
-    void sendEventMessage(JsonObjectPtr aEventMessage);
+    /// @param aEventMessage the event message
+    /// @param aImmediate if set, the event is never delayed by event batching
+    void sendEventMessage(JsonObjectPtr aEventMessage, bool aImmediate = false);
+
+    /// @return number of currently connected API clients
+    size_t numConnections() { return mConnections.size(); }
+
+    /// check if anyone is interested in an event, allows features to skip building event messages nobody wants
+    /// @param aFeature name of the feature that would send the event
+    /// @param aEventType the event type
+    /// @return true if the event should be sent, i.e. any client subscription matches or scripts are listening
+    bool wantsEvent(const string &aFeature, const string &aEventType);
+
+    /// let features know (soon, from the mainloop) that the outcome of wantsEvent() might have changed
+    /// @note to be called whenever API clients connect, disconnect or change subscriptions, or scripts start waiting for feature events
+    void subscriptionsChanged();
+
+    /// get the event type of a message
+    /// @param aEventMessage the event message
+    /// @return the value of the "event" field if there is one, the first field name other than "feature" otherwise
+    static string eventType(JsonObjectPtr aEventMessage);
 
     #if ENABLE_P44SCRIPT
     void scriptExecHandler(ApiRequestPtr aRequest, ScriptObjPtr aResult);
@@ -246,25 +537,33 @@ namespace p44 {
 
 
     ErrorPtr processRequest(ApiRequestPtr aRequest);
-    void sendEventMessageToApiClient(JsonObjectPtr aEventMessage);
+    /// check if a request could be processed, without actually processing it
+    /// @param aRequest the request data
+    /// @return error if request addresses an unknown feature or command, NULL if it looks processable
+    ErrorPtr validateRequest(JsonObjectPtr aRequest);
+    void sendEventMessageToApiClient(JsonObjectPtr aEventMessage, bool aImmediate = false);
     void sendEventMessageInternally(JsonObjectPtr aEventMessage);
 
   private:
 
     SocketCommPtr apiConnectionHandler(SocketCommPtr aServerSocketComm);
-    void apiRequestHandler(JsonCommPtr aConnection, ErrorPtr aError, JsonObjectPtr aRequest);
-
-    /// send response via main API connection.
-    /// @note: only for FeatureApiRequest
-    void sendResponse(JsonObjectPtr aResponse);
+    void apiConnectionStatusHandler(FeatureApiConnectionPtr aConnection, SocketCommPtr aSocketComm, ErrorPtr aError);
+    void apiRequestHandler(FeatureApiConnectionPtr aConnection, ErrorPtr aError, JsonObjectPtr aRequest);
+    void notifySubscriptionsChanged(MLTimer &aTimer);
 
 
+    ErrorPtr nop(ApiRequestPtr aRequest);
+    ErrorPtr commands(ApiRequestPtr aRequest);
     ErrorPtr init(ApiRequestPtr aRequest);
     ErrorPtr reset(ApiRequestPtr aRequest);
     ErrorPtr now(ApiRequestPtr aRequest);
     ErrorPtr status(ApiRequestPtr aRequest);
     ErrorPtr ping(ApiRequestPtr aRequest);
+    ErrorPtr metrics(ApiRequestPtr aRequest);
     ErrorPtr features(ApiRequestPtr aRequest);
+    ErrorPtr subscribe(ApiRequestPtr aRequest, bool aSubscribe);
+    ErrorPtr encoding(ApiRequestPtr aRequest);
+    ErrorPtr batch(ApiRequestPtr aRequest);
 
 
     #if ENABLE_LEGACY_FEATURE_SCRIPTS
@@ -378,7 +677,11 @@ namespace p44 {
     #define FEATURE_WIFITRACK_CMDLINEOPTS \
       { 0  , "wifitrack",      true,  "doinit;enable wifitrack (and optionally init)" }, \
       { 0  , "wifimonif",      true,  "interface;wifi monitoring interface to use" }, \
-      { 0  , "wifidboffs",     true,  "offset;offset into radiotap to get RSSi (driver dependent)" },
+      { 0  , "wifidboffs",     true,  "offset;offset into radiotap to get RSSi (driver dependent)" }, \
+      { 0  , "wifinative",     false, "capture and decode wifi frames directly instead of using tcpdump" }, \
+      { 0  , "wifitool",       true,  "toolname;wifitrack command line tool to run: parsebench, replay, ouitable" }, \
+      { 0  , "wifitoolinput",  true,  "file;input file for the wifitrack command line tool" }, \
+      { 0  , "wifitooloutput", true,  "file;output file for the wifitrack command line tool" },
   #else
     #define FEATURE_WIFITRACK_CMDLINEOPTS
   #endif
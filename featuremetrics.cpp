@@ -0,0 +1,152 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "featuremetrics.hpp"
+
+#include <string.h>
+
+using namespace p44;
+
+#define MAX_OPERATIONS_PER_FEATURE 64 ///< limits memory use when clients send lots of different unknown commands
+#define OTHER_OPERATIONS "(other)"
+
+// MARK: ===== LatencyStats
+
+LatencyStats::LatencyStats() :
+  mCount(0),
+  mErrors(0),
+  mTotal(0),
+  mMax(0)
+{
+  memset(mBuckets, 0, sizeof(mBuckets));
+}
+
+
+void LatencyStats::record(MLMicroSeconds aDuration, bool aError)
+{
+  if (aDuration<0) aDuration = 0;
+  int b = 0;
+  while (b<NUM_LATENCY_BUCKETS-1 && (aDuration>>(b+1))>0) b++;
+  mBuckets[b]++;
+  mCount++;
+  if (aError) mErrors++;
+  mTotal += aDuration;
+  if (aDuration>mMax) mMax = aDuration;
+}
+
+
+void LatencyStats::add(const LatencyStats &aOther)
+{
+  for (int b=0; b<NUM_LATENCY_BUCKETS; b++) mBuckets[b] += aOther.mBuckets[b];
+  mCount += aOther.mCount;
+  mErrors += aOther.mErrors;
+  mTotal += aOther.mTotal;
+  if (aOther.mMax>mMax) mMax = aOther.mMax;
+}
+
+
+MLMicroSeconds LatencyStats::percentile(double aFraction) const
+{
+  if (mCount==0) return 0;
+  double rank = aFraction*mCount;
+  long below = 0;
+  for (int b=0; b<NUM_LATENCY_BUCKETS; b++) {
+    if (mBuckets[b]==0) continue;
+    if (below+mBuckets[b]>=rank) {
+      // interpolate linearly within the bucket
+      double lo = b==0 ? 0 : (double)((MLMicroSeconds)1<<b);
+      double hi = (double)((MLMicroSeconds)1<<(b+1));
+      MLMicroSeconds p = lo + (hi-lo)*(rank-below)/mBuckets[b];
+      return p>mMax ? mMax : p;
+    }
+    below += mBuckets[b];
+  }
+  return mMax;
+}
+
+
+JsonObjectPtr LatencyStats::json() const
+{
+  JsonObjectPtr j = JsonObject::newObj();
+  j->add("count", JsonObject::newInt64(mCount));
+  j->add("errors", JsonObject::newInt64(mErrors));
+  j->add("totalms", JsonObject::newDouble((double)mTotal/MilliSecond));
+  if (mCount>0) {
+    j->add("avgms", JsonObject::newDouble((double)mTotal/mCount/MilliSecond));
+    j->add("maxms", JsonObject::newDouble((double)mMax/MilliSecond));
+    j->add("p50ms", JsonObject::newDouble((double)percentile(0.50)/MilliSecond));
+    j->add("p95ms", JsonObject::newDouble((double)percentile(0.95)/MilliSecond));
+    j->add("p99ms", JsonObject::newDouble((double)percentile(0.99)/MilliSecond));
+  }
+  return j;
+}
+
+
+// MARK: ===== FeatureMetrics
+
+FeatureMetrics::FeatureMetrics() :
+  mSince(MainLoop::unixtime())
+{
+}
+
+
+void FeatureMetrics::record(const string &aFeature, const string &aOperation, MLMicroSeconds aDuration, bool aError)
+{
+  OperationStatsMap &ops = mStats[aFeature];
+  OperationStatsMap::iterator pos = ops.find(aOperation);
+  if (pos==ops.end()) {
+    if (ops.size()>=MAX_OPERATIONS_PER_FEATURE) {
+      ops[OTHER_OPERATIONS].record(aDuration, aError);
+      return;
+    }
+    pos = ops.insert(make_pair(aOperation, LatencyStats())).first;
+  }
+  pos->second.record(aDuration, aError);
+}
+
+
+void FeatureMetrics::reset()
+{
+  mStats.clear();
+  mSince = MainLoop::unixtime();
+}
+
+
+JsonObjectPtr FeatureMetrics::json(bool aDetails) const
+{
+  JsonObjectPtr j = JsonObject::newObj();
+  j->add("since", JsonObject::newDouble((double)mSince/Second));
+  JsonObjectPtr features = JsonObject::newObj();
+  for (FeatureStatsMap::const_iterator fpos = mStats.begin(); fpos!=mStats.end(); ++fpos) {
+    LatencyStats total;
+    JsonObjectPtr ops = JsonObject::newObj();
+    for (OperationStatsMap::const_iterator opos = fpos->second.begin(); opos!=fpos->second.end(); ++opos) {
+      total.add(opos->second);
+      if (aDetails) ops->add(opos->first.c_str(), opos->second.json());
+    }
+    JsonObjectPtr f = total.json();
+    if (aDetails) f->add("operations", ops);
+    features->add(fpos->first.c_str(), f);
+  }
+  j->add("features", features);
+  return j;
+}
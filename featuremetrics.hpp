@@ -0,0 +1,101 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44features_featuremetrics_hpp__
+#define __p44features_featuremetrics_hpp__
+
+#include "p44features_common.hpp"
+
+#include "jsonobject.hpp"
+
+#include <map>
+
+namespace p44 {
+
+  #define NUM_LATENCY_BUCKETS 32 ///< bucket n counts durations from 2^n to 2^(n+1) µS, so max is ~71 minutes
+
+  /// count, error count and log2 histogram of durations of an operation
+  class LatencyStats
+  {
+    uint32_t mBuckets[NUM_LATENCY_BUCKETS];
+    long mCount;
+    long mErrors;
+    MLMicroSeconds mTotal;
+    MLMicroSeconds mMax;
+
+  public:
+
+    LatencyStats();
+
+    /// record one execution of the operation
+    /// @param aDuration how long the operation took
+    /// @param aError set if the operation failed
+    void record(MLMicroSeconds aDuration, bool aError);
+
+    /// add other stats to these (e.g. for totals)
+    void add(const LatencyStats &aOther);
+
+    /// @return number of recorded executions
+    long count() const { return mCount; }
+
+    /// @param aFraction which percentile to get, e.g. 0.95 for p95
+    /// @return estimated duration (interpolated within histogram bucket) below which aFraction of all executions were
+    MLMicroSeconds percentile(double aFraction) const;
+
+    /// @return JSON object with count, errors, avg/max/total time and p50/p95/p99 in milliseconds
+    JsonObjectPtr json() const;
+
+  };
+
+
+  /// latency statistics for all operations of all features
+  class FeatureMetrics
+  {
+    typedef std::map<string, LatencyStats> OperationStatsMap;
+    typedef std::map<string, OperationStatsMap> FeatureStatsMap;
+
+    FeatureStatsMap mStats;
+    MLMicroSeconds mSince; ///< unix time when collecting started
+
+  public:
+
+    FeatureMetrics();
+
+    /// record one execution of an operation
+    /// @param aFeature feature name
+    /// @param aOperation operation (command name, "properties", "init", "status()")
+    /// @param aDuration how long the operation took
+    /// @param aError set if the operation failed
+    void record(const string &aFeature, const string &aOperation, MLMicroSeconds aDuration, bool aError);
+
+    /// forget all recorded data
+    void reset();
+
+    /// @param aDetails if set, stats per operation are included, otherwise only totals per feature
+    /// @return metrics as JSON object
+    JsonObjectPtr json(bool aDetails) const;
+
+  };
+
+} // namespace p44
+
+#endif /* __p44features_featuremetrics_hpp__ */
@@ -0,0 +1,217 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44features_hashstore_hpp__
+#define __p44features_hashstore_hpp__
+
+#include "p44features_common.hpp"
+
+#include <vector>
+#include <algorithm>
+
+namespace p44 {
+
+  /// 64bit integer hash (finalizer of MurmurHash3)
+  inline uint32_t hashUInt64(uint64_t aKey)
+  {
+    aKey ^= aKey >> 33;
+    aKey *= 0xff51afd7ed558ccdULL;
+    aKey ^= aKey >> 33;
+    aKey *= 0xc4ceb9fe1a85ec53ULL;
+    aKey ^= aKey >> 33;
+    return (uint32_t)aKey;
+  }
+
+  /// string hash (FNV-1a)
+  inline uint32_t hashBytes(const char *aData, size_t aLen)
+  {
+    uint32_t h = 2166136261U;
+    for (size_t i=0; i<aLen; i++) {
+      h ^= (uint8_t)aData[i];
+      h *= 16777619U;
+    }
+    return h;
+  }
+
+
+  /// Open addressing (linear probing) hash store for refcounted objects which carry their own key.
+  /// @note KeyOps must provide:
+  ///   - `typedef ... Key` : the lookup key type (should be cheap to construct, e.g. pointer+length)
+  ///   - `static Key key(const T &aObj)` : the key of an object
+  ///   - `static uint32_t hash(const Key &aKey)` : hash of a key
+  ///   - `static bool matches(const T &aObj, const Key &aKey)` : true if object has the key
+  ///   - `static bool less(const T &aA, const T &aB)` : sort order for sortedObjects()
+  template<class T, class KeyOps> class HashStore
+  {
+  public:
+
+    typedef boost::intrusive_ptr<T> TPtr;
+    typedef typename KeyOps::Key Key;
+
+  private:
+
+    struct Slot
+    {
+      uint32_t hash;
+      TPtr obj; ///< NULL for empty slot
+    };
+    typedef std::vector<Slot> SlotVector;
+
+    SlotVector mSlots; ///< size is zero or a power of 2
+    size_t mMask;
+    size_t mCount;
+
+    struct ObjLess
+    {
+      bool operator()(const TPtr &aA, const TPtr &aB) const { return KeyOps::less(*aA, *aB); }
+    };
+
+  public:
+
+    HashStore() : mMask(0), mCount(0) {};
+
+    /// @return number of objects in the store
+    size_t size() const { return mCount; }
+
+    /// @return true if store is empty
+    bool empty() const { return mCount==0; }
+
+    /// remove all objects
+    void clear() { mSlots.clear(); mMask = 0; mCount = 0; }
+
+    /// make sure the store can hold the specified number of objects without rehashing
+    /// @param aCount number of objects
+    void reserve(size_t aCount) { while (aCount*4>mSlots.size()*3) grow(); }
+
+    /// find object by key
+    /// @param aKey the key
+    /// @return the object or NULL if none
+    TPtr find(const Key &aKey) const
+    {
+      if (mCount==0) return TPtr();
+      uint32_t h = KeyOps::hash(aKey);
+      for (size_t i = h & mMask; mSlots[i].obj; i = (i+1) & mMask) {
+        if (mSlots[i].hash==h && KeyOps::matches(*mSlots[i].obj, aKey)) return mSlots[i].obj;
+      }
+      return TPtr();
+    }
+
+    /// insert object, replacing an object with the same key, if any
+    /// @param aObj the object to insert
+    /// @return true if object was new, false if it replaced another one
+    bool insert(TPtr aObj)
+    {
+      if ((mCount+1)*4>mSlots.size()*3) grow(); // keep load factor below 0.75
+      uint32_t h = KeyOps::hash(KeyOps::key(*aObj));
+      size_t i = h & mMask;
+      while (mSlots[i].obj) {
+        if (mSlots[i].hash==h && KeyOps::matches(*mSlots[i].obj, KeyOps::key(*aObj))) {
+          mSlots[i].obj = aObj;
+          return false;
+        }
+        i = (i+1) & mMask;
+      }
+      mSlots[i].hash = h;
+      mSlots[i].obj = aObj;
+      mCount++;
+      return true;
+    }
+
+    /// remove object by key
+    /// @param aKey the key
+    /// @return true if an object was removed
+    bool erase(const Key &aKey)
+    {
+      if (mCount==0) return false;
+      uint32_t h = KeyOps::hash(aKey);
+      size_t i = h & mMask;
+      while (true) {
+        if (!mSlots[i].obj) return false;
+        if (mSlots[i].hash==h && KeyOps::matches(*mSlots[i].obj, aKey)) break;
+        i = (i+1) & mMask;
+      }
+      // backward shift deletion: move following entries of the probe sequence into the gap
+      size_t j = i;
+      while (true) {
+        j = (j+1) & mMask;
+        if (!mSlots[j].obj) break;
+        size_t home = mSlots[j].hash & mMask;
+        // entry at j may move to i only if its home position is not cyclically within (i,j]
+        if (i<=j ? (home<=i || home>j) : (home<=i && home>j)) {
+          mSlots[i] = mSlots[j];
+          i = j;
+        }
+      }
+      mSlots[i].obj.reset();
+      mCount--;
+      return true;
+    }
+
+    /// get all objects sorted by KeyOps::less
+    /// @param aObjects will receive the objects
+    void sortedObjects(std::vector<TPtr> &aObjects) const
+    {
+      aObjects.clear();
+      aObjects.reserve(mCount);
+      for (const_iterator pos = begin(); pos!=end(); ++pos) aObjects.push_back(*pos);
+      std::sort(aObjects.begin(), aObjects.end(), ObjLess());
+    }
+
+    /// iterator over all objects (in unspecified order)
+    class const_iterator
+    {
+      const SlotVector *mSlotsP;
+      size_t mIdx;
+      void skip() { while (mIdx<mSlotsP->size() && !(*mSlotsP)[mIdx].obj) mIdx++; }
+    public:
+      const_iterator(const SlotVector *aSlots, size_t aIdx) : mSlotsP(aSlots), mIdx(aIdx) { skip(); }
+      const TPtr &operator*() const { return (*mSlotsP)[mIdx].obj; }
+      const TPtr *operator->() const { return &(*mSlotsP)[mIdx].obj; }
+      const_iterator &operator++() { mIdx++; skip(); return *this; }
+      bool operator==(const const_iterator &aOther) const { return mIdx==aOther.mIdx; }
+      bool operator!=(const const_iterator &aOther) const { return mIdx!=aOther.mIdx; }
+    };
+
+    const_iterator begin() const { return const_iterator(&mSlots, 0); }
+    const_iterator end() const { return const_iterator(&mSlots, mSlots.size()); }
+
+  private:
+
+    void grow()
+    {
+      SlotVector old;
+      old.swap(mSlots);
+      mSlots.resize(old.size()>0 ? old.size()*2 : 16);
+      mMask = mSlots.size()-1;
+      for (typename SlotVector::iterator pos = old.begin(); pos!=old.end(); ++pos) {
+        if (!pos->obj) continue;
+        size_t i = pos->hash & mMask;
+        while (mSlots[i].obj) i = (i+1) & mMask;
+        mSlots[i] = *pos;
+      }
+    }
+
+  };
+
+} // namespace p44
+
+#endif /* __p44features_hashstore_hpp__ */
@@ -31,6 +31,8 @@ HermelShoot::HermelShoot(AnalogIoPtr aPwmLeft, AnalogIoPtr aPwmRight, bool doSta
   pwmLeft(aPwmLeft),
   pwmRight(aPwmRight)
 {
+  // API
+  mDispatch.registerCommand("shoot", boost::bind(&HermelShoot::shoot, this, _1));
   if (doStart) {
     initOperation();
   }
@@ -45,20 +47,6 @@ ErrorPtr HermelShoot::initialize(JsonObjectPtr aInitData)
 }
 
 
-ErrorPtr HermelShoot::processRequest(ApiRequestPtr aRequest)
-{
-  JsonObjectPtr o = aRequest->getRequest()->get("cmd");
-  if (!o) {
-    return FeatureApiError::err("missing 'cmd'");
-  }
-  string cmd = o->stringValue();
-  if (cmd=="shoot") {
-    return shoot(aRequest);
-  }
-  return inherited::processRequest(aRequest);
-}
-
-
 JsonObjectPtr HermelShoot::status()
 {
   JsonObjectPtr answer = inherited::status();
@@ -104,6 +92,7 @@ void HermelShoot::shoot(double aAngle, double aIntensity, MLMicroSeconds aPulseL
 
 void HermelShoot::endPulse()
 {
+  FEATURE_STALL_GUARD;
   pwmRight->setValue(0);
   pwmLeft->setValue(0);
 }
@@ -35,6 +35,9 @@ Indicators::Indicators(LEDChainArrangementPtr aLedChainArrangement) :
   inherited(FEATURE_NAME),
   mLedChainArrangement(aLedChainArrangement)
 {
+  // API
+  mDispatch.registerCommand("indicate", boost::bind(&Indicators::indicateCmd, this, _1));
+  mDispatch.registerCommand("stop", boost::bind(&Indicators::stopCmd, this, _1));
 }
 
 
@@ -128,101 +131,93 @@ ErrorPtr Indicators::initialize(JsonObjectPtr aInitData)
 }
 
 
-ErrorPtr Indicators::processRequest(ApiRequestPtr aRequest)
+ErrorPtr Indicators::indicateCmd(ApiRequestPtr aRequest)
 {
+  //  minimally: { cmd: "indicate" } /* full area */
+  //  normally: { cmd: "indicate", x:0, dx:20, effect="swipe" }
+  //  full: { cmd: "indicate", x:0, dx:20, y:0, dy:1, effect:"pulse", t:1 }
+  if (!mIndicatorsView) return TextError::err("no indicators view");
   ErrorPtr err;
   JsonObjectPtr data = aRequest->getRequest();
-  JsonObjectPtr o = data->get("cmd");
-  if (o) {
-    string cmd = o->stringValue();
-    // decode commands
-    //  minimally: { cmd: "indicate" } /* full area */
-    //  normally: { cmd: "indicate", x:0, dx:20, effect="swipe" }
-    //  full: { cmd: "indicate", x:0, dx:20, y:0, dy:1, effect:"pulse", t:1 }
-    if (cmd=="indicate" && mIndicatorsView) {
-      PixelRect f = mIndicatorsView->getContent(); // default to full view
-      // common parameters
-      if (data->get("x", o)) f.x = o->int32Value();
-      if (data->get("y", o)) f.y = o->int32Value();
-      if (data->get("dx", o)) f.dx = o->int32Value();
-      if (data->get("dy", o)) f.dy = o->int32Value();
-      MLMicroSeconds t = 0.5*Second;
-      if (data->get("t", o)) t = o->doubleValue()*Second;
-      PixelColor col = { 255, 0, 0, 255 }; // default to red
-      if (data->get("color", o)) col = webColorToPixel(o->stringValue());
-      // effect
-      JsonObjectPtr viewCfg;
-      P44ViewPtr effectView;
-      if (!data->get("effect", o)) {
-        o = JsonObject::newString("plain"); // default effect
-      }
-      if (o->isType(json_type_string)) {
-        string effectName = o->stringValue();
-        // check predefined effects
-        if (effectName=="plain") {
-          effectView = P44ViewPtr(new P44View);
-          effectView->setBackgroundColor(col);
-          effectView->setFrame(f);
-          //effectView->setFullFrameContent();
-        }
-        else if (effectName=="swipe") {
-          effectView = P44ViewPtr(new P44View);
-          effectView->setForegroundColor(col);
-          effectView->setFrame(f);
-          effectView->setFullFrameContent();
-          effectView->animatorFor("content_x")->from(-f.dx)->animate(f.dx, t);
-        }
-        else if (effectName=="pulse") {
-          effectView = P44ViewPtr(new P44View);
-          effectView->setBackgroundColor(col);
-          effectView->setFrame(f);
-          //effectView->setFullFrameContent();
-          effectView->animatorFor("alpha")->from(0)->repeat(true, 2)->animate(255, t/2);
-        }
-        else if (effectName=="spot") {
-          bool radial = false;
-          if (data->get("radial", o)) radial = o->boolValue();
-          LightSpotViewPtr lsp = LightSpotViewPtr(new LightSpotView);
-          effectView = lsp;
-          effectView->setFrame(f);
-          effectView->setFullFrameContent();
-          lsp->setRelativeContentOrigin(0, 0);
-          lsp->setRelativeContentSize(0.5, 0.5, false); // lightspot content size is the first quadrant, so 0.5 fills frame
-          lsp->setColoringParameters(col, -1, gradient_curve_cos, 0, gradient_none, 0, gradient_none, radial);
-          effectView->animatorFor("alpha")->from(0)->repeat(true, 2)->animate(255, t/2);
-        }
-      }
-      // not a predefined effect: could be JSON literal config or filename
-      if (!viewCfg && !effectView) {
-        viewCfg = Application::jsonObjOrResource(o, &err, FEATURE_NAME "/");
-        if (Error::notOK(err)) return err;
-      }
-      if (viewCfg) {
-        // add-in frame
-        viewCfg->add("x", JsonObject::newInt32(f.x));
-        viewCfg->add("y", JsonObject::newInt32(f.y));
-        viewCfg->add("dx", JsonObject::newInt32(f.dx));
-        viewCfg->add("dy", JsonObject::newInt32(f.dy));
-        err = p44::createViewFromConfig(viewCfg, effectView, mIndicatorsView);
-        if (Error::notOK(err)) return err;
-      }
-      if (!effectView) return TextError::err("No valid indicator effect");
-      // now run
-      effectView->setHaltWhenHidden(false); // by default, views are in haltWhenHidden mode and would not animate out of alpha==0!
-      runEffect(effectView, t, data);
-      return Error::ok();
+  JsonObjectPtr o;
+  PixelRect f = mIndicatorsView->getContent(); // default to full view
+  // common parameters
+  if (data->get("x", o)) f.x = o->int32Value();
+  if (data->get("y", o)) f.y = o->int32Value();
+  if (data->get("dx", o)) f.dx = o->int32Value();
+  if (data->get("dy", o)) f.dy = o->int32Value();
+  MLMicroSeconds t = 0.5*Second;
+  if (data->get("t", o)) t = o->doubleValue()*Second;
+  PixelColor col = { 255, 0, 0, 255 }; // default to red
+  if (data->get("color", o)) col = webColorToPixel(o->stringValue());
+  // effect
+  JsonObjectPtr viewCfg;
+  P44ViewPtr effectView;
+  if (!data->get("effect", o)) {
+    o = JsonObject::newString("plain"); // default effect
+  }
+  if (o->isType(json_type_string)) {
+    string effectName = o->stringValue();
+    // check predefined effects
+    if (effectName=="plain") {
+      effectView = P44ViewPtr(new P44View);
+      effectView->setBackgroundColor(col);
+      effectView->setFrame(f);
+      //effectView->setFullFrameContent();
     }
-    else if (cmd=="stop") {
-      stop();
-      return Error::ok();
+    else if (effectName=="swipe") {
+      effectView = P44ViewPtr(new P44View);
+      effectView->setForegroundColor(col);
+      effectView->setFrame(f);
+      effectView->setFullFrameContent();
+      effectView->animatorFor("content_x")->from(-f.dx)->animate(f.dx, t);
+    }
+    else if (effectName=="pulse") {
+      effectView = P44ViewPtr(new P44View);
+      effectView->setBackgroundColor(col);
+      effectView->setFrame(f);
+      //effectView->setFullFrameContent();
+      effectView->animatorFor("alpha")->from(0)->repeat(true, 2)->animate(255, t/2);
+    }
+    else if (effectName=="spot") {
+      bool radial = false;
+      if (data->get("radial", o)) radial = o->boolValue();
+      LightSpotViewPtr lsp = LightSpotViewPtr(new LightSpotView);
+      effectView = lsp;
+      effectView->setFrame(f);
+      effectView->setFullFrameContent();
+      lsp->setRelativeContentOrigin(0, 0);
+      lsp->setRelativeContentSize(0.5, 0.5, false); // lightspot content size is the first quadrant, so 0.5 fills frame
+      lsp->setColoringParameters(col, -1, gradient_curve_cos, 0, gradient_none, 0, gradient_none, radial);
+      effectView->animatorFor("alpha")->from(0)->repeat(true, 2)->animate(255, t/2);
     }
-    return inherited::processRequest(aRequest);
   }
-  else {
-    // decode properties
-    //%%% none yet
-    return err ? err : Error::ok();
+  // not a predefined effect: could be JSON literal config or filename
+  if (!viewCfg && !effectView) {
+    viewCfg = Application::jsonObjOrResource(o, &err, FEATURE_NAME "/");
+    if (Error::notOK(err)) return err;
   }
+  if (viewCfg) {
+    // add-in frame
+    viewCfg->add("x", JsonObject::newInt32(f.x));
+    viewCfg->add("y", JsonObject::newInt32(f.y));
+    viewCfg->add("dx", JsonObject::newInt32(f.dx));
+    viewCfg->add("dy", JsonObject::newInt32(f.dy));
+    err = p44::createViewFromConfig(viewCfg, effectView, mIndicatorsView);
+    if (Error::notOK(err)) return err;
+  }
+  if (!effectView) return TextError::err("No valid indicator effect");
+  // now run
+  effectView->setHaltWhenHidden(false); // by default, views are in haltWhenHidden mode and would not animate out of alpha==0!
+  runEffect(effectView, t, data);
+  return Error::ok();
+}
+
+
+ErrorPtr Indicators::stopCmd(ApiRequestPtr aRequest)
+{
+  stop();
+  return Error::ok();
 }
 
 
@@ -264,6 +259,7 @@ void Indicators::runEffect(P44ViewPtr aView, MLMicroSeconds aDuration, JsonObjec
 
 void Indicators::effectDone(IndicatorEffectPtr aEffect)
 {
+  FEATURE_STALL_GUARD;
   aEffect->mView->stopAnimations();
   mIndicatorsView->removeView(aEffect->mView);
   mActiveIndicators.remove(aEffect);
@@ -78,6 +78,7 @@ ErrorPtr Inputs::initialize(JsonObjectPtr aInitData)
 
 void Inputs::inputChanged(Input &aInput, bool aNewValue)
 {
+  FEATURE_STALL_GUARD;
   JsonObjectPtr message = JsonObject::newObj();
   message->add("name", JsonObject::newString(aInput.name));
   message->add("state", JsonObject::newBool(aNewValue));
@@ -106,6 +106,7 @@ void KeyEvents::initOperation()
 
 bool KeyEvents::eventDataHandler(int aFD, int aPollFlags)
 {
+  FEATURE_STALL_GUARD;
   union {
     struct input_event ev;
     uint8_t bytes[sizeof(input_event)];
@@ -32,6 +32,8 @@ Light::Light(AnalogIoPtr aPwmDimmer, bool doStart) :
   inherited("light"),
   pwmDimmer(aPwmDimmer)
 {
+  // API
+  mDispatch.registerCommand("fade", boost::bind(&Light::fade, this, _1));
   if (doStart) {
     setInitialized();
   }
@@ -46,20 +48,6 @@ ErrorPtr Light::initialize(JsonObjectPtr aInitData)
 }
 
 
-ErrorPtr Light::processRequest(ApiRequestPtr aRequest)
-{
-  JsonObjectPtr o = aRequest->getRequest()->get("cmd");
-  if (!o) {
-    return FeatureApiError::err("missing 'cmd'");
-  }
-  string cmd = o->stringValue();
-  if (cmd=="fade") {
-    return fade(aRequest);
-  }
-  return inherited::processRequest(aRequest);
-}
-
-
 JsonObjectPtr Light::status()
 {
   JsonObjectPtr answer = inherited::status();
@@ -107,6 +95,7 @@ void Light::fade(double aFrom, double aTo, MLMicroSeconds aFadeTime, MLMicroSeco
 
 void Light::startFading(double aTo, MLMicroSeconds aFadeTime)
 {
+  FEATURE_STALL_GUARD;
   animator->animate(aTo, aFadeTime, NoOP);
 }
 
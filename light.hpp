@@ -76,12 +76,6 @@ namespace p44 {
     /// @return error if any, NULL if ok
     virtual ErrorPtr initialize(JsonObjectPtr aInitData) override;
 
-    /// handle request
-    /// @param aRequest the API request to process
-    /// @return NULL to send nothing at return (but possibly later via aRequest->sendResponse),
-    ///   Error::ok() to just send a empty response, or error to report back
-    virtual ErrorPtr processRequest(ApiRequestPtr aRequest) override;
-
     /// @return status information object for initialized feature, bool false for uninitialized
     virtual JsonObjectPtr status() override;
 
@@ -61,6 +61,25 @@ MixLoop::MixLoop(const string aLedChain1Name, const string aLedChain2Name, bool
   hitDetectorActive(false),
   hitShowing(false)
 {
+  // API
+  mDispatch.registerCommand("hit", boost::bind(&MixLoop::hitCmd, this, _1));
+  mDispatch.registerProperty("accelThreshold", boost::bind(&MixLoop::accelThresholdProp, this, _1));
+  mDispatch.registerTimeProperty("interval", interval);
+  mDispatch.registerDoubleProperty("accelChangeCutoff", accelChangeCutoff);
+  mDispatch.registerDoubleProperty("accelMaxChange", accelMaxChange);
+  mDispatch.registerDoubleProperty("accelIntegrationGain", accelIntegrationGain);
+  mDispatch.registerDoubleProperty("integralFadeOffset", integralFadeOffset);
+  mDispatch.registerDoubleProperty("integralFadeScaling", integralFadeScaling);
+  mDispatch.registerDoubleProperty("maxIntegral", maxIntegral);
+  mDispatch.registerDoubleProperty("hitStartMinIntegral", hitStartMinIntegral);
+  mDispatch.registerTimeProperty("hitWindowStart", hitWindowStart);
+  mDispatch.registerTimeProperty("hitWindowDuration", hitWindowDuration);
+  mDispatch.registerDoubleProperty("hitMinAccelChange", hitMinAccelChange);
+  mDispatch.registerProperty("numLeds", boost::bind(&MixLoop::numLedsProp, this, _1));
+  mDispatch.registerDoubleProperty("integralDispOffset", integralDispOffset);
+  mDispatch.registerDoubleProperty("integralDispScaling", integralDispScaling);
+  mDispatch.registerTimeProperty("hitFlashTime", hitFlashTime);
+  mDispatch.registerTimeProperty("hitDispTime", hitDispTime);
   // check for commandline-triggered standalone operation
   if (doStart) {
     initOperation();
@@ -76,76 +95,24 @@ ErrorPtr MixLoop::initialize(JsonObjectPtr aInitData)
 }
 
 
-ErrorPtr MixLoop::processRequest(ApiRequestPtr aRequest)
+ErrorPtr MixLoop::hitCmd(ApiRequestPtr aRequest)
 {
-  ErrorPtr err;
-  JsonObjectPtr data = aRequest->getRequest();
-  JsonObjectPtr o = data->get("cmd");
-  if (o) {
-    string cmd = o->stringValue();
-    if (cmd=="hit") {
-      showHit();
-      return Error::ok();
-    }
-    else {
-      return inherited::processRequest(aRequest);
-    }
-  }
-  else {
-    // decode properties
-    if (data->get("accelThreshold", o, true)) {
-      accelThreshold = o->int32Value();
-    }
-    if (data->get("interval", o, true)) {
-      interval = o->doubleValue()*Second;
-    }
-    if (data->get("accelChangeCutoff", o, true)) {
-      accelChangeCutoff = o->doubleValue();
-    }
-    if (data->get("accelMaxChange", o, true)) {
-      accelMaxChange = o->doubleValue();
-    }
-    if (data->get("accelIntegrationGain", o, true)) {
-      accelIntegrationGain = o->doubleValue();
-    }
-    if (data->get("integralFadeOffset", o, true)) {
-      integralFadeOffset = o->doubleValue();
-    }
-    if (data->get("integralFadeScaling", o, true)) {
-      integralFadeScaling = o->doubleValue();
-    }
-    if (data->get("maxIntegral", o, true)) {
-      maxIntegral = o->doubleValue();
-    }
-    if (data->get("hitStartMinIntegral", o, true)) {
-      hitStartMinIntegral = o->doubleValue();
-    }
-    if (data->get("hitWindowStart", o, true)) {
-      hitWindowStart = o->doubleValue()*Second;
-    }
-    if (data->get("hitWindowDuration", o, true)) {
-      hitWindowDuration = o->doubleValue()*Second;
-    }
-    if (data->get("hitMinAccelChange", o, true)) {
-      hitMinAccelChange = o->doubleValue();
-    }
-    if (data->get("numLeds", o, true)) {
-      numLeds = o->int32Value();
-    }
-    if (data->get("integralDispOffset", o, true)) {
-      integralDispOffset = o->doubleValue();
-    }
-    if (data->get("integralDispScaling", o, true)) {
-      integralDispScaling = o->doubleValue();
-    }
-    if (data->get("hitFlashTime", o, true)) {
-      hitFlashTime = o->doubleValue()*Second;
-    }
-    if (data->get("hitDispTime", o, true)) {
-      hitDispTime = o->doubleValue()*Second;
-    }
-    return err ? err : Error::ok();
-  }
+  showHit();
+  return Error::ok();
+}
+
+
+ErrorPtr MixLoop::accelThresholdProp(JsonObjectPtr aValue)
+{
+  accelThreshold = aValue->int32Value();
+  return ErrorPtr();
+}
+
+
+ErrorPtr MixLoop::numLedsProp(JsonObjectPtr aValue)
+{
+  numLeds = aValue->int32Value();
+  return ErrorPtr();
 }
 
 
@@ -235,6 +202,7 @@ static bool adxl345_readword(SPIDevicePtr aSPiDev, uint8_t aReg, uint16_t &aValu
 
 void MixLoop::accelInit()
 {
+  FEATURE_STALL_GUARD;
   // null previous
   lastaccel[0] = 0;
   lastaccel[1] = 0;
@@ -265,6 +233,7 @@ void MixLoop::accelInit()
 
 void MixLoop::accelMeasure()
 {
+  FEATURE_STALL_GUARD;
   // measure
   bool changed = false;
   double changeamount = 0;
@@ -381,6 +350,7 @@ void MixLoop::showHit()
 
 void MixLoop::showHitEnd()
 {
+  FEATURE_STALL_GUARD;
   hitShowing = false;
 }
 
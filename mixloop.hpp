@@ -89,12 +89,6 @@ namespace p44 {
     /// @return error if any, NULL if ok
     virtual ErrorPtr initialize(JsonObjectPtr aInitData) override;
 
-    /// handle request
-    /// @param aRequest the API request to process
-    /// @return NULL to send nothing at return (but possibly later via aRequest->sendResponse),
-    ///   Error::ok() to just send a empty response, or error to report back
-    virtual ErrorPtr processRequest(ApiRequestPtr aRequest) override;
-
     /// @return status information object for initialized feature, bool false for uninitialized
     virtual JsonObjectPtr status() override;
 
@@ -108,6 +102,10 @@ namespace p44 {
     void showHitEnd();
     void dispNormal();
 
+    ErrorPtr hitCmd(ApiRequestPtr aRequest);
+    ErrorPtr accelThresholdProp(JsonObjectPtr aValue);
+    ErrorPtr numLedsProp(JsonObjectPtr aValue);
+
   };
 
 } // namespace p44
@@ -33,6 +33,10 @@ using namespace p44;
 Neuron::Neuron(const string aLedChain1Name, const string aLedChain2Name, AnalogIoPtr aSensor, const string aStartCfg) :
   inherited("neuron")
 {
+  // API
+  mDispatch.registerCommand("fire", boost::bind(&Neuron::fire, this, _1));
+  mDispatch.registerCommand("glow", boost::bind(&Neuron::glow, this, _1));
+  mDispatch.registerCommand("mute", boost::bind(&Neuron::mute, this, _1));
   ledChain1Name = aLedChain1Name;
   ledChain2Name = aLedChain2Name;
   sensor = aSensor;
@@ -85,26 +89,6 @@ ErrorPtr Neuron::initialize(JsonObjectPtr aInitData)
 }
 
 
-ErrorPtr Neuron::processRequest(ApiRequestPtr aRequest)
-{
-  JsonObjectPtr o = aRequest->getRequest()->get("cmd");
-  if (!o) {
-    return FeatureApiError::err("missing 'cmd'");
-  }
-  string cmd = o->stringValue();
-  if (cmd=="fire") {
-    return fire(aRequest);
-  }
-  if (cmd=="glow") {
-    return glow(aRequest);
-  }
-  if (cmd=="mute") {
-    return mute(aRequest);
-  }
-  return inherited::processRequest(aRequest);
-}
-
-
 JsonObjectPtr Neuron::status()
 {
   JsonObjectPtr answer = inherited::status();
@@ -183,6 +167,7 @@ void Neuron::fire(double aValue)
 
 void Neuron::measure(MLTimer &aTimer)
 {
+  FEATURE_STALL_GUARD;
   double value = sensor->value();
   avg = (avg * (movingAverageCount - 1) + value) / movingAverageCount;
   if(!isMuted && avg > threshold) fire(avg);
@@ -191,6 +176,7 @@ void Neuron::measure(MLTimer &aTimer)
 
 void Neuron::animateAxon(MLTimer &aTimer)
 {
+  FEATURE_STALL_GUARD;
   for(int i = 0; i < numAxonLeds; i++) {
     uint8_t c = abs(i - pos) < 4 ? 255 : 0;
     if(ledChain1) ledChain1->setPowerXY(i, 0, c, c, 0);
@@ -205,6 +191,7 @@ void Neuron::animateAxon(MLTimer &aTimer)
 
 void Neuron::animateBody(MLTimer &aTimer)
 {
+  FEATURE_STALL_GUARD;
   phi += 0.02;
   if(bodyState != BodyFadeOut && phi > M_PI) phi = 0;
   if(axonState == AxonIdle && bodyState == BodyGlowing) {
@@ -194,7 +194,7 @@ ErrorPtr RFIDs::initialize(JsonObjectPtr aInitData)
 
 ErrorPtr RFIDs::processRequest(ApiRequestPtr aRequest)
 {
-  return TextError::err("No API implemented yet %%%%%%");
+  return inherited::processRequest(aRequest);
 }
 
 
@@ -241,6 +241,7 @@ void RFIDs::resetReaders(SimpleCB aDoneCB)
 
 void RFIDs::releaseReset(SimpleCB aDoneCB)
 {
+  FEATURE_STALL_GUARD;
   mResetOutput->set(1); // release reset = HIGH
   mStartupTimer.executeOnce(boost::bind(&RFIDs::resetDone, this, aDoneCB), RESET_TIME);
 }
@@ -248,6 +249,7 @@ void RFIDs::releaseReset(SimpleCB aDoneCB)
 
 void RFIDs::resetDone(SimpleCB aDoneCB)
 {
+  FEATURE_STALL_GUARD;
   if (aDoneCB) aDoneCB();
 }
 
@@ -297,6 +299,7 @@ void RFIDs::rfidPollingThread(ChildThreadWrapper &aThread)
 
 void RFIDs::rfidPollingThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode)
 {
+  FEATURE_STALL_GUARD;
   OLOG(LOG_DEBUG, "Received signal from child thread: %d", aSignalCode);
   if (aSignalCode==threadSignalUserSignal) {
     // means a new RFID was detected
@@ -331,6 +334,7 @@ void RFIDs::stopActiveGroup(int aExceptReader)
 
 void RFIDs::switchToNextGroup()
 {
+  FEATURE_STALL_GUARD;
   FOCUSOLOG("\n___ group timeout -> terminate current, switch to next");
   stopActiveGroup();
   runNextGroup();
@@ -348,6 +352,7 @@ void RFIDs::runNextGroup()
 
 void RFIDs::runActiveGroup()
 {
+  FEATURE_STALL_GUARD;
   // Start field and do a probe on all group members
   FOCUSOLOG("\n=== Start running new group of readers");
   for (RFIDReaderMap::iterator pos = mActiveGroup->begin(); pos!=mActiveGroup->end(); ++pos) {
@@ -363,6 +368,7 @@ void RFIDs::runActiveGroup()
 
 void RFIDs::probeTypeAResult(RFID522Ptr aReader, ErrorPtr aErr)
 {
+  FEATURE_STALL_GUARD;
   FOCUSOLOG("\nprobeTypeAResult from reader #%d", aReader->getReaderIndex());
   if (Error::isOK(aErr)) {
     // Card detected: Stop all other readers in group
@@ -394,6 +400,7 @@ void RFIDs::probeTypeAResult(RFID522Ptr aReader, ErrorPtr aErr)
 
 void RFIDs::antiCollisionResult(RFID522Ptr aReader, ErrorPtr aErr, const string aNUID)
 {
+  FEATURE_STALL_GUARD;
   if (Error::isOK(aErr)) {
     string nUID;
     // nUID is LSB first, and last byte is redundant BCC. Reverse to have MSB first, and omit BCC
@@ -441,6 +448,7 @@ void RFIDs::initIrq()
 
 void RFIDs::initReaders()
 {
+  FEATURE_STALL_GUARD;
   if (mRfidGroups.size()>0) {
     // init all, but no energy field enabled
     for (RFIDReaderMap::iterator pos = mRfidReaders.begin(); pos!=mRfidReaders.end(); ++pos) {
@@ -500,6 +508,7 @@ void RFIDs::haltIrqHandling()
 
 void RFIDs::pollIrq(MLTimer &aTimer)
 {
+  FEATURE_STALL_GUARD;
   irqHandler(false); // assume active (LOW)
   if (mPauseIrqHandling) {
     // prevent retriggering timer to allow pollPauseAfterDetect start immediately after card detection
@@ -512,6 +521,7 @@ void RFIDs::pollIrq(MLTimer &aTimer)
 
 void RFIDs::irqHandler(bool aState)
 {
+  FEATURE_STALL_GUARD;
   mIrqTimer.cancel();
   if (aState) {
     // going high (inactive)
@@ -545,6 +555,7 @@ void RFIDs::irqHandler(bool aState)
 
 void RFIDs::detectedCard(RFID522Ptr aReader, ErrorPtr aErr)
 {
+  FEATURE_STALL_GUARD;
   if (Error::isOK(aErr)) {
     OLOG(LOG_NOTICE, "Detected card on reader %d", aReader->getReaderIndex());
     aReader->antiCollision(boost::bind(&RFIDs::gotCardNUID, this, aReader, _1, _3));
@@ -558,6 +569,7 @@ void RFIDs::detectedCard(RFID522Ptr aReader, ErrorPtr aErr)
 
 void RFIDs::gotCardNUID(RFID522Ptr aReader, ErrorPtr aErr, const string aNUID)
 {
+  FEATURE_STALL_GUARD;
   if (Error::isOK(aErr)) {
     string nUID;
     // nUID is LSB first, and last byte is redundant BCC. Reverse to have MSB first, and omit BCC
@@ -46,6 +46,10 @@ Splitflaps::Splitflaps(
   mOCtrlColumns(6), // ...and 6 columns (modules) is a standard "Gleisanzeiger"
   mOCtrlDirty(false)
 {
+  // API
+  mDispatch.registerCommand("raw", boost::bind(&Splitflaps::rawCmd, this, _1));
+  mDispatch.registerCommand("position", boost::bind(&Splitflaps::positionCmd, this, _1));
+  mDispatch.registerCommand("info", boost::bind(&Splitflaps::infoCmd, this, _1));
   mSbbSerial.isMemberVariable();
   if (strcmp(aConnectionSpec,"simulation")==0) {
     // simulation mode
@@ -156,102 +160,99 @@ ErrorPtr Splitflaps::initialize(JsonObjectPtr aInitData)
 }
 
 
-ErrorPtr Splitflaps::processRequest(ApiRequestPtr aRequest)
+ErrorPtr Splitflaps::rawCmd(ApiRequestPtr aRequest)
 {
-  ErrorPtr err;
   JsonObjectPtr data = aRequest->getRequest();
-  JsonObjectPtr o = data->get("cmd");
-  if (o) {
-    string cmd = o->stringValue();
-    // decode commands
-    if (cmd=="raw") {
-      // send raw command
-      // { "cmd":"raw", "data":[ byte, byte, byte ...] }
-      // { "cmd":"raw", "data":"hexstring" }
-      // { "cmd":"raw", "data":"hexstring", "answer":3 }
-      if (!data->get("data", o)) {
-        return TextError::err("missing data");
+  JsonObjectPtr o;
+  // send raw command
+  // { "cmd":"raw", "data":[ byte, byte, byte ...] }
+  // { "cmd":"raw", "data":"hexstring" }
+  // { "cmd":"raw", "data":"hexstring", "answer":3 }
+  if (!data->get("data", o)) {
+    return TextError::err("missing data");
+  }
+  else {
+    string bytes;
+    if (o->isType(json_type_string)) {
+      // hex string of bytes
+      bytes = hexToBinaryString(o->stringValue().c_str(), true);
+    }
+    else if (o->isType(json_type_array)) {
+      // array of bytes
+      size_t nb = o->arrayLength();
+      for (int i=0; i<nb; i++) {
+        bytes += (char)(o->arrayGet(i)->int32Value());
       }
-      else {
-        string bytes;
-        if (o->isType(json_type_string)) {
-          // hex string of bytes
-          bytes = hexToBinaryString(o->stringValue().c_str(), true);
-        }
-        else if (o->isType(json_type_array)) {
-          // array of bytes
-          size_t nb = o->arrayLength();
-          for (int i=0; i<nb; i++) {
-            bytes[i] = (uint8_t)(o->arrayGet(i)->int32Value());
+    }
+    else {
+      return TextError::err("specify command as array of bytes or hexstring");
+    }
+    // possibly we want an initiation delay
+    MLMicroSeconds initiationDelay = -1; // standard
+    if (data->get("delay", o)) initiationDelay = o->doubleValue()*Second;
+    // possibly we want an answer
+    size_t answerBytes = 0;
+    if (data->get("answer", o)) answerBytes = o->int32Value();
+    sendRawCommand(bytes, answerBytes, boost::bind(&Splitflaps::rawCommandAnswer, this, aRequest, _1, _2), initiationDelay);
+    return ErrorPtr(); // handler will send reply
+  }
+}
+
+
+ErrorPtr Splitflaps::positionCmd(ApiRequestPtr aRequest)
+{
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  // set or read module position
+  // { "cmd":"position", "name":name [, "value":value] }
+  if (!data->get("name", o, true)) {
+    return TextError::err("missing module name");
+  }
+  else {
+    // find module
+    SplitFlapModuleVector::iterator mpos;
+    for (mpos=mSplitflapModules.begin(); mpos!=mSplitflapModules.end(); ++mpos) {
+      if (mpos->mName==o->stringValue()) {
+        // module found
+        if (!data->get("value", o)) {
+          // read back current module value
+          JsonObjectPtr ans;
+          uint8_t v = getModuleValue(*mpos);
+          if (mpos->mType==moduletype_alphanum) {
+            ans = JsonObject::newString((const char*)&v, 1);
+          }
+          else {
+            ans = JsonObject::newInt32(v);
           }
+          aRequest->sendResponse(ans, ErrorPtr());
+          return ErrorPtr();
         }
-        else {
-          return TextError::err("specify command as array of bytes or hexstring");
+        int value = 0;
+        if (o->isType(json_type_string) && mpos->mType==moduletype_alphanum) {
+          value = o->c_strValue()[0]; // take first char's ASCII-code as value
         }
-        // possibly we want an initiation delay
-        MLMicroSeconds initiationDelay = -1; // standard
-        if (data->get("delay", o)) initiationDelay = o->doubleValue()*Second;
-        // possibly we want an answer
-        size_t answerBytes = 0;
-        if (data->get("answer", o)) answerBytes = o->int32Value();
-        sendRawCommand(bytes, answerBytes, boost::bind(&Splitflaps::rawCommandAnswer, this, aRequest, _1, _2), initiationDelay);
-        return ErrorPtr(); // handler will send reply
-      }
-    }
-    else if (cmd=="position") {
-      // set or read module position
-      // { "cmd":"position", "name":name [, "value":value] }
-      if (!data->get("name", o, true)) {
-        return TextError::err("missing module name");
-      }
-      else {
-        // find module
-        SplitFlapModuleVector::iterator mpos;
-        for (mpos=mSplitflapModules.begin(); mpos!=mSplitflapModules.end(); ++mpos) {
-          if (mpos->mName==o->stringValue()) {
-            // module found
-            if (!data->get("value", o)) {
-              // read back current module value
-              JsonObjectPtr ans;
-              uint8_t v = getModuleValue(*mpos);
-              if (mpos->mType==moduletype_alphanum) {
-                ans = JsonObject::newString((const char*)&v, 1);
-              }
-              else {
-                ans = JsonObject::newInt32(v);
-              }
-              aRequest->sendResponse(ans, ErrorPtr());
-            }
-            int value = 0;
-            if (o->isType(json_type_string) && mpos->mType==moduletype_alphanum) {
-              value = o->c_strValue()[0]; // take first char's ASCII-code as value
-            }
-            else {
-              value = o->int32Value();
-            }
-            setModuleValue(*mpos, value);
-            return Error::ok();
-          }
+        else {
+          value = o->int32Value();
         }
-        return TextError::err("module '%s' not found", o->c_strValue());
+        setModuleValue(*mpos, value);
+        return Error::ok();
       }
     }
-    else if (cmd=="info") {
-      // TODO: implement
-      return TextError::err("info not yet implemented");
-    }
-    return inherited::processRequest(aRequest);
-  }
-  else {
-    // decode properties
-    //%%% none yet
-    return err ? err : Error::ok();
+    return TextError::err("module '%s' not found", o->c_strValue());
   }
 }
 
 
+ErrorPtr Splitflaps::infoCmd(ApiRequestPtr aRequest)
+{
+  // TODO: implement
+  return TextError::err("info not yet implemented");
+}
+
+
 void Splitflaps::rawCommandAnswer(ApiRequestPtr aRequest, const string &aResponse, ErrorPtr aError)
 {
+  FEATURE_STALL_GUARD;
   aRequest->sendResponse(JsonObject::newString(binaryToHexString(aResponse, ' ')), aError);
 }
 
@@ -283,6 +284,7 @@ JsonObjectPtr Splitflaps::status()
 
 void Splitflaps::enableSendingImmediate(bool aEnable)
 {
+  FEATURE_STALL_GUARD;
   switch(mTxEnableMode) {
     case txEnable_dtr:
       mSbbSerial.mSerialComm->setDTR(aEnable);
@@ -314,6 +316,7 @@ void Splitflaps::enableSending(bool aEnable)
 
 ssize_t Splitflaps::acceptExtraBytes(size_t aNumBytes, const uint8_t *aBytes)
 {
+  FEATURE_STALL_GUARD;
   // got bytes with no command expecting them in particular
   if (LOGENABLED(LOG_INFO)) {
     string m;
@@ -461,6 +464,7 @@ void Splitflaps::sendRawBusCommand(const string aCommand, size_t aExpectedBytes,
 
 void Splitflaps::sbbBusCommandComplete(SBBResultCB aResultCB, SerialOperationPtr aSerialOperation, ErrorPtr aError)
 {
+  FEATURE_STALL_GUARD;
   OLOG(LOG_INFO, "Command complete");
   string result;
   if (Error::isOK(aError)) {
@@ -562,6 +566,7 @@ void Splitflaps::sendCtrlCommand(const char *aCmd, SBBResultCB aResultCB)
 
 void Splitflaps::updateCtrlDisplay()
 {
+  FEATURE_STALL_GUARD;
   if (mOCtrlDirty) {
     mOCtrlDirty = false;
     string msg = "\x08"; // ^H - go to beginning of "screen"
@@ -610,6 +615,7 @@ void Splitflaps::sendRawCtrlCommand(const string aCommand, SBBResultCB aResultCB
 
 void Splitflaps::sbbCtrlCommandComplete(SBBResultCB aResultCB, ErrorPtr aError)
 {
+  FEATURE_STALL_GUARD;
   OLOG(LOG_INFO, "Command complete");
   if (aResultCB) aResultCB("", aError);
 }
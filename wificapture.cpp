@@ -0,0 +1,509 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include "wificapture.hpp"
+
+#if ENABLE_FEATURE_WIFITRACK
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __linux__
+  #include <sys/ioctl.h>
+  #include <sys/socket.h>
+  #include <net/if.h>
+  #include <net/if_arp.h>
+  #include <arpa/inet.h>
+  #include <linux/if_packet.h>
+  #include <linux/if_ether.h>
+  #include <linux/filter.h>
+#endif
+
+using namespace p44;
+
+
+static inline uint16_t le16(const uint8_t *aP)
+{
+  return aP[0] | (aP[1]<<8);
+}
+
+static inline uint32_t le32(const uint8_t *aP)
+{
+  return aP[0] | (aP[1]<<8) | (aP[2]<<16) | ((uint32_t)aP[3]<<24);
+}
+
+static inline uint64_t mac48(const uint8_t *aP)
+{
+  uint64_t mac = 0;
+  for (int i=0; i<6; i++) mac = (mac<<8) | aP[i];
+  return mac;
+}
+
+
+// MARK: ===== WTFrameDecoder
+
+bool WTFrameDecoder::decodePacket(uint32_t aLinkType, const uint8_t *aData, size_t aLen, WTSighting &aSighting)
+{
+  switch (aLinkType) {
+    case linktype_radiotap:
+      return decodeRadiotap(aData, aLen, aSighting);
+    case linktype_ieee802_11:
+      aSighting.rssi = 0;
+      return decode80211(aData, aLen, aSighting);
+    default:
+      return false;
+  }
+}
+
+
+#define RADIOTAP_FLAGS_FCS 0x10 ///< frame includes FCS at the end
+#define RADIOTAP_DBM_ANTSIGNAL 5 ///< presence bit of the dBm antenna signal field
+
+bool WTFrameDecoder::decodeRadiotap(const uint8_t *aData, size_t aLen, WTSighting &aSighting)
+{
+  // radiotap header: version(1), pad(1), length(2), present(4)[, more present words...]
+  if (aLen<8 || aData[0]!=0) return false;
+  size_t hdrLen = le16(aData+2);
+  if (hdrLen<8 || hdrLen>aLen) return false;
+  uint32_t present = le32(aData+4);
+  // skip extended presence bitmaps
+  size_t pos = 8;
+  uint32_t p = present;
+  while (p & 0x80000000) {
+    if (pos+4>hdrLen) return false;
+    p = le32(aData+pos);
+    pos += 4;
+  }
+  // walk the fields of the first presence word up to the antenna signal
+  // Note: fields are aligned to their natural size, relative to the start of the header
+  static const uint8_t fieldSize[RADIOTAP_DBM_ANTSIGNAL+1] = { 8, 1, 1, 4, 2, 1 }; // TSFT, flags, rate, channel, FHSS, dBm signal
+  static const uint8_t fieldAlign[RADIOTAP_DBM_ANTSIGNAL+1] = { 8, 1, 1, 2, 1, 1 };
+  bool fcs = false;
+  aSighting.rssi = 0;
+  for (int bit=0; bit<=RADIOTAP_DBM_ANTSIGNAL; bit++) {
+    if ((present & (1<<bit))==0) continue;
+    pos = (pos+fieldAlign[bit]-1) & ~(size_t)(fieldAlign[bit]-1);
+    if (pos+fieldSize[bit]>hdrLen) return false;
+    if (bit==1) fcs = (aData[pos] & RADIOTAP_FLAGS_FCS)!=0;
+    else if (bit==RADIOTAP_DBM_ANTSIGNAL) aSighting.rssi = (int8_t)aData[pos];
+    pos += fieldSize[bit];
+  }
+  size_t frameLen = aLen-hdrLen;
+  if (fcs) {
+    if (frameLen<4) return false;
+    frameLen -= 4;
+  }
+  return decode80211(aData+hdrLen, frameLen, aSighting);
+}
+
+
+#define IEEE80211_HDR_LEN 24
+#define IEEE80211_BEACON_FIXED_LEN 12 // timestamp(8), interval(2), capabilities(2)
+#define IEEE80211_FC0_PROBEREQ 0x40 // version 0, type 0 (mgmt), subtype 4
+#define IEEE80211_FC0_BEACON 0x80 // version 0, type 0 (mgmt), subtype 8
+#define IEEE80211_IE_SSID 0
+
+bool WTFrameDecoder::decode80211(const uint8_t *aData, size_t aLen, WTSighting &aSighting)
+{
+  if (aLen<IEEE80211_HDR_LEN) return false;
+  // frame control, duration(2), DA(6), SA(6), BSSID(6), seq(2)
+  size_t ie;
+  if (aData[0]==IEEE80211_FC0_PROBEREQ) {
+    aSighting.beacon = false;
+    ie = IEEE80211_HDR_LEN;
+  }
+  else if (aData[0]==IEEE80211_FC0_BEACON) {
+    aSighting.beacon = true;
+    ie = IEEE80211_HDR_LEN+IEEE80211_BEACON_FIXED_LEN;
+  }
+  else {
+    return false; // not a frame we are interested in
+  }
+  aSighting.mac = mac48(aData+10);
+  aSighting.bssid = mac48(aData+16);
+  // search SSID information element
+  while (ie+2<=aLen) {
+    uint8_t id = aData[ie];
+    uint8_t len = aData[ie+1];
+    if (ie+2+len>aLen) break; // truncated
+    if (id==IEEE80211_IE_SSID) {
+      setSsid(aSighting, aData+ie+2, len);
+      return true;
+    }
+    ie += 2+len;
+  }
+  return false; // no SSID element
+}
+
+
+static inline bool startsWith(const char *aP, const char *aEnd, const char *aPrefix, size_t aPrefixLen)
+{
+  return (size_t)(aEnd-aP)>=aPrefixLen && memcmp(aP, aPrefix, aPrefixLen)==0;
+}
+
+static inline int hexDigit(char aC)
+{
+  if (aC>='0' && aC<='9') return aC-'0';
+  if (aC>='a' && aC<='f') return aC-'a'+10;
+  if (aC>='A' && aC<='F') return aC-'A'+10;
+  return -1;
+}
+
+
+bool WTFrameDecoder::parseMac(const char *aText, const char *aEnd, uint64_t &aMac)
+{
+  uint64_t mac = 0;
+  for (int i=0; i<6; i++) {
+    if (i>0) {
+      if (aText>=aEnd || *aText!=':') return false;
+      aText++;
+    }
+    if (aEnd-aText<2) return false;
+    int h = hexDigit(aText[0]);
+    int l = hexDigit(aText[1]);
+    if (h<0 || l<0) return false;
+    mac = (mac<<8) | (h<<4) | l;
+    aText += 2;
+  }
+  aMac = mac;
+  return true;
+}
+
+
+void WTFrameDecoder::setSsid(WTSighting &aSighting, const uint8_t *aSsid, size_t aLen)
+{
+  if (aLen>WT_MAX_SSID_BYTES) aLen = WT_MAX_SSID_BYTES;
+  // usually, SSIDs are printable ASCII and can be used as-is
+  size_t n = 0;
+  while (n<aLen && aSsid[n]>=0x20 && aSsid[n]<0x7F) n++;
+  if (n==aLen || aSsid[n]==0) {
+    aSighting.ssid = (const char *)aSsid;
+    aSighting.ssidLen = n; // like tcpdump, stop at NUL (e.g. hidden SSIDs sent as all zero bytes)
+    return;
+  }
+  // escape like tcpdump's fn_print_char()
+  char *p = aSighting.escapedSsid;
+  memcpy(p, aSsid, n);
+  p += n;
+  for (size_t i=n; i<aLen && aSsid[i]!=0; i++) {
+    uint8_t c = aSsid[i];
+    if (c & 0x80) {
+      c &= 0x7F;
+      *p++ = 'M';
+      *p++ = '-';
+    }
+    if (c<0x20 || c==0x7F) {
+      c ^= 0x40;
+      *p++ = '^';
+    }
+    *p++ = (char)c;
+  }
+  aSighting.ssid = aSighting.escapedSsid;
+  aSighting.ssidLen = p-aSighting.escapedSsid;
+}
+
+
+// Example line:
+// 17:40:22.356367 1.0 Mb/s 2412 MHz 11b -75dBm signal -75dBm signal antenna 0 -109dBm signal antenna 1 BSSID:5c:49:79:6d:28:1a (oui Unknown) DA:5c:49:79:6d:28:1a (oui Unknown) SA:c8:bc:c8:be:0d:0a (oui Unknown) Probe Request (iWay_Fiber_bu725) [1.0* 2.0* 5.5* 11.0* 6.0 9.0 12.0 18.0 Mbit]
+bool WTFrameDecoder::parseTcpdumpLine(const char *aLine, size_t aLen, bool aBeacons, WTSighting &aSighting)
+{
+  const char *p = aLine;
+  const char *end = aLine+aLen;
+  bool haveRssi = false;
+  bool haveMac = false;
+  while (p<end) {
+    // p is at the beginning of a space separated token
+    const char *tok = p;
+    while (p<end && *p!=' ') p++;
+    size_t tl = p-tok;
+    // p is at the space after the token (or at the end)
+    if (!haveRssi) {
+      // RSSI is the number before the first "signal"
+      if (tl>0 && startsWith(p, end, " signal", 7)) {
+        int sign = 1;
+        const char *n = tok;
+        if (*n=='-') { sign = -1; n++; }
+        int v = 0;
+        while (n<p && *n>='0' && *n<='9') v = v*10 + (*n++ - '0');
+        aSighting.rssi = sign*v;
+        haveRssi = true;
+      }
+    }
+    else if (tl>3 && tok[0]=='S' && tok[1]=='A' && tok[2]==':') {
+      haveMac = parseMac(tok+3, p, aSighting.mac);
+    }
+    else if (tl>6 && memcmp(tok, "BSSID:", 6)==0) {
+      parseMac(tok+6, p, aSighting.bssid);
+    }
+    else if (tl==5 && memcmp(tok, "Probe", 5)==0 && startsWith(p, end, " Request (", 10)) {
+      if (!haveMac) return false;
+      aSighting.beacon = false;
+      p += 10;
+      break;
+    }
+    else if (tl==6 && memcmp(tok, "Beacon", 6)==0 && startsWith(p, end, " (", 2)) {
+      if (!aBeacons) return false;
+      aSighting.beacon = true;
+      p += 2;
+      break;
+    }
+    p++; // skip the space
+  }
+  if (p>=end) return false; // no probe request or beacon found
+  // p is at the start of the SSID, which ends at the first ") "
+  const char *e = p;
+  while (e<end && !(e[0]==')' && e+1<end && e[1]==' ')) e++;
+  aSighting.ssid = p;
+  aSighting.ssidLen = e-p;
+  return true;
+}
+
+
+// MARK: ===== WTPcapFile
+
+#define PCAP_MAGIC_US 0xA1B2C3D4
+#define PCAP_MAGIC_NS 0xA1B23C4D
+#define PCAP_FILE_HDR_LEN 24
+#define PCAP_RECORD_HDR_LEN 16
+
+WTPcapFile::WTPcapFile() :
+  mFd(-1),
+  mData(NULL),
+  mSize(0),
+  mPos(0),
+  mSwapped(false),
+  mNanoSeconds(false),
+  mLinkType(0)
+{
+}
+
+
+WTPcapFile::~WTPcapFile()
+{
+  close();
+}
+
+
+void WTPcapFile::close()
+{
+  if (mData) {
+    munmap((void *)mData, mSize);
+    mData = NULL;
+  }
+  if (mFd>=0) {
+    ::close(mFd);
+    mFd = -1;
+  }
+  mSize = 0;
+  mPos = 0;
+}
+
+
+uint32_t WTPcapFile::u32(size_t aOffset) const
+{
+  uint32_t v = le32(mData+aOffset);
+  if (mSwapped) v = __builtin_bswap32(v);
+  return v;
+}
+
+
+ErrorPtr WTPcapFile::open(const string aPath)
+{
+  close();
+  mFd = ::open(aPath.c_str(), O_RDONLY);
+  if (mFd<0) return SysError::errNo();
+  struct stat st;
+  if (fstat(mFd, &st)<0) {
+    ErrorPtr err = SysError::errNo();
+    close();
+    return err;
+  }
+  if (st.st_size<PCAP_FILE_HDR_LEN) {
+    close();
+    return TextError::err("'%s' is too short for a pcap file", aPath.c_str());
+  }
+  void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, mFd, 0);
+  if (m==MAP_FAILED) {
+    ErrorPtr err = SysError::errNo();
+    close();
+    return err;
+  }
+  mData = (const uint8_t *)m;
+  mSize = st.st_size;
+  madvise(m, mSize, MADV_SEQUENTIAL);
+  // check header
+  mSwapped = false;
+  uint32_t magic = u32(0);
+  if (magic!=PCAP_MAGIC_US && magic!=PCAP_MAGIC_NS) {
+    mSwapped = true;
+    magic = u32(0);
+  }
+  if (magic!=PCAP_MAGIC_US && magic!=PCAP_MAGIC_NS) {
+    close();
+    return TextError::err("'%s' is not a pcap file (note: pcapng is not supported)", aPath.c_str());
+  }
+  mNanoSeconds = magic==PCAP_MAGIC_NS;
+  mLinkType = u32(20) & 0x0FFFFFFF; // upper bits are FCS info
+  if (mLinkType!=WTFrameDecoder::linktype_radiotap && mLinkType!=WTFrameDecoder::linktype_ieee802_11) {
+    close();
+    return TextError::err("'%s' has unsupported link type %u (need radiotap or 802.11)", aPath.c_str(), mLinkType);
+  }
+  mPos = PCAP_FILE_HDR_LEN;
+  return ErrorPtr();
+}
+
+
+void WTPcapFile::rewind()
+{
+  if (mData) mPos = PCAP_FILE_HDR_LEN;
+}
+
+
+bool WTPcapFile::nextPacket(const uint8_t *&aData, size_t &aLen, MLMicroSeconds &aTimestamp)
+{
+  if (!mData || mPos+PCAP_RECORD_HDR_LEN>mSize) return false;
+  uint32_t secs = u32(mPos);
+  uint32_t frac = u32(mPos+4);
+  uint32_t inclLen = u32(mPos+8);
+  mPos += PCAP_RECORD_HDR_LEN;
+  if (inclLen>mSize-mPos) {
+    // truncated file
+    mPos = mSize;
+    return false;
+  }
+  aData = mData+mPos;
+  aLen = inclLen;
+  aTimestamp = (MLMicroSeconds)secs*Second + (mNanoSeconds ? frac/1000 : frac);
+  mPos += inclLen;
+  return true;
+}
+
+
+// MARK: ===== WTPacketSocket
+
+WTPacketSocket::WTPacketSocket() :
+  mFd(-1)
+{
+}
+
+
+WTPacketSocket::~WTPacketSocket()
+{
+  close();
+}
+
+
+void WTPacketSocket::close()
+{
+  if (mFd>=0) {
+    ::close(mFd);
+    mFd = -1;
+  }
+}
+
+
+#define CAPTURE_RCVBUF_SIZE (1024*1024) ///< socket buffer to survive bursts of probe requests
+
+ErrorPtr WTPacketSocket::open(const string aInterface, bool aBeacons)
+{
+  close();
+  #ifdef __linux__
+  ErrorPtr err;
+  unsigned int ifIndex = if_nametoindex(aInterface.c_str());
+  if (ifIndex==0) {
+    return TextError::err("unknown interface '%s'", aInterface.c_str());
+  }
+  mFd = socket(AF_PACKET, SOCK_RAW|SOCK_NONBLOCK|SOCK_CLOEXEC, htons(ETH_P_ALL));
+  if (mFd<0) return SysError::errNo();
+  // must be a monitor mode interface delivering radiotap headers
+  struct ifreq ifr;
+  memset(&ifr, 0, sizeof(ifr));
+  strncpy(ifr.ifr_name, aInterface.c_str(), IFNAMSIZ-1);
+  if (ioctl(mFd, SIOCGIFHWADDR, &ifr)<0) {
+    err = SysError::errNo();
+  }
+  else if (ifr.ifr_hwaddr.sa_family!=ARPHRD_IEEE80211_RADIOTAP) {
+    err = TextError::err("'%s' is not a monitor mode interface with radiotap headers", aInterface.c_str());
+  }
+  if (Error::isOK(err)) {
+    // kernel filter: only pass probe requests (and beacons), so other traffic does not even wake us up
+    // - X = radiotap header length (little endian 16 bit at offset 2)
+    // - A = first byte of 802.11 frame control
+    struct sock_filter code[] = {
+      BPF_STMT(BPF_LD+BPF_B+BPF_ABS, 3),
+      BPF_STMT(BPF_ALU+BPF_LSH+BPF_K, 8),
+      BPF_STMT(BPF_MISC+BPF_TAX, 0),
+      BPF_STMT(BPF_LD+BPF_B+BPF_ABS, 2),
+      BPF_STMT(BPF_ALU+BPF_ADD+BPF_X, 0),
+      BPF_STMT(BPF_MISC+BPF_TAX, 0),
+      BPF_STMT(BPF_LD+BPF_B+BPF_IND, 0),
+      BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, IEEE80211_FC0_PROBEREQ, 1, 0),
+      BPF_JUMP(BPF_JMP+BPF_JEQ+BPF_K, (uint32_t)(aBeacons ? IEEE80211_FC0_BEACON : IEEE80211_FC0_PROBEREQ), 0, 1),
+      BPF_STMT(BPF_RET+BPF_K, WT_MAX_FRAME_SIZE),
+      BPF_STMT(BPF_RET+BPF_K, 0)
+    };
+    struct sock_fprog prog;
+    prog.len = sizeof(code)/sizeof(code[0]);
+    prog.filter = code;
+    if (setsockopt(mFd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog))<0) {
+      err = SysError::errNo();
+    }
+  }
+  if (Error::isOK(err)) {
+    int rcvbuf = CAPTURE_RCVBUF_SIZE;
+    setsockopt(mFd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf)); // not fatal if it fails
+    struct sockaddr_ll sll;
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = ifIndex;
+    if (bind(mFd, (struct sockaddr *)&sll, sizeof(sll))<0) {
+      err = SysError::errNo();
+    }
+  }
+  if (Error::notOK(err)) close();
+  return err;
+  #else
+  return TextError::err("native wifi capture is only available on Linux");
+  #endif
+}
+
+
+size_t WTPacketSocket::receive(const uint8_t *&aData, ErrorPtr &aErr)
+{
+  if (mFd<0) return 0;
+  ssize_t n = recv(mFd, mBuffer, sizeof(mBuffer), 0);
+  if (n<0) {
+    if (errno!=EAGAIN && errno!=EWOULDBLOCK && errno!=EINTR) {
+      aErr = SysError::errNo();
+    }
+    return 0;
+  }
+  aData = mBuffer;
+  return (size_t)n;
+}
+
+#endif // ENABLE_FEATURE_WIFITRACK
@@ -0,0 +1,237 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44features_wificapture_hpp__
+#define __p44features_wificapture_hpp__
+
+#include "p44features_common.hpp"
+
+#if ENABLE_FEATURE_WIFITRACK
+
+namespace p44 {
+
+  #define WT_MAX_SSID_BYTES 32 ///< max length of a SSID as sent
+  #define WT_MAX_SSID_LEN (4*WT_MAX_SSID_BYTES) ///< max length of a SSID as recorded (escaped, up to 4 chars per byte)
+
+  /// a probe request or beacon, as decoded from a captured frame (or a tcpdump output line)
+  /// @note SSIDs are always represented the way tcpdump prints them (up to the first NUL byte, non-ASCII bytes
+  ///   prefixed with "M-", control characters as "^" followed by the character XOR 0x40), no matter
+  ///   if decoded from a frame or parsed from tcpdump output, so the same network always has the same SSID.
+  ///   This is also the representation of SSIDs in state saved by versions using tcpdump only.
+  /// @note the SSID is not copied, but points into the buffer the sighting was decoded from (or, if it needed
+  ///   escaping, into the sighting itself), so it is valid only as long as that buffer remains unchanged.
+  struct WTSighting
+  {
+    bool beacon; ///< set for beacons, otherwise it is a probe request
+    int rssi; ///< signal in dBm, 0 if unknown
+    uint64_t mac; ///< sender (source address)
+    uint64_t bssid; ///< BSSID
+    const char *ssid; ///< the SSID (not null terminated, escaped like tcpdump does)
+    size_t ssidLen; ///< length of the SSID
+    MLMicroSeconds timestamp; ///< when the frame was captured, Never if unknown
+    char escapedSsid[WT_MAX_SSID_LEN]; ///< buffer for SSIDs from captured frames which needed escaping
+
+    WTSighting() : beacon(false), rssi(0), mac(0), bssid(0), ssid(""), ssidLen(0), timestamp(Never) {};
+
+    /// @return SSID as string (allocates!)
+    string ssidStr() const { return string(ssid, ssidLen); }
+  };
+
+
+  /// self-contained copy of a sighting (with the SSID copied), for passing sightings between threads
+  struct WTSightingRecord
+  {
+    bool beacon;
+    int8_t rssi;
+    uint8_t ssidLen;
+    uint64_t mac;
+    uint64_t bssid;
+    MLMicroSeconds timestamp;
+    char ssid[WT_MAX_SSID_LEN];
+
+    WTSightingRecord() : beacon(false), rssi(0), ssidLen(0), mac(0), bssid(0), timestamp(Never) {};
+
+    /// copy sighting into this record
+    /// @note SSIDs longer than WT_MAX_SSID_LEN are truncated
+    void set(const WTSighting &aSighting)
+    {
+      beacon = aSighting.beacon;
+      rssi = (int8_t)aSighting.rssi;
+      mac = aSighting.mac;
+      bssid = aSighting.bssid;
+      timestamp = aSighting.timestamp;
+      ssidLen = (uint8_t)(aSighting.ssidLen>WT_MAX_SSID_LEN ? WT_MAX_SSID_LEN : aSighting.ssidLen);
+      memcpy(ssid, aSighting.ssid, ssidLen);
+    }
+
+    /// get sighting from this record
+    /// @note the sighting's SSID points into this record
+    void get(WTSighting &aSighting) const
+    {
+      aSighting.beacon = beacon;
+      aSighting.rssi = rssi;
+      aSighting.mac = mac;
+      aSighting.bssid = bssid;
+      aSighting.timestamp = timestamp;
+      aSighting.ssid = ssid;
+      aSighting.ssidLen = ssidLen;
+    }
+  };
+
+
+  /// decoder for captured 802.11 frames
+  class WTFrameDecoder
+  {
+  public:
+
+    /// pcap link types we can decode
+    enum {
+      linktype_ieee802_11 = 105, ///< plain 802.11 frames (no signal info)
+      linktype_radiotap = 127 ///< 802.11 frames preceded by radiotap header
+    };
+
+    /// decode a captured packet
+    /// @param aLinkType link type of the capture (see enum)
+    /// @param aData the packet
+    /// @param aLen length of the packet
+    /// @param aSighting will receive the decoded info (timestamp is not touched)
+    /// @return true if packet is a probe request or a beacon and could be decoded
+    static bool decodePacket(uint32_t aLinkType, const uint8_t *aData, size_t aLen, WTSighting &aSighting);
+
+    /// decode 802.11 frame preceded by radiotap header
+    static bool decodeRadiotap(const uint8_t *aData, size_t aLen, WTSighting &aSighting);
+
+    /// decode 802.11 management frame
+    /// @note rssi and timestamp are not touched
+    static bool decode80211(const uint8_t *aData, size_t aLen, WTSighting &aSighting);
+
+    /// set the SSID of a sighting from the bytes as sent, escaped the same way as tcpdump prints it
+    /// @param aSighting the sighting
+    /// @param aSsid the SSID as sent (only the first WT_MAX_SSID_BYTES are used)
+    /// @param aLen length of the SSID
+    static void setSsid(WTSighting &aSighting, const uint8_t *aSsid, size_t aLen);
+
+    /// parse a line of `tcpdump -e` output in a single pass, without allocating memory
+    /// @param aLine the line (need not be null terminated)
+    /// @param aLen length of the line
+    /// @param aBeacons if set, beacons are decoded, otherwise only probe requests
+    /// @param aSighting will receive the decoded info (timestamp is not touched)
+    /// @return true if line is a probe request (or beacon) and could be decoded
+    static bool parseTcpdumpLine(const char *aLine, size_t aLen, bool aBeacons, WTSighting &aSighting);
+
+    /// parse a MAC address in xx:xx:xx:xx:xx:xx notation
+    /// @param aText the text
+    /// @param aEnd end of text
+    /// @param aMac will receive the MAC
+    /// @return true if a MAC address was found
+    static bool parseMac(const char *aText, const char *aEnd, uint64_t &aMac);
+
+  };
+
+
+  /// read-only access to a (classic, non-pcapng) pcap file, memory mapped
+  class WTPcapFile
+  {
+    int mFd;
+    const uint8_t *mData;
+    size_t mSize;
+    size_t mPos;
+    bool mSwapped;
+    bool mNanoSeconds;
+    uint32_t mLinkType;
+
+  public:
+
+    WTPcapFile();
+    ~WTPcapFile();
+
+    /// open a pcap file
+    /// @param aPath path to the pcap file
+    /// @return error if file cannot be opened or is not a pcap file with a link type we can decode
+    ErrorPtr open(const string aPath);
+
+    /// close the file
+    void close();
+
+    /// @return true if file is open
+    bool isOpen() const { return mData!=NULL; }
+
+    /// @return link type of the packets in this file
+    uint32_t linkType() const { return mLinkType; }
+
+    /// get next packet
+    /// @param aData will be set to point to the packet data (in the mapped file)
+    /// @param aLen will be set to the captured length of the packet
+    /// @param aTimestamp will be set to the packet's capture time (unix time)
+    /// @return false at end of file
+    bool nextPacket(const uint8_t *&aData, size_t &aLen, MLMicroSeconds &aTimestamp);
+
+    /// restart reading from the first packet
+    void rewind();
+
+  private:
+
+    uint32_t u32(size_t aOffset) const;
+
+  };
+
+
+  #define WT_MAX_FRAME_SIZE 4096 ///< frames larger than this are truncated (we only need the start of mgmt frames)
+
+  /// capture of 802.11 management frames with radiotap headers from a monitor mode interface
+  /// @note only available on Linux (AF_PACKET socket)
+  class WTPacketSocket
+  {
+    int mFd;
+    uint8_t mBuffer[WT_MAX_FRAME_SIZE];
+
+  public:
+
+    WTPacketSocket();
+    ~WTPacketSocket();
+
+    /// open capture
+    /// @param aInterface the monitor mode interface
+    /// @param aBeacons if set, beacons are captured in addition to probe requests
+    /// @return error if capture cannot be started
+    /// @note a kernel packet filter is installed, so only probe requests (and beacons) wake up the process
+    ErrorPtr open(const string aInterface, bool aBeacons);
+
+    /// close capture
+    void close();
+
+    /// @return file descriptor to poll for POLLIN, -1 if not open
+    int fd() const { return mFd; }
+
+    /// receive a frame (non-blocking)
+    /// @param aData will be set to point to the frame in the internal buffer, valid until next receive()
+    /// @param aErr will be set in case of error
+    /// @return size of the frame, 0 if none available
+    size_t receive(const uint8_t *&aData, ErrorPtr &aErr);
+
+  };
+
+} // namespace p44
+
+#endif // ENABLE_FEATURE_WIFITRACK
+
+#endif /* __p44features_wificapture_hpp__ */
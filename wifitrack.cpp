@@ -32,7 +32,30 @@
 #include "application.hpp"
 #include "viewstack.hpp"
 
-#define WIFITRACK_STATE_FILE_NAME "wifitrack_state.json"
+#include <poll.h>
+#include <fcntl.h>
+
+#define WIFITRACK_STATE_FILE_NAME "wifitrack_state.json" ///< JSON export
+#define WIFITRACK_SNAPSHOT_FILE_NAME "wifitrack_state.bin" ///< binary snapshot, see wtsnapshot.hpp
+#define WIFITRACK_EXPORT_FILE_NAME "wifitrack_export.ndjson" ///< default NDJSON export file (in temp directory)
+#define WIFITRACK_HOT_OUIS_FILE_NAME "wifitrack_hot_ouis.txt" ///< vendors seen before, same format as oui.txt
+#define WIFITRACK_CHANGELOG_FILE_NAME "wifitrack_changes.log" ///< generation number gets appended
+
+#define MIN_COMPACTION_LOG_SIZE (1024*1024) ///< change log is not compacted before reaching this size
+#define WT_NOT_IN_SNAPSHOT 0xFFFFFFFF ///< marks MACs created after a snapshot was started
+
+#define EVICTION_CHECK_INTERVAL (1*Minute)
+#define AUTOSAVE_CHECK_INTERVAL (10*Second) ///< how often the autosave intervals are checked
+#define THREAD_STOP_TIMEOUT (5*Second) ///< max time to wait for the threads to end
+// rough memory cost estimates, including hash store slots, set nodes and allocation overhead
+#define WT_MAC_COST (sizeof(WTMac)+32)
+#define WT_LINK_COST (4+8) ///< SSID id in MAC plus MAC pointer in SSID
+#define WT_SSID_COST (sizeof(WTSSid)+48)
+#define WT_PERSON_COST (sizeof(WTPerson)+64)
+#define WT_PAIR_COST 24
+#define WT_EPHEMERAL_COST (sizeof(WTEphemeralMac)+32)
+
+#define EPHEMERAL_PRUNE_INTERVAL (1*Minute)
 
 #define FEATURE_NAME "wifitrack"
 
@@ -40,37 +63,120 @@
 using namespace p44;
 
 
+#if IN_THREAD
+
+/// scoped lock for the tracking data, for API access while the aggregation thread is running
+class WTDataLock
+{
+  pthread_mutex_t *mMutex;
+public:
+  WTDataLock(pthread_mutex_t *aMutex) : mMutex(aMutex) { if (mMutex) pthread_mutex_lock(mMutex); };
+  ~WTDataLock() { if (mMutex) pthread_mutex_unlock(mMutex); };
+};
+#define WT_DATA_LOCK WTDataLock dataLock(mAggregationThread ? &mDataMutex : NULL)
+
+#else
+
+#define WT_DATA_LOCK
+
+#endif // IN_THREAD
+
+
 
 // MARK: ===== WTMac
 
 WTMac::WTMac() :
+  id(0),
   seenLast(Never),
   seenFirst(Never),
   seenCount(0),
   ouiName(NULL),
+  ouiResolved(false),
   lastRssi(-9999),
   bestRssi(-9999),
   worstRssi(9999),
-  hidden(false)
+  hidden(false),
+  dirty(false),
+  proxy(false),
+  nextInPerson(NULL),
+  prevInPerson(NULL)
+{
+}
+
+
+bool WTMac::hasSsid(uint32_t aSsidId) const
+{
+  return std::binary_search(ssids.begin(), ssids.end(), aSsidId);
+}
+
+
+bool WTMac::addSsid(uint32_t aSsidId)
+{
+  WTSSidIdList::iterator pos = std::lower_bound(ssids.begin(), ssids.end(), aSsidId);
+  if (pos!=ssids.end() && *pos==aSsidId) return false; // already known
+  ssids.insert(pos, aSsidId);
+  return true;
+}
+
+
+/// @return key for the pair index, independent of order of the MACs
+static uint64_t macPairKey(const WTMac &aA, const WTMac &aB)
+{
+  // +1 to make sure key is never 0
+  if (aA.id<aB.id) return ((uint64_t)aA.id<<32)+aB.id+1;
+  return ((uint64_t)aB.id<<32)+aA.id+1;
+}
+
+
+/// @return true if MAC is locally administered, which is what randomized MACs are
+static inline bool isRandomizedMac(uint64_t aMac)
 {
+  return (aMac>>40) & 0x02;
 }
 
 
 // MARK: ===== WTSSid
 
 WTSSid::WTSSid() :
+  id(0),
   seenLast(Never),
   seenCount(0),
   hidden(false),
+  dirty(false),
   beaconSeenLast(Never),
   beaconRssi(-9999)
 {
 }
 
 
+static bool macIdLess(const WTMacPtr &aA, const WTMacPtr &aB)
+{
+  return aA->id<aB->id;
+}
+
+
+bool WTSSid::addMac(WTMacPtr aMac)
+{
+  WTMacList::iterator pos = std::lower_bound(macs.begin(), macs.end(), aMac, macIdLess);
+  if (pos!=macs.end() && *pos==aMac) return false; // already known
+  macs.insert(pos, aMac);
+  return true;
+}
+
+
+bool WTSSid::removeMac(WTMacPtr aMac)
+{
+  WTMacList::iterator pos = std::lower_bound(macs.begin(), macs.end(), aMac, macIdLess);
+  if (pos==macs.end() || *pos!=aMac) return false;
+  macs.erase(pos);
+  return true;
+}
+
+
 // MARK: ===== WTPerson
 
 WTPerson::WTPerson() :
+  id(0),
   seenLast(Never),
   seenFirst(Never),
   seenCount(0),
@@ -80,7 +186,11 @@ WTPerson::WTPerson() :
   shownLast(Never),
   color(white),
   imageIndex(0),
-  hidden(false)
+  hidden(false),
+  dirty(false),
+  firstMac(NULL),
+  lastMac(NULL),
+  macCount(0)
 {
 }
 
@@ -88,21 +198,30 @@ WTPerson::WTPerson() :
 
 // MARK: ===== WifiTrack
 
-WifiTrack::WifiTrack(const string aMonitorIf, int aRadiotapDBOffset, bool doStart) :
+WifiTrack::WifiTrack(const string aMonitorIf, int aRadiotapDBOffset, bool aNativeCapture, bool doStart) :
   inherited(FEATURE_NAME),
   #if IN_THREAD
   mUseThread(false),
+  mAggregationThreadP(NULL),
+  mRunningThreads(0),
+  mSightingQueue(4096),
+  mDroppedSightings(0),
+  mEventQueue(256),
   #endif
   mDirectDisplay(true),
   mApiNotify(false),
   mMonitorIf(aMonitorIf),
+  mNativeCapture(aNativeCapture),
   mDumpPid(-1),
+  mDumpBufferFill(0),
+  mDumpLineOverflow(false),
   mRememberWithoutSsid(false),
   mOuiNames(true),
   mMinShowInterval(3*Minute),
   mMinRssi(-80),
   mRadiotapDBOffset(0x16), // correct value for mt76 on Openwrt 19.07, must be 0x1E on Openwrt 22.03
   mReportSightings(false),
+  mSightingEventsWanted(false),
   mAggregatePersons(true),
   mScanBeacons(true),
   mMinProcessRssi(-99),
@@ -111,15 +230,79 @@ WifiTrack::WifiTrack(const string aMonitorIf, int aRadiotapDBOffset, bool doStar
   mMinCommonSsidCount(3),
   mNumPersonImages(24),
   mMaxDisplayDelay(21*Second),
-  mSaveTempInterval(10*Minute),
+  mSaveTempInterval(1*Minute),
   mSaveDataInterval(7*Day),
   mLastTempAutoSave(Never),
   mLastDataAutoSave(Never),
-  mLoadingContent(false)
+  mGeneration(0),
+  mChangeLog(NULL),
+  mChangeLogBytes(0),
+  mSnapshotBytes(0),
+  mCompactionWanted(false),
+  mSnapshotCompaction(false),
+  mSnapshotPhase(0),
+  mSnapshotIdx(0),
+  mLoadingContent(false),
+  mNextMacId(0),
+  mNextPersonId(0),
+  mMeasureAggregation(false),
+  mAggregationTime(0),
+  mMaxMemory(0),
+  mMaxMacAge(0),
+  mEvictMinAge(1*Hour),
+  mLastEvictionCheck(Never),
+  mEvictedMacs(0),
+  mEvictedSsids(0),
+  mEvictedPersons(0),
+  mCollapseRandomMacs(true),
+  mEphemeralTTL(15*Minute),
+  mLastEphemeralPrune(Never),
+  mCollapsedMacs(0),
+  mExportFile(NULL),
+  mExportOUINames(false),
+  mExportPhase(0),
+  mExportIdx(0),
+  mExportEntries(0),
+  mOuisReady(false),
+  mOuiLoadFile(NULL)
 {
   if (aRadiotapDBOffset>0) {
     mRadiotapDBOffset = aRadiotapDBOffset;
   }
+  #if IN_THREAD
+  mWakeFds[0] = -1;
+  mWakeFds[1] = -1;
+  #endif
+  // API
+  mDispatch.registerCommand("dump", boost::bind(&WifiTrack::dumpCmd, this, _1));
+  mDispatch.registerCommand("dumppage", boost::bind(&WifiTrack::dumpPageCmd, this, _1));
+  mDispatch.registerCommand("export", boost::bind(&WifiTrack::exportCmd, this, _1));
+  mDispatch.registerCommand("save", boost::bind(&WifiTrack::saveCmd, this, _1));
+  mDispatch.registerCommand("load", boost::bind(&WifiTrack::loadCmd, this, _1));
+  mDispatch.registerCommand("test", boost::bind(&WifiTrack::testCmd, this, _1));
+  mDispatch.registerCommand("hide", boost::bind(&WifiTrack::hideCmd, this, _1));
+  mDispatch.registerCommand("rename", boost::bind(&WifiTrack::renameCmd, this, _1));
+  mDispatch.registerCommand("restart", boost::bind(&WifiTrack::restartCmd, this, _1));
+  mDispatch.registerTimeProperty("minShowInterval", mMinShowInterval);
+  mDispatch.registerBoolProperty("rememberWithoutSsid", mRememberWithoutSsid);
+  mDispatch.registerBoolProperty("ouiNames", mOuiNames);
+  mDispatch.registerBoolProperty("reportSightings", mReportSightings);
+  mDispatch.registerBoolProperty("aggregatePersons", mAggregatePersons);
+  mDispatch.registerIntProperty("minProcessRssi", mMinProcessRssi);
+  mDispatch.registerProperty("minRssi", boost::bind(&WifiTrack::minRssiProp, this, _1));
+  mDispatch.registerProperty("scanBeacons", boost::bind(&WifiTrack::scanBeaconsProp, this, _1));
+  mDispatch.registerIntProperty("minShowRssi", mMinShowRssi);
+  mDispatch.registerProperty("tooCommonMacCount", boost::bind(&WifiTrack::tooCommonMacCountProp, this, _1));
+  mDispatch.registerIntProperty("minCommonSsidCount", mMinCommonSsidCount);
+  mDispatch.registerIntProperty("numPersonImages", mNumPersonImages);
+  mDispatch.registerTimeProperty("maxDisplayDelay", mMaxDisplayDelay);
+  mDispatch.registerTimeProperty("saveTempInterval", mSaveTempInterval);
+  mDispatch.registerTimeProperty("saveDataInterval", mSaveDataInterval);
+  mDispatch.registerIntProperty("maxMemory", mMaxMemory);
+  mDispatch.registerTimeProperty("maxMacAge", mMaxMacAge);
+  mDispatch.registerTimeProperty("evictMinAge", mEvictMinAge);
+  mDispatch.registerBoolProperty("collapseRandomMacs", mCollapseRandomMacs);
+  mDispatch.registerTimeProperty("ephemeralTTL", mEphemeralTTL);
   // check for commandline-triggered standalone operation
   if (doStart) {
     initOperation();
@@ -130,18 +313,19 @@ WifiTrack::WifiTrack(const string aMonitorIf, int aRadiotapDBOffset, bool doStar
 void WifiTrack::reset()
 {
   OLOG(LOG_INFO,"Received reset command, request RFID polling termination")
+  mReplayTicket.cancel();
+  mPcapReplay.close();
   #if IN_THREAD
-  if (mWifiTrackingThread) {
-    // make terminate (will do in background)
-    mWifiTrackingThread->disconnect();
-    mWifiTrackingThread->terminate();
-    mWifiTrackingThread.reset();
-    // forget this mutex, new thread will create a new one
-    pthread_mutex_destroy(&mReportMutex);
+  if (mWifiTrackingThread || mAggregationThread) {
+    stopThreads();
+    mCapture.close(); // poll handler was in the thread's mainloop, which is gone now
+    stopPersistence();
     inherited::reset();
     return;
   }
   #endif // IN_THREAD
+  stopNativeCapture();
+  stopPersistence();
   inherited::reset();
 }
 
@@ -167,6 +351,12 @@ ErrorPtr WifiTrack::initialize(JsonObjectPtr aInitData)
   if (aInitData->get("radiotapDBoffs", o)) {
     mRadiotapDBOffset = o->int32Value();
   }
+  if (aInitData->get("nativeCapture", o)) {
+    mNativeCapture = o->boolValue();
+  }
+  if (aInitData->get("pcapFile", o)) {
+    mPcapFile = o->stringValue();
+  }
   #if IN_THREAD
   if (aInitData->get("trackingthread", o)) {
     mUseThread = o->boolValue();
@@ -177,161 +367,360 @@ ErrorPtr WifiTrack::initialize(JsonObjectPtr aInitData)
 }
 
 
-ErrorPtr WifiTrack::processRequest(ApiRequestPtr aRequest)
+ErrorPtr WifiTrack::dumpCmd(ApiRequestPtr aRequest)
 {
-  ErrorPtr err;
+  WT_DATA_LOCK;
   JsonObjectPtr data = aRequest->getRequest();
-  JsonObjectPtr o = data->get("cmd");
-  if (o) {
-    string cmd = o->stringValue();
-    if (cmd=="dump") {
-      bool ssids = true;
-      bool macs = true;
-      bool persons = true;
-      bool personssids = false;
-      bool ouinames = true;
-      if (data->get("ssids", o)) ssids = o->boolValue();
-      if (data->get("macs", o)) macs = o->boolValue();
-      if (data->get("persons", o)) persons = o->boolValue();
-      if (data->get("personssids", o)) personssids = o->boolValue();
-      if (data->get("ouinames", o)) ouinames = o->boolValue();
-      JsonObjectPtr ans = dataDump(ssids, macs, persons, ouinames, personssids);
-      aRequest->sendResponse(ans, ErrorPtr());
-      return ErrorPtr();
-    }
-    else if (cmd=="save") {
-      string path = Application::sharedApplication()->dataPath(WIFITRACK_STATE_FILE_NAME);
-      if (data->get("path", o)) path = o->stringValue();
-      err = save(path);
-      return err ? err : Error::ok();
-    }
-    else if (cmd=="load") {
-      string path = Application::sharedApplication()->dataPath(WIFITRACK_STATE_FILE_NAME);
-      if (data->get("path", o)) path = o->stringValue();
-      err = load(path);
-      return err ? err : Error::ok();
-    }
-    else if (cmd=="test") {
-      string intro = "hi";
-      string name = "anonymus";
-      string brand = "any";
-      string target = "wifi";
-      if (data->get("intro", o)) intro = o->stringValue();
-      if (data->get("name", o)) name = o->stringValue();
-      if (data->get("brand", o)) brand = o->stringValue();
-      if (data->get("target", o)) target = o->stringValue();
-      int imgIdx = 0;
-      if (data->get("imgidx", o)) imgIdx = o->int32Value() % mNumPersonImages;
-      PixelColor col = white;
-      if (data->get("color", o)) col = webColorToPixel(o->stringValue());
-      displayEncounter(intro, imgIdx, col, name, brand, target);
-      return Error::ok();
-    }
-    else if (cmd=="hide") {
-      bool hide = true;
-      if (data->get("hide", o)) hide = o->boolValue();
-      if (data->get("ssid", o)) {
-        string s = o->stringValue();
-        WTSSidMap::iterator pos = mSsids.find(s);
-        if (pos!=mSsids.end()) {
-          pos->second->hidden = hide;
-        }
-      }
-      else if (data->get("mac", o)) {
-        uint64_t mac = stringToMacAddress(o->stringValue().c_str());
-        WTMacMap::iterator pos = mMacs.find(mac);
-        if (pos!=mMacs.end()) {
-          if (data->get("withperson", o)) {
-            if (pos->second->person && o->boolValue()) pos->second->person->hidden = hide; // hide associated person
-          }
-          pos->second->hidden = hide;
-        }
-      }
-      return Error::ok();
-    }
-    else if (cmd=="rename") {
-      if (data->get("mac", o)) {
-        uint64_t mac = stringToMacAddress(o->stringValue().c_str());
-        WTMacMap::iterator pos = mMacs.find(mac);
-        if (pos!=mMacs.end() && pos->second->person) {
-          if (data->get("name", o)) {
-            pos->second->person->name = o->stringValue();
-          }
-          if (data->get("color", o)) {
-            pos->second->person->color = webColorToPixel(o->stringValue());
-          }
-          if (data->get("imgidx", o)) {
-            pos->second->person->imageIndex = o->int32Value() % mNumPersonImages;
-          }
-        }
-      }
-      return Error::ok();
+  JsonObjectPtr o;
+  bool ssids = true;
+  bool macs = true;
+  bool persons = true;
+  bool personssids = false;
+  bool ouinames = true;
+  if (data->get("ssids", o)) ssids = o->boolValue();
+  if (data->get("macs", o)) macs = o->boolValue();
+  if (data->get("persons", o)) persons = o->boolValue();
+  if (data->get("personssids", o)) personssids = o->boolValue();
+  if (data->get("ouinames", o)) ouinames = o->boolValue();
+  JsonObjectPtr ans = dataDump(ssids, macs, persons, ouinames, personssids);
+  aRequest->sendResponse(ans, ErrorPtr());
+  return ErrorPtr();
+}
+
+
+#define DUMP_PAGE_SIZE 100 ///< default number of objects per page for dumppage
+#define MAX_DUMP_PAGE_SIZE 1000 ///< max number of objects per page for dumppage
+
+ErrorPtr WifiTrack::dumpPageCmd(ApiRequestPtr aRequest)
+{
+  WT_DATA_LOCK;
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  string what = "macs";
+  string cursor;
+  bool hasCursor = false;
+  int count = DUMP_PAGE_SIZE;
+  bool personssids = false;
+  bool ouinames = true;
+  if (data->get("what", o)) what = o->stringValue();
+  if (data->get("cursor", o)) { cursor = o->stringValue(); hasCursor = true; }
+  if (data->get("count", o)) count = o->int32Value();
+  if (data->get("personssids", o)) personssids = o->boolValue();
+  if (data->get("ouinames", o)) ouinames = o->boolValue();
+  if (count<1 || count>MAX_DUMP_PAGE_SIZE) return TextError::err("count must be 1..%d", MAX_DUMP_PAGE_SIZE);
+  MLMicroSeconds unixTimeOffset = -MainLoop::now()+MainLoop::unixtime();
+  JsonObjectPtr ans = JsonObject::newObj();
+  bool more = false;
+  string next;
+  if (what=="ssids") {
+    std::vector<WTSSidPtr> page;
+    ssidPage(hasCursor, cursor, count, page);
+    JsonObjectPtr sans = JsonObject::newObj();
+    for (std::vector<WTSSidPtr>::iterator spos = page.begin(); spos!=page.end(); ++spos) {
+      sans->add((*spos)->ssid.c_str(), ssidJson(*spos, unixTimeOffset));
     }
-    else if (cmd=="restart") {
-      restartScanner();
-      return Error::ok();
+    ans->add("ssids", sans);
+    ans->add("numssids", JsonObject::newInt64(mSsids.size()));
+    if ((more = page.size()==(size_t)count)) next = page.back()->ssid;
+  }
+  else if (what=="macs") {
+    std::vector<WTMacPtr> page;
+    macPage(hasCursor, hasCursor ? stringToMacAddress(cursor.c_str()) : 0, count, page);
+    JsonObjectPtr mans = JsonObject::newObj();
+    for (std::vector<WTMacPtr>::iterator mpos = page.begin(); mpos!=page.end(); ++mpos) {
+      mans->add(macAddressToString((*mpos)->mac, ':').c_str(), macJson(*mpos, unixTimeOffset, ouinames));
     }
-    else {
-      return inherited::processRequest(aRequest);
+    ans->add("macs", mans);
+    ans->add("nummacs", JsonObject::newInt64(mMacs.size()));
+    if ((more = page.size()==(size_t)count)) next = macAddressToString(page.back()->mac, ':');
+  }
+  else if (what=="persons") {
+    std::vector<WTPersonPtr> page;
+    personPage(hasCursor, hasCursor ? (uint32_t)atol(cursor.c_str()) : 0, count, page);
+    JsonObjectPtr pans = JsonObject::newArray();
+    for (std::vector<WTPersonPtr>::iterator ppos = page.begin(); ppos!=page.end(); ++ppos) {
+      pans->arrayAppend(personJson(*ppos, unixTimeOffset, personssids));
     }
+    ans->add("persons", pans);
+    ans->add("numpersons", JsonObject::newInt64(mPersons.size()));
+    if ((more = page.size()==(size_t)count)) next = string_format("%u", page.back()->id);
   }
   else {
-    // decode properties
-    if (data->get("minShowInterval", o, true)) {
-      mMinShowInterval = o->doubleValue()*Second;
-    }
-    if (data->get("rememberWithoutSsid", o, true)) {
-      mRememberWithoutSsid = o->boolValue();
-    }
-    if (data->get("ouiNames", o, true)) {
-      mOuiNames = o->boolValue();
-    }
-    if (data->get("reportSightings", o)) {
-      mReportSightings = o->boolValue();
-    }
-    if (data->get("aggregatePersons", o)) {
-      mAggregatePersons = o->boolValue();
-    }
-    if (data->get("minProcessRssi", o, true)) {
-      mMinProcessRssi = o->int32Value();
-    }
-    if (data->get("minRssi", o, true)) {
-      int i = o->int32Value();
-      if (i!=mMinRssi) {
-        mMinRssi = i;
-        restartScanner();
+    return TextError::err("unknown 'what', must be 'ssids', 'macs' or 'persons'");
+  }
+  if (more) ans->add("next", JsonObject::newString(next));
+  aRequest->sendResponse(ans, ErrorPtr());
+  return ErrorPtr();
+}
+
+
+#define EXPORT_OBJECTS_PER_STEP 500 ///< number of objects exported per mainloop cycle
+
+ErrorPtr WifiTrack::exportCmd(ApiRequestPtr aRequest)
+{
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  if (mExportFile) return TextError::err("export to '%s' still running", mExportPath.c_str());
+  string path = Application::sharedApplication()->tempPath(WIFITRACK_EXPORT_FILE_NAME);
+  if (data->get("path", o)) path = o->stringValue();
+  mExportOUINames = false;
+  if (data->get("ouinames", o)) mExportOUINames = o->boolValue();
+  mExportFile = fopen(path.c_str(), "w");
+  if (!mExportFile) return SysError::errNo("cannot create export file: ");
+  mExportPath = path;
+  mExportPhase = 0;
+  mExportIdx = 0;
+  mExportEntries = 0;
+  {
+    // capture the objects to export once, steps then just walk these lists (NDJSON has no required order)
+    WT_DATA_LOCK;
+    mExportSsids = mSsidById;
+    mExportMacs.clear();
+    mExportMacs.reserve(mMacs.size());
+    for (WTMacStore::const_iterator pos = mMacs.begin(); pos!=mMacs.end(); ++pos) mExportMacs.push_back(*pos);
+    mExportPersons.assign(mPersons.begin(), mPersons.end());
+  }
+  OLOG(LOG_NOTICE, ">>> exporting tracking data to '%s'", mExportPath.c_str());
+  mExportTicket.executeOnce(boost::bind(&WifiTrack::exportStep, this, _1));
+  JsonObjectPtr ans = JsonObject::newObj();
+  ans->add("path", JsonObject::newString(mExportPath));
+  aRequest->sendResponse(ans, ErrorPtr());
+  return ErrorPtr();
+}
+
+
+void WifiTrack::exportStep(MLTimer &aTimer)
+{
+  FEATURE_STALL_GUARD;
+  {
+    WT_DATA_LOCK;
+    MLMicroSeconds unixTimeOffset = -MainLoop::now()+MainLoop::unixtime();
+    // up to EXPORT_OBJECTS_PER_STEP objects per step, in the same format as the change log (SSIDs first, macs refer to them, persons to macs)
+    std::vector<JsonObjectPtr> entries;
+    bool phaseDone = false;
+    if (mExportPhase==0) {
+      size_t end = std::min(mExportIdx+EXPORT_OBJECTS_PER_STEP, mExportSsids.size());
+      for (; mExportIdx<end; mExportIdx++) {
+        WTSSidPtr s = mExportSsids[mExportIdx];
+        if (!s || mSsidById[s->id]!=s) continue; // evicted (before or during export)
+        JsonObjectPtr e = JsonObject::newObj();
+        e->add("ssid", JsonObject::newString(s->ssid));
+        e->add("d", ssidJson(s, unixTimeOffset));
+        entries.push_back(e);
       }
+      phaseDone = mExportIdx>=mExportSsids.size();
     }
-    if (data->get("scanBeacons", o, true)) {
-      bool b = o->boolValue();
-      if (b!=mScanBeacons) {
-        mScanBeacons = b;
-        restartScanner();
+    else if (mExportPhase==1) {
+      size_t end = std::min(mExportIdx+EXPORT_OBJECTS_PER_STEP, mExportMacs.size());
+      for (; mExportIdx<end; mExportIdx++) {
+        WTMacPtr m = mExportMacs[mExportIdx];
+        if (mMacs.find(m->mac)!=m) continue; // evicted during export
+        JsonObjectPtr e = JsonObject::newObj();
+        e->add("mac", JsonObject::newString(macAddressToString(m->mac, ':')));
+        e->add("d", macJson(m, unixTimeOffset, mExportOUINames));
+        entries.push_back(e);
       }
+      phaseDone = mExportIdx>=mExportMacs.size();
     }
-    if (data->get("minShowRssi", o, true)) {
-      mMinShowRssi = o->int32Value();
+    else if (mExportPhase==2) {
+      size_t end = std::min(mExportIdx+EXPORT_OBJECTS_PER_STEP, mExportPersons.size());
+      for (; mExportIdx<end; mExportIdx++) {
+        WTPersonPtr p = mExportPersons[mExportIdx];
+        if (p->mergedInto || p->macCount==0) continue; // not a person of its own (any more)
+        JsonObjectPtr e = JsonObject::newObj();
+        e->add("person", personJson(p, unixTimeOffset, false));
+        entries.push_back(e);
+      }
+      phaseDone = mExportIdx>=mExportPersons.size();
     }
-    if (data->get("tooCommonMacCount", o, true)) {
-      mTooCommonMacCount = o->int32Value();
+    else {
+      endExport(ErrorPtr());
+      return;
     }
-    if (data->get("minCommonSsidCount", o, true)) {
-      mMinCommonSsidCount = o->int32Value();
+    for (std::vector<JsonObjectPtr>::iterator pos = entries.begin(); pos!=entries.end(); ++pos) {
+      string line = (*pos)->json_str();
+      line += '\n';
+      if (fwrite(line.c_str(), line.size(), 1, mExportFile)!=1) {
+        endExport(SysError::errNo("writing export file: "));
+        return;
+      }
+      mExportEntries++;
     }
-    if (data->get("numPersonImages", o, true)) {
-      mNumPersonImages = o->int32Value();
+    if (phaseDone) {
+      // this kind of objects is complete
+      mExportPhase++;
+      mExportIdx = 0;
     }
-    if (data->get("maxDisplayDelay", o, true)) {
-      mMaxDisplayDelay = o->doubleValue()*Second;
+  }
+  MainLoop::currentMainLoop().retriggerTimer(aTimer, 0);
+}
+
+
+void WifiTrack::endExport(ErrorPtr aError)
+{
+  mExportTicket.cancel();
+  mExportSsids.clear();
+  mExportMacs.clear();
+  mExportPersons.clear();
+  if (!mExportFile) return;
+  fclose(mExportFile);
+  mExportFile = NULL;
+  if (Error::isOK(aError)) {
+    OLOG(LOG_NOTICE, ">>> exported %ld entries to '%s'", mExportEntries, mExportPath.c_str());
+  }
+  else {
+    OLOG(LOG_ERR, "export to '%s' failed: %s", mExportPath.c_str(), Error::text(aError));
+    unlink(mExportPath.c_str());
+  }
+}
+
+
+ErrorPtr WifiTrack::saveCmd(ApiRequestPtr aRequest)
+{
+  WT_DATA_LOCK;
+  ErrorPtr err;
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  string path = Application::sharedApplication()->dataPath(WIFITRACK_STATE_FILE_NAME);
+  if (data->get("path", o)) path = o->stringValue();
+  err = save(path);
+  return err ? err : Error::ok();
+}
+
+
+ErrorPtr WifiTrack::loadCmd(ApiRequestPtr aRequest)
+{
+  WT_DATA_LOCK;
+  ErrorPtr err;
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  string path = Application::sharedApplication()->dataPath(WIFITRACK_STATE_FILE_NAME);
+  if (data->get("path", o)) path = o->stringValue();
+  err = load(path);
+  mCompactionWanted = true; // loaded data is not in the change log
+  return err ? err : Error::ok();
+}
+
+
+ErrorPtr WifiTrack::testCmd(ApiRequestPtr aRequest)
+{
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  string intro = "hi";
+  string name = "anonymus";
+  string brand = "any";
+  string target = "wifi";
+  if (data->get("intro", o)) intro = o->stringValue();
+  if (data->get("name", o)) name = o->stringValue();
+  if (data->get("brand", o)) brand = o->stringValue();
+  if (data->get("target", o)) target = o->stringValue();
+  int imgIdx = 0;
+  if (data->get("imgidx", o)) imgIdx = o->int32Value() % mNumPersonImages;
+  PixelColor col = white;
+  if (data->get("color", o)) col = webColorToPixel(o->stringValue());
+  displayEncounter(intro, imgIdx, col, name, brand, target);
+  return Error::ok();
+}
+
+
+ErrorPtr WifiTrack::hideCmd(ApiRequestPtr aRequest)
+{
+  WT_DATA_LOCK;
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  bool hide = true;
+  if (data->get("hide", o)) hide = o->boolValue();
+  if (data->get("ssid", o)) {
+    WTSSidPtr s = mSsids.find(o->stringValue());
+    if (s) {
+      s->hidden = hide;
+      markDirty(s);
     }
-    if (data->get("saveTempInterval", o, true)) {
-      mSaveTempInterval = o->doubleValue()*Second;
+  }
+  else if (data->get("mac", o)) {
+    uint64_t mac = stringToMacAddress(o->stringValue().c_str());
+    WTMacPtr m = mMacs.find(mac);
+    if (m) {
+      if (data->get("withperson", o)) {
+        WTPersonPtr p = personOf(m);
+        if (p && o->boolValue()) {
+          p->hidden = hide; // hide associated person
+          markDirty(p);
+        }
+      }
+      m->hidden = hide;
+      markDirty(m);
     }
-    if (data->get("saveDataInterval", o, true)) {
-      mSaveDataInterval = o->doubleValue()*Second;
+  }
+  return Error::ok();
+}
+
+
+ErrorPtr WifiTrack::renameCmd(ApiRequestPtr aRequest)
+{
+  WT_DATA_LOCK;
+  JsonObjectPtr data = aRequest->getRequest();
+  JsonObjectPtr o;
+  if (data->get("mac", o)) {
+    uint64_t mac = stringToMacAddress(o->stringValue().c_str());
+    WTMacPtr m = mMacs.find(mac);
+    WTPersonPtr p;
+    if (m) p = personOf(m);
+    if (p) {
+      if (data->get("name", o)) {
+        p->name = o->stringValue();
+      }
+      if (data->get("color", o)) {
+        p->color = webColorToPixel(o->stringValue());
+      }
+      if (data->get("imgidx", o)) {
+        p->imageIndex = o->int32Value() % mNumPersonImages;
+      }
+      markDirty(p);
     }
-    return err ? err : Error::ok();
   }
+  return Error::ok();
+}
+
+
+ErrorPtr WifiTrack::restartCmd(ApiRequestPtr aRequest)
+{
+  restartScanner();
+  return Error::ok();
+}
+
+
+ErrorPtr WifiTrack::minRssiProp(JsonObjectPtr aValue)
+{
+  int i = aValue->int32Value();
+  if (i!=mMinRssi) {
+    mMinRssi = i;
+    restartScanner();
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr WifiTrack::tooCommonMacCountProp(JsonObjectPtr aValue)
+{
+  int i = aValue->int32Value();
+  if (i!=mTooCommonMacCount) {
+    WT_DATA_LOCK;
+    mTooCommonMacCount = i;
+    rebuildPairIndex(); // set of SSIDs to count has changed
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr WifiTrack::scanBeaconsProp(JsonObjectPtr aValue)
+{
+  bool b = aValue->boolValue();
+  if (b!=mScanBeacons) {
+    mScanBeacons = b;
+    restartScanner();
+  }
+  return ErrorPtr();
 }
 
 
@@ -346,6 +735,7 @@ JsonObjectPtr WifiTrack::status()
     answer->add("aggregatePersons", JsonObject::newBool(mAggregatePersons));
     answer->add("minRssi", JsonObject::newInt32(mMinRssi));
     answer->add("scanBeacons", JsonObject::newBool(mScanBeacons));
+    answer->add("capture", JsonObject::newString(!mPcapFile.empty() ? "pcapfile" : (mNativeCapture ? "native" : "tcpdump")));
     answer->add("minProcessRssi", JsonObject::newInt32(mMinProcessRssi));
     answer->add("minShowRssi", JsonObject::newInt32(mMinShowRssi));
     answer->add("tooCommonMacCount", JsonObject::newInt32(mTooCommonMacCount));
@@ -354,10 +744,33 @@ JsonObjectPtr WifiTrack::status()
     answer->add("maxDisplayDelay", JsonObject::newDouble((double)mMaxDisplayDelay/Second));
     answer->add("saveTempInterval", JsonObject::newDouble((double)mSaveTempInterval/Second));
     answer->add("saveDataInterval", JsonObject::newDouble((double)mSaveDataInterval/Second));
+    answer->add("maxMemory", JsonObject::newInt32(mMaxMemory));
+    answer->add("maxMacAge", JsonObject::newDouble((double)mMaxMacAge/Second));
+    answer->add("evictMinAge", JsonObject::newDouble((double)mEvictMinAge/Second));
+    answer->add("collapseRandomMacs", JsonObject::newBool(mCollapseRandomMacs));
+    answer->add("ephemeralTTL", JsonObject::newDouble((double)mEphemeralTTL/Second));
     // also add some statistics
+    WT_DATA_LOCK;
+    #if IN_THREAD
+    if (mUseThread) {
+      answer->add("queuedsightings", JsonObject::newInt64(mSightingQueue.size()));
+      answer->add("droppedsightings", JsonObject::newInt64(mDroppedSightings));
+    }
+    #endif // IN_THREAD
     answer->add("numpersons", JsonObject::newInt64(mPersons.size()));
     answer->add("nummacs", JsonObject::newInt64(mMacs.size()));
     answer->add("numssids", JsonObject::newInt64(mSsids.size()));
+    answer->add("nummacpairs", JsonObject::newInt64(mPairIndex.size()));
+    answer->add("memoryestimate", JsonObject::newInt64(memoryEstimate()/1024));
+    answer->add("evictedmacs", JsonObject::newInt64(mEvictedMacs));
+    answer->add("evictedssids", JsonObject::newInt64(mEvictedSsids));
+    answer->add("evictedpersons", JsonObject::newInt64(mEvictedPersons));
+    answer->add("ephemeralmacs", JsonObject::newInt64(mEphemeralMacs.size()));
+    answer->add("collapsedmacs", JsonObject::newInt64(mCollapsedMacs));
+    answer->add("ouisready", JsonObject::newBool(mOuisReady));
+    if (mExportFile) answer->add("exportedentries", JsonObject::newInt64(mExportEntries));
+    answer->add("generation", JsonObject::newInt64(mGeneration));
+    answer->add("changelogbytes", JsonObject::newInt64(mChangeLogBytes));
   }
   return answer;
 }
@@ -369,7 +782,10 @@ ErrorPtr WifiTrack::load(const string aPath)
   ErrorPtr err;
   JsonObjectPtr data = JsonObject::objFromFile(Application::sharedApplication()->tempPath(aPath).c_str(), &err);
   if (err) return err; // no data to import
-  return dataImport(data);
+  err = dataImport(data);
+  // links were created without updating the pair index
+  rebuildPairIndex();
+  return err;
 }
 
 
@@ -392,76 +808,27 @@ JsonObjectPtr WifiTrack::dataDump(bool aSsids, bool aMacs, bool aPersons, bool a
   if (aPersons) {
     JsonObjectPtr pans = JsonObject::newArray();
     for (WTPersonSet::iterator ppos = mPersons.begin(); ppos!=mPersons.end(); ++ppos) {
-      JsonObjectPtr p = JsonObject::newObj();
-      p->add("lastrssi", JsonObject::newInt32((*ppos)->lastRssi));
-      p->add("bestrssi", JsonObject::newInt32((*ppos)->bestRssi));
-      p->add("worstrssi", JsonObject::newInt32((*ppos)->worstRssi));
-      if ((*ppos)->hidden) p->add("hidden", JsonObject::newBool(true));
-      p->add("count", JsonObject::newInt64((*ppos)->seenCount));
-      p->add("last", JsonObject::newInt64((*ppos)->seenLast+unixTimeOffset));
-      p->add("first", JsonObject::newInt64((*ppos)->seenFirst+unixTimeOffset));
-      p->add("color", JsonObject::newString(pixelToWebColor((*ppos)->color, true)));
-      p->add("imgidx", JsonObject::newInt64((*ppos)->imageIndex));
-      p->add("name", JsonObject::newString((*ppos)->name));
-      JsonObjectPtr marr = JsonObject::newArray();
-      WTSSidSet pssids;
-      pssids.clear();
-      for (WTMacSet::iterator mpos = (*ppos)->macs.begin(); mpos!=(*ppos)->macs.end(); ++mpos) {
-        marr->arrayAppend(JsonObject::newString(macAddressToString((*mpos)->mac, ':').c_str()));
-        if (aPersonSsids) {
-          for (WTSSidSet::iterator spos = (*mpos)->ssids.begin(); spos!=(*mpos)->ssids.end(); ++spos) {
-            pssids.insert(*spos);
-          }
-        }
-      }
-      p->add("macs", marr);
-      if (aPersonSsids) {
-        JsonObjectPtr sarr = JsonObject::newArray();
-        for (WTSSidSet::iterator spos = pssids.begin(); spos!=pssids.end(); ++spos) {
-          sarr->arrayAppend(JsonObject::newString((*spos)->ssid));
-        }
-        p->add("ssids", sarr);
-      }
-      pans->arrayAppend(p);
+      pans->arrayAppend(personJson(*ppos, unixTimeOffset, aPersonSsids));
     }
     ans->add("persons", pans);
   }
   if (aMacs) {
-    // macs
+    // macs (sorted by MAC, as the store is unordered)
     JsonObjectPtr mans = JsonObject::newObj();
-    for (WTMacMap::iterator mpos = mMacs.begin(); mpos!=mMacs.end(); ++mpos) {
-      JsonObjectPtr m = JsonObject::newObj();
-      if (aOUINames && mpos->second->ouiName) m->add("ouiname", JsonObject::newString(mpos->second->ouiName));
-      m->add("lastrssi", JsonObject::newInt32(mpos->second->lastRssi));
-      m->add("bestrssi", JsonObject::newInt32(mpos->second->bestRssi));
-      m->add("worstrssi", JsonObject::newInt32(mpos->second->worstRssi));
-      if (mpos->second->hidden) m->add("hidden", JsonObject::newBool(true));
-      m->add("count", JsonObject::newInt64(mpos->second->seenCount));
-      m->add("last", JsonObject::newInt64(mpos->second->seenLast+unixTimeOffset));
-      m->add("first", JsonObject::newInt64(mpos->second->seenFirst+unixTimeOffset));
-      JsonObjectPtr sarr = JsonObject::newArray();
-      for (WTSSidSet::iterator spos = mpos->second->ssids.begin(); spos!=mpos->second->ssids.end(); ++spos) {
-        sarr->arrayAppend(JsonObject::newString((*spos)->ssid));
-      }
-      m->add("ssids", sarr);
-      mans->add(macAddressToString(mpos->first, ':').c_str(), m);
+    std::vector<WTMacPtr> macs;
+    mMacs.sortedObjects(macs);
+    for (std::vector<WTMacPtr>::iterator mpos = macs.begin(); mpos!=macs.end(); ++mpos) {
+      mans->add(macAddressToString((*mpos)->mac, ':').c_str(), macJson(*mpos, unixTimeOffset, aOUINames));
     }
     ans->add("macs", mans);
   }
   if (aSsids) {
-    // ssid details
+    // ssid details (sorted by SSID, as the store is unordered)
     JsonObjectPtr sans = JsonObject::newObj();
-    for (WTSSidMap::iterator spos = mSsids.begin(); spos!=mSsids.end(); ++spos) {
-      JsonObjectPtr s = JsonObject::newObj();
-      s->add("count", JsonObject::newInt64(spos->second->seenCount));
-      s->add("last", JsonObject::newInt64(spos->second->seenLast+unixTimeOffset));
-      s->add("maccount", JsonObject::newInt64(spos->second->macs.size()));
-      if (spos->second->hidden) s->add("hidden", JsonObject::newBool(true));
-      if (spos->second->beaconSeenLast!=Never) {
-        s->add("lastbeacon", JsonObject::newInt64(spos->second->beaconSeenLast+unixTimeOffset));
-        s->add("beaconrssi", JsonObject::newInt32(spos->second->beaconRssi));
-      }
-      sans->add(spos->first.c_str(), s);
+    std::vector<WTSSidPtr> ssids;
+    mSsids.sortedObjects(ssids);
+    for (std::vector<WTSSidPtr>::iterator spos = ssids.begin(); spos!=ssids.end(); ++spos) {
+      sans->add((*spos)->ssid.c_str(), ssidJson(*spos, unixTimeOffset));
     }
     ans->add("ssids", sans);
   }
@@ -469,6 +836,119 @@ JsonObjectPtr WifiTrack::dataDump(bool aSsids, bool aMacs, bool aPersons, bool a
 }
 
 
+template<class T, class KeyOps> struct WTObjPtrLess
+{
+  bool operator()(const boost::intrusive_ptr<T> &aA, const boost::intrusive_ptr<T> &aB) const { return KeyOps::less(*aA, *aB); }
+};
+
+struct WTPersonIdLess
+{
+  bool operator()(const WTPersonPtr &aA, const WTPersonPtr &aB) const { return aA->id<aB->id; }
+};
+
+
+void WifiTrack::ssidPage(bool aAfterCursor, const string &aCursor, size_t aCount, std::vector<WTSSidPtr> &aPage)
+{
+  WTPageCollector<WTSSidPtr, WTObjPtrLess<WTSSid, WTSSidKeyOps> > page(aCount);
+  for (WTSSidStore::const_iterator pos = mSsids.begin(); pos!=mSsids.end(); ++pos) {
+    if (aAfterCursor && (*pos)->ssid<=aCursor) continue;
+    page.add(*pos);
+  }
+  page.sorted(aPage);
+}
+
+
+void WifiTrack::macPage(bool aAfterCursor, uint64_t aCursor, size_t aCount, std::vector<WTMacPtr> &aPage)
+{
+  WTPageCollector<WTMacPtr, WTObjPtrLess<WTMac, WTMacKeyOps> > page(aCount);
+  for (WTMacStore::const_iterator pos = mMacs.begin(); pos!=mMacs.end(); ++pos) {
+    if (aAfterCursor && (*pos)->mac<=aCursor) continue;
+    page.add(*pos);
+  }
+  page.sorted(aPage);
+}
+
+
+void WifiTrack::personPage(bool aAfterCursor, uint32_t aCursor, size_t aCount, std::vector<WTPersonPtr> &aPage)
+{
+  WTPageCollector<WTPersonPtr, WTPersonIdLess> page(aCount);
+  for (WTPersonSet::iterator pos = mPersons.begin(); pos!=mPersons.end(); ++pos) {
+    if (aAfterCursor && (*pos)->id<=aCursor) continue;
+    page.add(*pos);
+  }
+  page.sorted(aPage);
+}
+
+
+JsonObjectPtr WifiTrack::ssidJson(WTSSidPtr aSSid, MLMicroSeconds aUnixTimeOffset)
+{
+  JsonObjectPtr s = JsonObject::newObj();
+  s->add("count", JsonObject::newInt64(aSSid->seenCount));
+  s->add("last", JsonObject::newInt64(aSSid->seenLast+aUnixTimeOffset));
+  s->add("maccount", JsonObject::newInt64(aSSid->macs.size()));
+  if (aSSid->hidden) s->add("hidden", JsonObject::newBool(true));
+  if (aSSid->beaconSeenLast!=Never) {
+    s->add("lastbeacon", JsonObject::newInt64(aSSid->beaconSeenLast+aUnixTimeOffset));
+    s->add("beaconrssi", JsonObject::newInt32(aSSid->beaconRssi));
+  }
+  return s;
+}
+
+
+JsonObjectPtr WifiTrack::macJson(WTMacPtr aMac, MLMicroSeconds aUnixTimeOffset, bool aOUIName)
+{
+  JsonObjectPtr m = JsonObject::newObj();
+  if (aOUIName && ouiNameOf(aMac)) m->add("ouiname", JsonObject::newString(aMac->ouiName));
+  m->add("lastrssi", JsonObject::newInt32(aMac->lastRssi));
+  m->add("bestrssi", JsonObject::newInt32(aMac->bestRssi));
+  m->add("worstrssi", JsonObject::newInt32(aMac->worstRssi));
+  if (aMac->hidden) m->add("hidden", JsonObject::newBool(true));
+  if (aMac->proxy) m->add("proxy", JsonObject::newBool(true));
+  m->add("count", JsonObject::newInt64(aMac->seenCount));
+  m->add("last", JsonObject::newInt64(aMac->seenLast+aUnixTimeOffset));
+  m->add("first", JsonObject::newInt64(aMac->seenFirst+aUnixTimeOffset));
+  JsonObjectPtr sarr = JsonObject::newArray();
+  for (WTSSidIdList::iterator spos = aMac->ssids.begin(); spos!=aMac->ssids.end(); ++spos) {
+    sarr->arrayAppend(JsonObject::newString(mSsidById[*spos]->ssid));
+  }
+  m->add("ssids", sarr);
+  return m;
+}
+
+
+JsonObjectPtr WifiTrack::personJson(WTPersonPtr aPerson, MLMicroSeconds aUnixTimeOffset, bool aSsids)
+{
+  JsonObjectPtr p = JsonObject::newObj();
+  p->add("lastrssi", JsonObject::newInt32(aPerson->lastRssi));
+  p->add("bestrssi", JsonObject::newInt32(aPerson->bestRssi));
+  p->add("worstrssi", JsonObject::newInt32(aPerson->worstRssi));
+  if (aPerson->hidden) p->add("hidden", JsonObject::newBool(true));
+  p->add("count", JsonObject::newInt64(aPerson->seenCount));
+  p->add("last", JsonObject::newInt64(aPerson->seenLast+aUnixTimeOffset));
+  p->add("first", JsonObject::newInt64(aPerson->seenFirst+aUnixTimeOffset));
+  p->add("color", JsonObject::newString(pixelToWebColor(aPerson->color, true)));
+  p->add("imgidx", JsonObject::newInt64(aPerson->imageIndex));
+  p->add("name", JsonObject::newString(aPerson->name));
+  JsonObjectPtr marr = JsonObject::newArray();
+  std::set<uint32_t> pssids;
+  for (WTMac *m = aPerson->firstMac; m; m = m->nextInPerson) {
+    marr->arrayAppend(JsonObject::newString(macAddressToString(m->mac, ':').c_str()));
+    if (aSsids) {
+      pssids.insert(m->ssids.begin(), m->ssids.end());
+    }
+  }
+  p->add("macs", marr);
+  if (aSsids) {
+    JsonObjectPtr sarr = JsonObject::newArray();
+    for (std::set<uint32_t>::iterator spos = pssids.begin(); spos!=pssids.end(); ++spos) {
+      sarr->arrayAppend(JsonObject::newString(mSsidById[*spos]->ssid));
+    }
+    p->add("ssids", sarr);
+  }
+  return p;
+}
+
+
 ErrorPtr WifiTrack::dataImport(JsonObjectPtr aData)
 {
   MLMicroSeconds unixTimeOffset = -MainLoop::now()+MainLoop::unixtime();
@@ -480,26 +960,7 @@ ErrorPtr WifiTrack::dataImport(JsonObjectPtr aData)
   JsonObjectPtr sobj;
   string ssidstr;
   while (sobjs->nextKeyValue(ssidstr, sobj)) {
-    if (ssidstr.empty() && !mRememberWithoutSsid) continue; // skip empty SSID
-    WTSSidPtr s;
-    WTSSidMap::iterator spos = mSsids.find(ssidstr);
-    if (spos!=mSsids.end()) {
-      s = spos->second;
-    }
-    else {
-      s = WTSSidPtr(new WTSSid);
-      s->ssid = ssidstr;
-      mSsids[ssidstr] = s;
-    }
-    JsonObjectPtr o;
-    o = sobj->get("hidden");
-    if (o) s->hidden = o->boolValue();
-    o = sobj->get("count");
-    if (o) s->seenCount += o->int64Value();
-    o = sobj->get("last");
-    MLMicroSeconds l = Never;
-    if (o) l = o->int64Value()-unixTimeOffset;
-    if (l>s->seenLast) s->seenLast = l;
+    importSsid(ssidstr, sobj, true, unixTimeOffset);
   }
   // insert macs and links to ssids
   JsonObjectPtr mobjs = aData->get("macs");
@@ -508,138 +969,657 @@ ErrorPtr WifiTrack::dataImport(JsonObjectPtr aData)
   JsonObjectPtr mobj;
   string macstr;
   while (mobjs->nextKeyValue(macstr, mobj)) {
-    bool insertMac = false;
-    uint64_t mac = stringToMacAddress(macstr.c_str());
-    WTMacPtr m;
-    WTMacMap::iterator mpos = mMacs.find(mac);
-    if (mpos!=mMacs.end()) {
-      m = mpos->second;
-    }
-    else {
-      m = WTMacPtr(new WTMac);
-      m->mac = mac;
-      m->ouiName = ouiName(mac);
-      insertMac = true;
-    }
-    // links
-    JsonObjectPtr sarr = mobj->get("ssids");
-    for (int i=0; i<sarr->arrayLength(); ++i) {
-      string ssidstr = sarr->arrayGet(i)->stringValue();
-      if (!mRememberWithoutSsid && ssidstr.empty()) {
-        // empty SSID and we don't want empty ones!
-        if (sarr->arrayLength()==1) {
-          // also prevent inserting mac if the empty SSID is the only one
-          insertMac = false;
-        }
-        continue; // check next
-      }
-      WTSSidPtr s;
-      WTSSidMap::iterator spos = mSsids.find(ssidstr);
-      if (spos!=mSsids.end()) {
-        s = spos->second;
-      }
-      else {
-        s = WTSSidPtr(new WTSSid);
-        s->ssid = ssidstr;
-        mSsids[ssidstr] = s;
-      }
-      m->ssids.insert(s);
-      s->macs.insert(m);
-    }
-    if (insertMac) {
-      mMacs[mac] = m;
-    }
-    // other props
-    JsonObjectPtr o;
-    o = mobj->get("hidden");
-    if (o) m->hidden = o->boolValue();
-    o = mobj->get("count");
-    if (o) m->seenCount += o->int64Value();
-    o = mobj->get("bestrssi");
-    int r = -9999;
-    if (o) r = o->int32Value();
-    if (r>m->bestRssi) m->bestRssi = r;
-    o = mobj->get("worstrssi");
-    r = 9999;
-    if (o) r = o->int32Value();
-    if (r<m->worstRssi) m->worstRssi = r;
-    o = mobj->get("last");
-    MLMicroSeconds l = Never;
-    if (o) l = o->int64Value()-unixTimeOffset;
-    if (l>m->seenLast) {
-      m->seenLast = l;
-      o = mobj->get("lastrssi");
-      if (o) m->lastRssi = o->int32Value();
-    }
-    o = mobj->get("first");
-    l = Never;
-    if (o) l = o->int64Value()-unixTimeOffset;
-    if (l!=Never && m->seenFirst!=Never && l<m->seenFirst) m->seenFirst = l;
+    importMac(macstr, mobj, true, unixTimeOffset);
   }
   JsonObjectPtr pobjs = aData->get("persons");
   if (pobjs) {
     for (int pidx=0; pidx<pobjs->arrayLength(); pidx++) {
-      JsonObjectPtr pobj = pobjs->arrayGet(pidx);
-      WTPersonPtr p = WTPersonPtr(new WTPerson);
-      // links to macs
-      JsonObjectPtr marr = pobj->get("macs");
-      for (int i=0; i<marr->arrayLength(); ++i) {
-        string macstr = marr->arrayGet(i)->stringValue();
-        uint64_t mac = stringToMacAddress(macstr.c_str());
-        WTMacMap::iterator mpos = mMacs.find(mac);
-        if (mpos!=mMacs.end()) {
-          p->macs.insert(mpos->second);
-          mpos->second->person = p;
-        }
-      }
-      if (p->macs.size()==0) continue; // not linked to any mac -> invalid, skip
-      mPersons.insert(p);
-      // other props
-      JsonObjectPtr o;
-      o = pobj->get("name");
-      if (o) p->name = o->stringValue();
-      o = pobj->get("color");
-      if (o) p->color = webColorToPixel(o->stringValue());
-      o = pobj->get("imgidx");
-      if (o) p->imageIndex = o->int32Value();
-      o = pobj->get("hidden");
-      if (o) p->hidden = o->boolValue();
-      o = pobj->get("count");
-      if (o) p->seenCount += o->int64Value();
-      o = pobj->get("bestrssi");
-      int r = -9999;
-      if (o) r = o->int32Value();
-      if (r>p->bestRssi) p->bestRssi = r;
-      o = pobj->get("worstrssi");
-      r = 9999;
-      if (o) r = o->int32Value();
-      if (r<p->worstRssi) p->worstRssi = r;
-      o = pobj->get("last");
-      MLMicroSeconds l = Never;
-      if (o) l = o->int64Value()-unixTimeOffset;
-      if (l>p->seenLast) {
-        p->seenLast = l;
-        o = pobj->get("lastrssi");
-        if (o) p->lastRssi = o->int32Value();
-      }
-      o = pobj->get("first");
-      l = Never;
-      if (o) l = o->int64Value()-unixTimeOffset;
-      if (l!=Never && p->seenFirst!=Never && l<p->seenFirst) p->seenFirst = l;
+      importPerson(pobjs->arrayGet(pidx), true, unixTimeOffset);
     }
   }
   return ErrorPtr();
 }
 
-// MARK: ==== OUI lookup
+
+void WifiTrack::importSsid(const string aSsid, JsonObjectPtr aSsidObj, bool aAccumulate, MLMicroSeconds aUnixTimeOffset)
+{
+  if (aSsid.empty() && !mRememberWithoutSsid) return; // skip empty SSID
+  WTSSidPtr s = internSsid(aSsid);
+  JsonObjectPtr o;
+  if (aSsidObj->get("hidden", o)) s->hidden = o->boolValue();
+  if (aSsidObj->get("count", o)) {
+    if (aAccumulate) s->seenCount += o->int64Value();
+    else s->seenCount = o->int64Value();
+  }
+  if (aSsidObj->get("last", o)) {
+    MLMicroSeconds l = o->int64Value()-aUnixTimeOffset;
+    if (!aAccumulate || l>s->seenLast) s->seenLast = l;
+  }
+  if (aSsidObj->get("lastbeacon", o)) {
+    MLMicroSeconds l = o->int64Value()-aUnixTimeOffset;
+    if (!aAccumulate || s->beaconSeenLast==Never || l>s->beaconSeenLast) {
+      s->beaconSeenLast = l;
+      if (aSsidObj->get("beaconrssi", o)) s->beaconRssi = o->int32Value();
+    }
+  }
+}
 
 
-const char* WifiTrack::ouiName(uint64_t aMac)
+void WifiTrack::importMac(const string aMac, JsonObjectPtr aMacObj, bool aAccumulate, MLMicroSeconds aUnixTimeOffset)
 {
-  // default to a /24 search
-  const char *n = NULL;
-  OUIMap::iterator opos = mOuis.find((uint32_t)(aMac>>24));
-  if (opos!=mOuis.end()) {
+  bool insertMac = false;
+  uint64_t mac = stringToMacAddress(aMac.c_str());
+  WTMacPtr m = mMacs.find(mac);
+  if (!m) {
+    m = newMac(mac);
+    insertMac = true;
+  }
+  // links
+  JsonObjectPtr sarr = aMacObj->get("ssids");
+  for (int i=0; sarr && i<sarr->arrayLength(); ++i) {
+    string ssidstr = sarr->arrayGet(i)->stringValue();
+    if (!mRememberWithoutSsid && ssidstr.empty()) {
+      // empty SSID and we don't want empty ones!
+      if (sarr->arrayLength()==1) {
+        // also prevent inserting mac if the empty SSID is the only one
+        insertMac = false;
+      }
+      continue; // check next
+    }
+    WTSSidPtr s = internSsid(ssidstr);
+    m->addSsid(s->id);
+    s->addMac(m);
+  }
+  if (insertMac) {
+    mMacs.insert(m);
+  }
+  // other props
+  JsonObjectPtr o;
+  if (aMacObj->get("hidden", o)) m->hidden = o->boolValue();
+  if (aMacObj->get("proxy", o)) m->proxy = o->boolValue();
+  if (aMacObj->get("count", o)) {
+    if (aAccumulate) m->seenCount += o->int64Value();
+    else m->seenCount = o->int64Value();
+  }
+  if (aMacObj->get("bestrssi", o)) {
+    int r = o->int32Value();
+    if (!aAccumulate || r>m->bestRssi) m->bestRssi = r;
+  }
+  if (aMacObj->get("worstrssi", o)) {
+    int r = o->int32Value();
+    if (!aAccumulate || r<m->worstRssi) m->worstRssi = r;
+  }
+  if (aMacObj->get("last", o)) {
+    MLMicroSeconds l = o->int64Value()-aUnixTimeOffset;
+    if (!aAccumulate || l>m->seenLast) {
+      m->seenLast = l;
+      if (aMacObj->get("lastrssi", o)) m->lastRssi = o->int32Value();
+    }
+  }
+  if (aMacObj->get("first", o)) {
+    MLMicroSeconds l = o->int64Value()-aUnixTimeOffset;
+    if (!aAccumulate || m->seenFirst==Never || l<m->seenFirst) m->seenFirst = l;
+  }
+}
+
+
+void WifiTrack::importPerson(JsonObjectPtr aPersonObj, bool aAccumulate, MLMicroSeconds aUnixTimeOffset)
+{
+  // links to macs
+  JsonObjectPtr marr = aPersonObj->get("macs");
+  if (!marr) return;
+  std::vector<WTMacPtr> freeMacs; // macs not yet linked to a person
+  WTPersonSet existingPersons; // persons already linked to some of the macs
+  for (int i=0; i<marr->arrayLength(); ++i) {
+    string macstr = marr->arrayGet(i)->stringValue();
+    uint64_t mac = stringToMacAddress(macstr.c_str());
+    WTMacPtr m = mMacs.find(mac);
+    if (m) {
+      WTPersonPtr ep = personOf(m);
+      if (ep) existingPersons.insert(ep);
+      else freeMacs.push_back(m);
+    }
+  }
+  if (freeMacs.empty() && existingPersons.empty()) return; // not linked to any mac -> invalid, skip
+  WTPersonPtr p;
+  if (!aAccumulate && !existingPersons.empty()) {
+    // logged state of a person we already have: update it (combining all persons known to be the same by now)
+    WTPersonSet::iterator epos = existingPersons.begin();
+    p = *epos;
+    for (++epos; epos!=existingPersons.end(); ++epos) p = mergePersons(p, *epos);
+  }
+  else {
+    p = newPerson();
+    mPersons.insert(p);
+  }
+  for (std::vector<WTMacPtr>::iterator mpos = freeMacs.begin(); mpos!=freeMacs.end(); ++mpos) {
+    addMacToPerson(*mpos, p);
+  }
+  // other props
+  JsonObjectPtr o;
+  if (aPersonObj->get("name", o)) p->name = o->stringValue();
+  if (aPersonObj->get("color", o)) p->color = webColorToPixel(o->stringValue());
+  if (aPersonObj->get("imgidx", o)) p->imageIndex = o->int32Value();
+  if (aPersonObj->get("hidden", o)) p->hidden = o->boolValue();
+  if (aPersonObj->get("count", o)) p->seenCount = o->int64Value();
+  if (aPersonObj->get("bestrssi", o)) p->bestRssi = o->int32Value();
+  if (aPersonObj->get("worstrssi", o)) p->worstRssi = o->int32Value();
+  if (aPersonObj->get("last", o)) {
+    p->seenLast = o->int64Value()-aUnixTimeOffset;
+    if (aPersonObj->get("lastrssi", o)) p->lastRssi = o->int32Value();
+  }
+  if (aPersonObj->get("first", o)) p->seenFirst = o->int64Value()-aUnixTimeOffset;
+  if (aAccumulate) {
+    // merge with already existing persons sharing macs
+    for (WTPersonSet::iterator epos = existingPersons.begin(); epos!=existingPersons.end(); ++epos) {
+      p = mergePersons(p, *epos);
+    }
+  }
+}
+
+
+// MARK: ==== incremental persistence
+
+string WifiTrack::changeLogPath(uint32_t aGeneration)
+{
+  return Application::sharedApplication()->tempPath(string_format("%s.%u", WIFITRACK_CHANGELOG_FILE_NAME, aGeneration));
+}
+
+
+void WifiTrack::markDirty(WTSSidPtr aSSid)
+{
+  if (!aSSid->dirty) {
+    aSSid->dirty = true;
+    mDirtySsids.push_back(aSSid);
+  }
+}
+
+
+void WifiTrack::markDirty(WTMacPtr aMac)
+{
+  if (!aMac->dirty) {
+    aMac->dirty = true;
+    mDirtyMacs.push_back(aMac);
+  }
+}
+
+
+void WifiTrack::markDirty(WTPersonPtr aPerson)
+{
+  if (!aPerson->dirty) {
+    aPerson->dirty = true;
+    mDirtyPersons.push_back(aPerson);
+  }
+}
+
+
+ErrorPtr WifiTrack::loadState()
+{
+  ErrorPtr err;
+  mGeneration = 0;
+  err = loadSnapshot(Application::sharedApplication()->tempPath(WIFITRACK_SNAPSHOT_FILE_NAME));
+  if (Error::isOK(err)) {
+    OLOG(LOG_NOTICE, ">>> loaded snapshot from temp file, generation %u", mGeneration);
+  }
+  else {
+    // no snapshot (yet), base on persistent data, and make sure we get a snapshot soon
+    mCompactionWanted = true;
+    err = loadSnapshot(Application::sharedApplication()->dataPath(WIFITRACK_SNAPSHOT_FILE_NAME));
+    if (Error::isOK(err)) {
+      OLOG(LOG_NOTICE, ">>> loaded snapshot from persistent data file");
+      mGeneration = 0;
+    }
+    else {
+      // JSON state from versions before binary snapshots: the (frequently autosaved) temp file is more recent
+      mGeneration = 0;
+      string path = Application::sharedApplication()->tempPath(WIFITRACK_STATE_FILE_NAME);
+      JsonObjectPtr data = JsonObject::objFromFile(path.c_str(), &err);
+      if (Error::isOK(err)) {
+        JsonObjectPtr o;
+        if (data->get("generation", o)) mGeneration = (uint32_t)o->int64Value();
+        err = dataImport(data);
+        if (Error::isOK(err)) {
+          OLOG(LOG_NOTICE, ">>> loaded data from temp JSON file, generation %u", mGeneration);
+        }
+      }
+      if (Error::notOK(err)) {
+        // JSON state exported with the save command, or persistent data from versions before binary snapshots
+        mGeneration = 0;
+        err = load(Application::sharedApplication()->dataPath(WIFITRACK_STATE_FILE_NAME));
+        if (Error::isOK(err)) {
+          OLOG(LOG_NOTICE, ">>> loaded data from persistent JSON file");
+        }
+      }
+    }
+  }
+  // apply the changes logged since the snapshot was started
+  // Note: when a compaction did not complete, there is also the log of the next generation
+  long entries = 0;
+  uint32_t g = mGeneration;
+  while (Error::isOK(replayChangeLog(changeLogPath(g), entries))) {
+    mGeneration = g++;
+  }
+  if (entries>0) {
+    OLOG(LOG_NOTICE, ">>> applied %ld changes from change log(s)", entries);
+    if (Error::notOK(err)) err.reset(); // we have some state
+    mCompactionWanted = true;
+  }
+  // links were created without updating the pair index
+  rebuildPairIndex();
+  // continue logging changes
+  openChangeLog();
+  return err;
+}
+
+
+ErrorPtr WifiTrack::loadSnapshot(const string aPath)
+{
+  WTSnapshotFile snap;
+  ErrorPtr err = snap.open(aPath);
+  if (Error::notOK(err)) return err;
+  const WTSnapshotHeader &h = snap.header();
+  MLMicroSeconds unixTimeOffset = -MainLoop::now()+MainLoop::unixtime();
+  mGeneration = h.generation;
+  mSsids.reserve(mSsids.size()+h.numSsids);
+  mSsidById.reserve(mSsidById.size()+h.numSsids);
+  mMacs.reserve(mMacs.size()+h.numMacs);
+  // SSIDs
+  std::vector<WTSSidPtr> ssids; // by snapshot record index
+  ssids.reserve(h.numSsids);
+  for (uint32_t i=0; i<h.numSsids; i++) {
+    const WTSnapshotSsid &r = snap.ssid(i);
+    if (r.flags & WT_SNAPSHOT_UNUSED) {
+      ssids.push_back(WTSSidPtr());
+      continue;
+    }
+    WTSSidPtr s = internSsid(WTSSidKey(snap.str(r.nameOffset), r.nameLen));
+    s->seenLast = wtMainloopTime(r.seenLast, unixTimeOffset);
+    s->seenCount = r.seenCount;
+    s->beaconSeenLast = wtMainloopTime(r.beaconSeenLast, unixTimeOffset);
+    s->beaconRssi = r.beaconRssi;
+    s->hidden = (r.flags & WT_SNAPSHOT_HIDDEN)!=0;
+    ssids.push_back(s);
+  }
+  // MACs and their links to SSIDs
+  std::vector<WTMacPtr> macs; // by snapshot record index
+  macs.reserve(h.numMacs);
+  for (uint32_t i=0; i<h.numMacs; i++) {
+    const WTSnapshotMac &r = snap.mac(i);
+    WTMacPtr m = mMacs.find(r.mac);
+    if (!m) {
+      m = newMac(r.mac);
+      mMacs.insert(m);
+    }
+    m->seenLast = wtMainloopTime(r.seenLast, unixTimeOffset);
+    m->seenFirst = wtMainloopTime(r.seenFirst, unixTimeOffset);
+    m->seenCount = r.seenCount;
+    m->lastRssi = r.lastRssi;
+    m->bestRssi = r.bestRssi;
+    m->worstRssi = r.worstRssi;
+    m->hidden = (r.flags & WT_SNAPSHOT_HIDDEN)!=0;
+    m->proxy = (r.flags & WT_SNAPSHOT_PROXY)!=0;
+    m->ssids.reserve(m->ssids.size()+r.numSsids);
+    for (uint32_t j=0; j<r.numSsids; j++) {
+      WTSSidPtr s = ssids[snap.macSsid(r.firstSsid+j)];
+      if (s && m->addSsid(s->id)) s->addMac(m);
+    }
+    macs.push_back(m);
+  }
+  // persons
+  for (uint32_t i=0; i<h.numPersons; i++) {
+    const WTSnapshotPerson &r = snap.person(i);
+    if (r.numMacs==0) continue; // was merged into another person while snapshot was written
+    WTPersonPtr p = newPerson();
+    p->seenLast = wtMainloopTime(r.seenLast, unixTimeOffset);
+    p->seenFirst = wtMainloopTime(r.seenFirst, unixTimeOffset);
+    p->seenCount = r.seenCount;
+    p->lastRssi = r.lastRssi;
+    p->bestRssi = r.bestRssi;
+    p->worstRssi = r.worstRssi;
+    p->imageIndex = r.imageIndex;
+    p->color.r = r.color[0];
+    p->color.g = r.color[1];
+    p->color.b = r.color[2];
+    p->color.a = r.color[3];
+    p->name.assign(snap.str(r.nameOffset), r.nameLen);
+    p->hidden = (r.flags & WT_SNAPSHOT_HIDDEN)!=0;
+    mPersons.insert(p);
+    WTPersonSet existingPersons;
+    for (uint32_t j=0; j<r.numMacs; j++) {
+      WTMacPtr m = macs[snap.personMac(r.firstMac+j)];
+      WTPersonPtr ep = personOf(m);
+      if (ep) existingPersons.insert(ep);
+      else addMacToPerson(m, p);
+    }
+    for (WTPersonSet::iterator epos = existingPersons.begin(); epos!=existingPersons.end(); ++epos) {
+      p = mergePersons(p, *epos);
+    }
+  }
+  return ErrorPtr();
+}
+
+
+ErrorPtr WifiTrack::replayChangeLog(const string aPath, long &aEntries)
+{
+  FILE *f = fopen(aPath.c_str(), "r");
+  if (!f) return SysError::errNo();
+  MLMicroSeconds unixTimeOffset = -MainLoop::now()+MainLoop::unixtime();
+  string line;
+  while (string_fgetline(f, line)) {
+    ErrorPtr err;
+    JsonObjectPtr e = JsonObject::objFromText(line.c_str(), line.size(), &err);
+    if (!e || Error::notOK(err)) {
+      // possibly the last line, incompletely written at a crash
+      OLOG(LOG_WARNING, "invalid change log entry skipped: %s", Error::text(err));
+      continue;
+    }
+    JsonObjectPtr o, d;
+    if (e->get("ssid", o) && e->get("d", d)) importSsid(o->stringValue(), d, false, unixTimeOffset);
+    else if (e->get("mac", o) && e->get("d", d)) importMac(o->stringValue(), d, false, unixTimeOffset);
+    else if (e->get("person", o)) importPerson(o, false, unixTimeOffset);
+    else if (e->get("delmac", o)) {
+      WTMacPtr m = mMacs.find(stringToMacAddress(o->stringValue().c_str()));
+      if (m) evictMac(m, NULL);
+    }
+    else if (e->get("delssid", o)) {
+      WTSSidPtr s = mSsids.find(o->stringValue());
+      if (s && s->macs.empty()) evictSsid(s);
+    }
+    else continue;
+    aEntries++;
+  }
+  fclose(f);
+  return ErrorPtr();
+}
+
+
+void WifiTrack::openChangeLog()
+{
+  closeChangeLog();
+  string path = changeLogPath(mGeneration);
+  mChangeLog = fopen(path.c_str(), "a");
+  if (!mChangeLog) {
+    OLOG(LOG_ERR, "cannot open change log '%s': %s", path.c_str(), Error::text(SysError::errNo()));
+    return;
+  }
+  mChangeLogBytes = ftell(mChangeLog);
+}
+
+
+void WifiTrack::closeChangeLog()
+{
+  if (mChangeLog) {
+    fclose(mChangeLog);
+    mChangeLog = NULL;
+  }
+}
+
+
+void WifiTrack::appendChange(JsonObjectPtr aEntry)
+{
+  string line = aEntry->json_str();
+  line += '\n';
+  if (fwrite(line.c_str(), line.size(), 1, mChangeLog)==1) mChangeLogBytes += line.size();
+}
+
+
+void WifiTrack::flushChanges()
+{
+  if (!mChangeLog) openChangeLog();
+  MLMicroSeconds unixTimeOffset = -MainLoop::now()+MainLoop::unixtime();
+  long changes = 0;
+  // SSIDs first, macs refer to them, persons to macs
+  for (std::vector<WTSSidPtr>::iterator pos = mDirtySsids.begin(); pos!=mDirtySsids.end(); ++pos) {
+    (*pos)->dirty = false;
+    if (!mChangeLog || mSsidById[(*pos)->id]!=*pos) continue; // evicted in the meantime
+    JsonObjectPtr e = JsonObject::newObj();
+    e->add("ssid", JsonObject::newString((*pos)->ssid));
+    e->add("d", ssidJson(*pos, unixTimeOffset));
+    appendChange(e);
+    changes++;
+  }
+  mDirtySsids.clear();
+  for (std::vector<WTMacPtr>::iterator pos = mDirtyMacs.begin(); pos!=mDirtyMacs.end(); ++pos) {
+    (*pos)->dirty = false;
+    if (!mChangeLog || mMacs.find((*pos)->mac)!=*pos) continue; // evicted in the meantime
+    JsonObjectPtr e = JsonObject::newObj();
+    e->add("mac", JsonObject::newString(macAddressToString((*pos)->mac, ':')));
+    e->add("d", macJson(*pos, unixTimeOffset, false));
+    appendChange(e);
+    changes++;
+  }
+  mDirtyMacs.clear();
+  for (std::vector<WTPersonPtr>::iterator pos = mDirtyPersons.begin(); pos!=mDirtyPersons.end(); ++pos) {
+    (*pos)->dirty = false;
+    if (!mChangeLog || (*pos)->mergedInto || (*pos)->macCount==0) continue; // merged persons are part of their (also dirty) root person, persons without MACs are evicted
+    JsonObjectPtr e = JsonObject::newObj();
+    e->add("person", personJson(*pos, unixTimeOffset, false));
+    appendChange(e);
+    changes++;
+  }
+  mDirtyPersons.clear();
+  if (mChangeLog) {
+    fflush(mChangeLog);
+    OLOG(LOG_INFO, ">>> appended %ld changes to change log, now %ld bytes", changes, mChangeLogBytes);
+  }
+}
+
+
+void WifiTrack::autoSaveTimer(MLTimer &aTimer)
+{
+  FEATURE_STALL_GUARD;
+  {
+    WT_DATA_LOCK;
+    checkAutoSave();
+  }
+  MainLoop::currentMainLoop().retriggerTimer(aTimer, AUTOSAVE_CHECK_INTERVAL);
+}
+
+
+void WifiTrack::checkAutoSave()
+{
+  MLMicroSeconds now = MainLoop::now();
+  if (mSaveTempInterval!=Never && now>mLastTempAutoSave+mSaveTempInterval) {
+    mLastTempAutoSave = now;
+    flushChanges();
+    if (mChangeLogBytes>MIN_COMPACTION_LOG_SIZE && mChangeLogBytes>mSnapshotBytes/2) {
+      mCompactionWanted = true;
+    }
+  }
+  if (mSnapshotWriter.isOpen()) return; // snapshot still being written
+  if (mCompactionWanted && mSaveTempInterval!=Never) {
+    mCompactionWanted = false;
+    OLOG(LOG_NOTICE, ">>> compacting change log into new snapshot")
+    startSnapshot(Application::sharedApplication()->tempPath(WIFITRACK_SNAPSHOT_FILE_NAME), true);
+  }
+  else if (mSaveDataInterval!=Never && now>mLastDataAutoSave+mSaveDataInterval) {
+    mLastDataAutoSave = now;
+    OLOG(LOG_NOTICE, ">>> auto-saving data to (persistent) data file")
+    startSnapshot(Application::sharedApplication()->dataPath(WIFITRACK_SNAPSHOT_FILE_NAME), false);
+    saveHotOUIs();
+  }
+}
+
+
+void WifiTrack::startSnapshot(const string aPath, bool aCompaction)
+{
+  if (aCompaction) {
+    // changes from now on go into the log of the next generation
+    flushChanges();
+    mGeneration++;
+    openChangeLog();
+  }
+  mSnapshotCompaction = aCompaction;
+  // objects to write (objects changing or appearing while writing go to the change log)
+  mSnapshotSsids = mSsidById; // snapshot record index = SSID id
+  mSnapshotMacs.clear();
+  mSnapshotMacs.reserve(mMacs.size());
+  mSnapshotMacIdx.assign(mNextMacId, WT_NOT_IN_SNAPSHOT);
+  for (WTMacStore::const_iterator pos = mMacs.begin(); pos!=mMacs.end(); ++pos) {
+    mSnapshotMacIdx[(*pos)->id] = (uint32_t)mSnapshotMacs.size();
+    mSnapshotMacs.push_back(*pos);
+  }
+  mSnapshotPersons.assign(mPersons.begin(), mPersons.end());
+  ErrorPtr err = mSnapshotWriter.open(aPath, aCompaction ? mGeneration : 0, (uint32_t)mSnapshotSsids.size(), (uint32_t)mSnapshotMacs.size(), (uint32_t)mSnapshotPersons.size());
+  if (Error::notOK(err)) {
+    OLOG(LOG_ERR, "cannot create snapshot '%s': %s", aPath.c_str(), Error::text(err));
+    releaseSnapshotObjects();
+    return;
+  }
+  mSnapshotPhase = 0;
+  mSnapshotIdx = 0;
+  mSnapshotTicket.executeOnce(boost::bind(&WifiTrack::snapshotStep, this, _1));
+}
+
+
+#define SNAPSHOT_OBJECTS_PER_STEP 500 ///< objects written to the snapshot per mainloop cycle
+
+void WifiTrack::snapshotStep(MLTimer &aTimer)
+{
+  WT_DATA_LOCK;
+  FEATURE_STALL_GUARD;
+  if (!mSnapshotWriter.isOpen()) return;
+  MLMicroSeconds unixTimeOffset = -MainLoop::now()+MainLoop::unixtime();
+  std::vector<uint32_t> links;
+  for (int n=0; n<SNAPSHOT_OBJECTS_PER_STEP; n++) {
+    if (mSnapshotPhase==0) {
+      if (mSnapshotIdx>=mSnapshotSsids.size()) {
+        mSnapshotPhase++;
+        mSnapshotIdx = 0;
+        continue;
+      }
+      WTSSidPtr s = mSnapshotSsids[mSnapshotIdx++];
+      WTSnapshotSsid r;
+      memset(&r, 0, sizeof(r));
+      if (!s) {
+        // evicted, keep slot to keep record index = SSID id
+        r.flags = WT_SNAPSHOT_UNUSED;
+        mSnapshotWriter.writeSsid(r, "");
+        continue;
+      }
+      r.seenLast = wtSnapshotTime(s->seenLast, unixTimeOffset);
+      r.seenCount = s->seenCount;
+      r.beaconSeenLast = wtSnapshotTime(s->beaconSeenLast, unixTimeOffset);
+      r.beaconRssi = s->beaconRssi;
+      if (s->hidden) r.flags |= WT_SNAPSHOT_HIDDEN;
+      mSnapshotWriter.writeSsid(r, s->ssid);
+    }
+    else if (mSnapshotPhase==1) {
+      if (mSnapshotIdx>=mSnapshotMacs.size()) {
+        mSnapshotPhase++;
+        mSnapshotIdx = 0;
+        continue;
+      }
+      WTMacPtr m = mSnapshotMacs[mSnapshotIdx++];
+      WTSnapshotMac r;
+      memset(&r, 0, sizeof(r));
+      r.mac = m->mac;
+      r.seenLast = wtSnapshotTime(m->seenLast, unixTimeOffset);
+      r.seenFirst = wtSnapshotTime(m->seenFirst, unixTimeOffset);
+      r.seenCount = m->seenCount;
+      r.lastRssi = m->lastRssi;
+      r.bestRssi = m->bestRssi;
+      r.worstRssi = m->worstRssi;
+      if (m->hidden) r.flags |= WT_SNAPSHOT_HIDDEN;
+      if (m->proxy) r.flags |= WT_SNAPSHOT_PROXY;
+      links.clear();
+      for (WTSSidIdList::iterator pos = m->ssids.begin(); pos!=m->ssids.end(); ++pos) {
+        if (*pos<mSnapshotSsids.size()) links.push_back(*pos); // SSIDs that appeared later are in the change log
+      }
+      mSnapshotWriter.writeMac(r, links);
+    }
+    else {
+      if (mSnapshotIdx>=mSnapshotPersons.size()) {
+        finishSnapshot();
+        return;
+      }
+      WTPersonPtr p = mSnapshotPersons[mSnapshotIdx++];
+      WTSnapshotPerson r;
+      memset(&r, 0, sizeof(r));
+      r.seenLast = wtSnapshotTime(p->seenLast, unixTimeOffset);
+      r.seenFirst = wtSnapshotTime(p->seenFirst, unixTimeOffset);
+      r.seenCount = p->seenCount;
+      r.lastRssi = p->lastRssi;
+      r.bestRssi = p->bestRssi;
+      r.worstRssi = p->worstRssi;
+      r.imageIndex = p->imageIndex;
+      r.color[0] = p->color.r;
+      r.color[1] = p->color.g;
+      r.color[2] = p->color.b;
+      r.color[3] = p->color.a;
+      if (p->hidden) r.flags |= WT_SNAPSHOT_HIDDEN;
+      links.clear();
+      // Note: persons merged in the meantime have no MACs any more, their root person is in the change log
+      for (WTMac *m = p->firstMac; m; m = m->nextInPerson) {
+        if (m->id<mSnapshotMacIdx.size() && mSnapshotMacIdx[m->id]!=WT_NOT_IN_SNAPSHOT) links.push_back(mSnapshotMacIdx[m->id]);
+      }
+      mSnapshotWriter.writePerson(r, p->name, links);
+    }
+  }
+  MainLoop::currentMainLoop().retriggerTimer(aTimer, 0);
+}
+
+
+void WifiTrack::finishSnapshot()
+{
+  releaseSnapshotObjects();
+  ErrorPtr err = mSnapshotWriter.finish();
+  if (Error::notOK(err)) {
+    OLOG(LOG_ERR, "writing snapshot '%s' failed: %s", mSnapshotWriter.path().c_str(), Error::text(err));
+    return;
+  }
+  if (mSnapshotCompaction) {
+    // logs of previous generations are no longer needed
+    mSnapshotBytes = mSnapshotWriter.bytes();
+    uint32_t g = mGeneration;
+    while (g>0 && unlink(changeLogPath(--g).c_str())==0) {};
+  }
+  OLOG(LOG_NOTICE, ">>> snapshot '%s' written, %ld bytes", mSnapshotWriter.path().c_str(), mSnapshotWriter.bytes());
+}
+
+
+void WifiTrack::releaseSnapshotObjects()
+{
+  mSnapshotSsids.clear();
+  mSnapshotMacs.clear();
+  mSnapshotMacIdx.clear();
+  mSnapshotPersons.clear();
+}
+
+
+void WifiTrack::stopPersistence()
+{
+  mAutoSaveTicket.cancel();
+  mSnapshotTicket.cancel();
+  if (mSnapshotWriter.isOpen()) {
+    mSnapshotWriter.abort();
+    releaseSnapshotObjects();
+    if (mSnapshotCompaction) mCompactionWanted = true;
+  }
+  if (mChangeLog) {
+    flushChanges();
+    closeChangeLog();
+  }
+  saveHotOUIs();
+  endExport(TextError::err("aborted"));
+}
+
+
+// MARK: ==== OUI lookup
+
+
+const char* WifiTrack::ouiName(uint64_t aMac)
+{
+  if (mOuiTable.isOpen()) return mOuiTable.lookup(aMac);
+  if (!mOuisReady) {
+    // full table not yet loaded, only vendors seen before can be resolved
+    OUIHotMap::iterator hpos = mHotOuis.find((uint32_t)(aMac>>24));
+    return hpos!=mHotOuis.end() ? hpos->second.c_str() : NULL;
+  }
+  // oui.txt based map, default to a /24 search
+  const char *n = NULL;
+  OUIMap::iterator opos = mOuis.find((uint32_t)(aMac>>24));
+  if (opos!=mOuis.end()) {
     n = opos->second;
     if ((intptr_t)n<256) {
       // not a pointer, but subtable identifier byte
@@ -657,6 +1637,17 @@ const char* WifiTrack::ouiName(uint64_t aMac)
 }
 
 
+const char* WifiTrack::ouiNameOf(WTMacPtr aMac)
+{
+  if (!aMac->ouiResolved && mOuisReady) {
+    // MAC was created before the full table was ready
+    aMac->ouiName = ouiName(aMac->mac);
+    aMac->ouiResolved = true;
+  }
+  return aMac->ouiName;
+}
+
+
 #define CREATE_OUI_TABLE 0
 
 #ifdef __APPLE__
@@ -729,15 +1720,61 @@ static void createOUItable()
 
 
 
-void WifiTrack::loadOUIs()
+#define OUI_LINES_PER_STEP 1000 ///< number of oui.txt lines parsed per mainloop cycle when loading in background
+#define MAX_HOT_OUIS 256 ///< max number of vendors in the hot OUI cache
+
+void WifiTrack::loadOUIs(bool aInBackground)
+{
+  FEATURE_STALL_GUARD;
+  if (!mOuiNames || mOuisReady) return; // prevent re-loading
+  if (!mOuiLoadFile) {
+    // precompiled table, if available
+    ErrorPtr err = mOuiTable.open(Application::sharedApplication()->resourcePath("oui.bin"));
+    if (Error::isOK(err)) {
+      OLOG(LOG_NOTICE, "Mapped precompiled OUI table with %lu OUIs", mOuiTable.size());
+      mOuisReady = true;
+      return;
+    }
+    OLOG(LOG_NOTICE, "No precompiled OUI table (%s), loading OUIs from oui.txt", Error::text(err));
+    mOuiLoadFile = fopen(Application::sharedApplication()->resourcePath("oui.txt").c_str(), "r");
+    if (!mOuiLoadFile) {
+      OLOG(LOG_ERR, "Cannot open OUI file: %s", Error::text(SysError::errNo()));
+      return;
+    }
+  }
+  if (aInBackground) {
+    // resolve vendors seen before from the hot cache until the full table is loaded
+    loadHotOUIs();
+    mOuiLoadTicket.executeOnce(boost::bind(&WifiTrack::ouiLoadStep, this, _1));
+  }
+  else {
+    mOuiLoadTicket.cancel();
+    while (!loadOUIsStep(0)) {};
+    ouisReady();
+  }
+}
+
+
+void WifiTrack::ouiLoadStep(MLTimer &aTimer)
+{
+  FEATURE_STALL_GUARD;
+  if (loadOUIsStep(OUI_LINES_PER_STEP)) {
+    ouisReady();
+    return;
+  }
+  MainLoop::currentMainLoop().retriggerTimer(aTimer, 0);
+}
+
+
+bool WifiTrack::loadOUIsStep(int aMaxLines)
 {
-  if (!mOuiNames || !mOuis.empty()) return; // prevent re-loading
-  OLOG(LOG_NOTICE, "Loading OUIs");
-  typedef std::map<string, const char*> NameMap;
-  NameMap nameMap;
   string line;
-  FILE *f = fopen(Application::sharedApplication()->resourcePath("oui.txt").c_str(), "r");
-  while (string_fgetline(f, line)) {
+  for (int i=0; aMaxLines<=0 || i<aMaxLines; i++) {
+    if (!string_fgetline(mOuiLoadFile, line)) {
+      fclose(mOuiLoadFile);
+      mOuiLoadFile = NULL;
+      return true; // done
+    }
     if (line.size()<1 || line[0]=='#') continue; // skip comments and empty lines
     // mmmmm[/nn]   name
     string s;
@@ -752,352 +1789,1050 @@ void WifiTrack::loadOUIs()
     if (s[0]=='*') {
       uint32_t gbyte;
       if (sscanf(s.c_str()+1, "%u", &gbyte)!=1) continue;
-      mOuis[msrch] = (const char *)(intptr_t)gbyte; // not a pointer, but group header byte
+      mLoadingOuis[msrch] = (const char *)(intptr_t)gbyte; // not a pointer, but group header byte
     }
     else {
       // always use same string for multiple occurrences
-      NameMap::iterator npos = nameMap.find(s);
+      OUINameMap::iterator npos = mLoadingOuiNames.find(s);
       const char *nameP = NULL;
-      if (npos==nameMap.end()) {
+      if (npos==mLoadingOuiNames.end()) {
         nameP = new char[s.size()+1];
         strcpy((char *)nameP, s.c_str());
-        nameMap[s] = nameP;
+        mLoadingOuiNames[s] = nameP;
       }
       else {
         nameP = npos->second;
       }
-      mOuis[msrch] = nameP;
+      mLoadingOuis[msrch] = nameP;
+    }
+  }
+  return false; // more to load
+}
+
+
+void WifiTrack::ouisReady()
+{
+  {
+    WT_DATA_LOCK; // aggregation thread might be resolving names right now
+    mOuis.swap(mLoadingOuis);
+    mOuisReady = true;
+  }
+  OLOG(LOG_NOTICE, "Loaded %lu OUIs with %lu distinct names", mOuis.size(), mLoadingOuiNames.size());
+  mLoadingOuis.clear();
+  mLoadingOuiNames.clear();
+  // Note: MACs created so far will get their final name when it is needed, see ouiNameOf()
+}
+
+
+void WifiTrack::loadHotOUIs()
+{
+  if (!mHotOuis.empty()) return; // already loaded (names must remain valid, MACs might point to them)
+  FILE *f = fopen(Application::sharedApplication()->dataPath(WIFITRACK_HOT_OUIS_FILE_NAME).c_str(), "r");
+  if (!f) return; // no cache yet
+  string line;
+  while (string_fgetline(f, line)) {
+    string s;
+    const char *cursor = line.c_str();
+    uint32_t oui24;
+    if (!nextPart(cursor, s, '\t', true) || sscanf(s.c_str(), "%x", &oui24)!=1) continue;
+    if (!nextPart(cursor, s, '\t', true) || s.empty()) continue;
+    mHotOuis[oui24] = s;
+  }
+  fclose(f);
+  OLOG(LOG_INFO, "Loaded %lu vendor names from hot OUI cache", mHotOuis.size());
+}
+
+
+void WifiTrack::saveHotOUIs()
+{
+  if (!mOuisReady || mOuiTable.isOpen()) return; // hot cache is only useful while loading oui.txt
+  // count MACs per /24 OUI
+  typedef std::map<uint32_t, long> OUICountMap;
+  OUICountMap counts;
+  for (WTMacStore::const_iterator pos = mMacs.begin(); pos!=mMacs.end(); ++pos) {
+    if ((*pos)->proxy) continue; // randomized address, has no vendor
+    counts[(uint32_t)((*pos)->mac>>24)]++;
+  }
+  // most frequent vendors that can be resolved by /24 alone
+  typedef std::vector<std::pair<long, uint32_t> > OUIRanking;
+  OUIRanking ranking;
+  for (OUICountMap::iterator pos = counts.begin(); pos!=counts.end(); ++pos) {
+    OUIMap::iterator opos = mOuis.find(pos->first);
+    if (opos==mOuis.end() || (intptr_t)opos->second<256) continue; // unknown, or subdivided into /28 or /36 blocks
+    ranking.push_back(std::make_pair(pos->second, pos->first));
+  }
+  if (ranking.empty()) return;
+  std::sort(ranking.begin(), ranking.end(), std::greater<std::pair<long, uint32_t> >());
+  if (ranking.size()>MAX_HOT_OUIS) ranking.resize(MAX_HOT_OUIS);
+  string path = Application::sharedApplication()->dataPath(WIFITRACK_HOT_OUIS_FILE_NAME);
+  string tmpPath = path+".tmp";
+  FILE *f = fopen(tmpPath.c_str(), "w");
+  if (!f) {
+    OLOG(LOG_WARNING, "Cannot write hot OUI cache: %s", Error::text(SysError::errNo()));
+    return;
+  }
+  for (OUIRanking::iterator pos = ranking.begin(); pos!=ranking.end(); ++pos) {
+    fprintf(f, "%06X\t%s\n", pos->second, mOuis[pos->second]);
+  }
+  fclose(f);
+  if (rename(tmpPath.c_str(), path.c_str())<0) {
+    OLOG(LOG_WARNING, "Cannot write hot OUI cache: %s", Error::text(SysError::errNo()));
+  }
+}
+
+
+
+// MARK: ==== wifitrack operation
+
+void WifiTrack::initOperation()
+{
+  mRestartTicket.cancel(); // cancel pending restarts
+  OLOG(LOG_NOTICE, "initializing wifitrack");
+  // display
+  if (mDirectDisplay) {
+    mDisp = boost::dynamic_pointer_cast<DispMatrix>(FeatureApi::sharedApi()->getFeature("dispmatrix"));
+    if (mDisp) {
+      mDisp->setNeedContentHandler(boost::bind(&WifiTrack::needContentHandler, this));
+    }
+  }
+  // network scanning
+  #if defined(__APPLE__) && CREATE_OUI_TABLE
+  createOUItable();
+  #endif
+  ErrorPtr err;
+  loadOUIs(true); // scanning does not wait for the OUIs
+  #ifdef __APPLE__
+  //uint64_t testMac = 0x40A36BC12345ll;
+  //printf("%llX = %s", testMac, ouiName(testMac));
+  #endif
+  err = loadState();
+  if (Error::isOK(err)) {
+    // assume data secured
+    mLastTempAutoSave = MainLoop::now();
+    mLastDataAutoSave = mLastTempAutoSave;
+  }
+  else {
+    OLOG(LOG_ERR, "could not load state: %s", Error::text(err));
+  }
+  // autosaving (flushing the change log, writing snapshots) runs in the main thread, also in threaded mode
+  mAutoSaveTicket.executeOnce(boost::bind(&WifiTrack::autoSaveTimer, this, _1), AUTOSAVE_CHECK_INTERVAL);
+  #if IN_THREAD
+  if (mUseThread) {
+    // pipeline: tracking thread (capture, parsing) -> aggregation thread -> main thread (events)
+    if (pipe(mWakeFds)<0) {
+      OLOG(LOG_ERR, "cannot create pipe for aggregation thread: %s -> running single threaded", Error::text(SysError::errNo()));
+      mUseThread = false;
+    }
+    else {
+      fcntl(mWakeFds[0], F_SETFL, fcntl(mWakeFds[0], F_GETFL) | O_NONBLOCK);
+      fcntl(mWakeFds[1], F_SETFL, fcntl(mWakeFds[1], F_GETFL) | O_NONBLOCK);
+      pthread_mutex_init(&mDataMutex, NULL);
+      mSightingQueue.clear();
+      mEventQueue.clear();
+      mPendingEvents.clear();
+      mDroppedSightings = 0;
+      OLOG(LOG_NOTICE, "- Starting wifi scanner and aggregation threads");
+      mRunningThreads = 2;
+      mAggregationThread = MainLoop::currentMainLoop().executeInThread(
+        boost::bind(&WifiTrack::aggregationThread, this, _1),
+        boost::bind(&WifiTrack::aggregationThreadSignal, this, _1, _2)
+      );
+      mWifiTrackingThread = MainLoop::currentMainLoop().executeInThread(
+        boost::bind(&WifiTrack::wifiTrackingThread, this, _1),
+        boost::bind(&WifiTrack::wifiTrackingThreadSignal, this, _1, _2)
+      );
+      return;
+    }
+  }
+  #endif // IN_THREAD
+  // single threaded
+  OLOG(LOG_NOTICE, "- Starting wifi scanner (single threaded)");
+  startScanner();
+}
+
+
+#if IN_THREAD
+
+void WifiTrack::wifiTrackingThread(ChildThreadWrapper &aThread)
+{
+  // create mainloop
+  OLOG(LOG_INFO, "Start of wifi tracking thread routine")
+  aThread.threadMainLoop();
+  // start scanner, will schedule first mainloop timers
+  startScanner();
+  // now start the thread's mainloop
+  aThread.threadMainLoop().run();
+  OLOG(LOG_INFO, "End of wifi tracking thread routine")
+  mRunningThreads--;
+}
+
+
+void WifiTrack::wifiTrackingThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode)
+{
+  FEATURE_STALL_GUARD;
+  OLOG(LOG_DEBUG, "Received signal from tracking thread: %d", aSignalCode);
+  if (aSignalCode==threadSignalCompleted) {
+    OLOG(LOG_INFO, "Tracking thread reports having ended");
+    mWifiTrackingThread.reset();
+  }
+}
+
+
+void WifiTrack::stopThreads()
+{
+  // request termination
+  if (mWifiTrackingThread) {
+    mWifiTrackingThread->disconnect();
+    mWifiTrackingThread->terminate();
+  }
+  if (mAggregationThread) {
+    mAggregationThread->disconnect();
+    mAggregationThread->terminate();
+  }
+  // terminating happens in the background: wait until the thread routines have actually ended,
+  // as the data lock must remain in effect as long as the aggregation thread might access data
+  MLMicroSeconds started = MainLoop::now();
+  while (mRunningThreads>0) {
+    if (MainLoop::now()-started>THREAD_STOP_TIMEOUT) {
+      OLOG(LOG_ERR, "%d thread(s) did not end within %d seconds, data lock is kept", mRunningThreads.load(), (int)(THREAD_STOP_TIMEOUT/Second));
+      break;
+    }
+    usleep(1000);
+  }
+  mWifiTrackingThread.reset();
+  mAggregationThread.reset();
+  // forget the mutex, new threads will use a new one
+  if (mRunningThreads==0) pthread_mutex_destroy(&mDataMutex);
+  for (int i=0; i<2; i++) {
+    if (mWakeFds[i]>=0) {
+      close(mWakeFds[i]);
+      mWakeFds[i] = -1;
+    }
+  }
+}
+
+
+#define SIGHTINGS_PER_LOCK 256 ///< max number of sightings processed without releasing the data lock
+
+void WifiTrack::aggregationThread(ChildThreadWrapper &aThread)
+{
+  OLOG(LOG_INFO, "Start of aggregation thread routine")
+  mAggregationThreadP = &aThread;
+  aThread.threadMainLoop().registerPollHandler(mWakeFds[0], POLLIN, boost::bind(&WifiTrack::sightingsQueuedHandler, this, _1, _2));
+  aThread.threadMainLoop().run();
+  OLOG(LOG_INFO, "End of aggregation thread routine")
+  mRunningThreads--;
+}
+
+
+bool WifiTrack::sightingsQueuedHandler(int aFD, int aPollFlags)
+{
+  if (aPollFlags & POLLIN) {
+    // consume wakeup(s)
+    uint8_t buf[64];
+    while (read(aFD, buf, sizeof(buf))>0) {};
+    do {
+      processQueuedSightings();
+    } while (!mSightingQueue.idle()); // only sleep when nothing was queued meanwhile
+  }
+  return true;
+}
+
+
+void WifiTrack::processQueuedSightings()
+{
+  WTSightingRecord rec;
+  WTSighting sighting;
+  bool more = true;
+  while (more) {
+    pthread_mutex_lock(&mDataMutex);
+    for (int i=0; i<SIGHTINGS_PER_LOCK; i++) {
+      if (!mSightingQueue.pop(rec)) {
+        more = false;
+        break;
+      }
+      rec.get(sighting);
+      recordSighting(sighting);
+    }
+    pthread_mutex_unlock(&mDataMutex);
+  }
+  flushEvents();
+}
+
+
+void WifiTrack::flushEvents()
+{
+  // pass as many events as possible to the main thread, keep the rest for later (none gets lost)
+  bool passed = false;
+  while (!mPendingEvents.empty()) {
+    if (!mEventQueue.push(mPendingEvents.front())) break; // main thread has not yet caught up
+    mPendingEvents.pop_front(); // now empty, the event was moved into the queue (refcounts are not thread safe)
+    passed = true;
+  }
+  if (passed && mAggregationThreadP) {
+    mAggregationThreadP->signalParentThread(threadSignalUserSignal);
+  }
+  if (!mPendingEvents.empty()) {
+    mPendingEventsTicket.executeOnce(boost::bind(&WifiTrack::flushEvents, this), 10*MilliSecond);
+  }
+}
+
+
+void WifiTrack::aggregationThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode)
+{
+  FEATURE_STALL_GUARD;
+  if (aSignalCode==threadSignalUserSignal) {
+    // events are queued
+    JsonObjectPtr message;
+    while (mEventQueue.pop(message)) {
+      sendEventMessage(message);
+    }
+  }
+  else if (aSignalCode==threadSignalCompleted) {
+    OLOG(LOG_INFO, "Aggregation thread reports having ended");
+    mAggregationThread.reset();
+  }
+}
+
+#endif // IN_THREAD
+
+
+
+
+void WifiTrack::startScanner()
+{
+  FEATURE_STALL_GUARD;
+  if (!mPcapFile.empty()) {
+    // offline operation from captured packets
+    startPcapReplay();
+  }
+  else if (mNativeCapture && !mMonitorIf.empty()) {
+    startNativeCapture();
+  }
+  else {
+    startTcpdump();
+  }
+  // ready
+  setInitialized();
+}
+
+
+void WifiTrack::startTcpdump()
+{
+  if (!mMonitorIf.empty()) {
+    string cmd = string_format("tcpdump -e -i %s -s 256", mMonitorIf.c_str());
+    if (mScanBeacons) {
+      string_format_append(cmd, " \\( type mgt subtype probe-req or subtype beacon \\)");
+    }
+    else {
+      string_format_append(cmd, " \\( type mgt subtype probe-req \\)");
+    }
+    if (mMinRssi!=0 && mRadiotapDBOffset!=0) {
+      uint16_t m = mMinRssi & 0xFF;
+      // Note: offset into radiotap to get rssi is specific to set of radio tap fields supported by the wifi driver
+      string_format_append(cmd, " and \\( radio[0x%x] \\> 0x%02X \\)", mRadiotapDBOffset , m);
+    }
+    #ifdef __APPLE__
+    OLOG(LOG_WARNING, "hardcoded access to mixloop/hermel/35c3 chatty wifi device");
+    //#warning "hardcoded access to mixloop/hermel/35c3 chatty wifi device"
+    //cmd = "ssh -p 22 root@hermel-40a36bc18907.local. \"tcpdump -e -i moni0 -s 2000 type mgt subtype probe-req\"";
+    //cmd = "ssh -p 22 root@1a8479bcaf76.cust.devices.plan44.ch \"" + cmd + "\""; // original chatty wifi hardware
+    cmd = "SSH_AUTH_SOCK=/private/tmp/com.apple.launchd.WLKxsPpKxd/Listeners SECURITYSESSIONID=186b3 /usr/bin/ssh -p 22 root@20bf65c5c362549f80922f97716abf8b00.p44lc.devices.plan44.ch \"" + cmd + "\""; // P44-xxm-mini 39c3 bluebox
+    #endif // __APPLE__
+    int resultFd = -1;
+    OLOG(LOG_NOTICE, "Starting tcpdump: %s", cmd.c_str());
+    mDumpPid = MainLoop::currentMainLoop().fork_and_system(boost::bind(&WifiTrack::dumpEnded, this, _1), cmd.c_str(), true, &resultFd);
+    if (mDumpPid>=0 && resultFd>=0) {
+      mDumpBufferFill = 0;
+      mDumpLineOverflow = false;
+      mDumpStream = FdCommPtr(new FdComm(MainLoop::currentMainLoop()));
+      mDumpStream->setFd(resultFd);
+      mDumpStream->setReceiveHandler(boost::bind(&WifiTrack::gotDumpData, this, _1));
+    }
+  }
+}
+
+
+void WifiTrack::dumpEnded(ErrorPtr aError)
+{
+  FEATURE_STALL_GUARD;
+  OLOG(LOG_NOTICE, "tcpdump terminated with status: %s", Error::text(aError));
+  mRestartTicket.executeOnce(boost::bind(&WifiTrack::startScanner, this), 5*Second);
+}
+
+
+void WifiTrack::restartScanner()
+{
+  if (mCapture.fd()>=0) {
+    stopNativeCapture();
+    mRestartTicket.executeOnce(boost::bind(&WifiTrack::startScanner, this), 1*Second);
+    return;
+  }
+  if (mDumpPid>=0) {
+    kill(mDumpPid, SIGTERM);
+    mDumpPid = -1;
+    // killing tcpdump should cause dumpEnded() and automatic restart
+  }
+  // anyway, if not restarted after 15 seconds, try anyway
+  mRestartTicket.executeOnce(boost::bind(&WifiTrack::startScanner, this), 15*Second);
+}
+
+
+
+
+void WifiTrack::gotDumpData(ErrorPtr aError)
+{
+  FEATURE_STALL_GUARD;
+  if (!Error::isOK(aError)) {
+    OLOG(LOG_ERR, "error reading from tcp output stream: %s", Error::text(aError));
+    return;
+  }
+  // Note: lines are parsed in place in the receive buffer, no per-line memory allocation
+  while (mDumpStream->numBytesReady()>0) {
+    size_t got = mDumpStream->receiveBytes(DUMP_BUFFER_SIZE-mDumpBufferFill, (uint8_t *)mDumpBuffer+mDumpBufferFill, aError);
+    if (Error::notOK(aError)) {
+      OLOG(LOG_ERR, "error reading from tcp output stream: %s", Error::text(aError));
+      return;
+    }
+    if (got==0) break;
+    mDumpBufferFill += got;
+    char *line = mDumpBuffer;
+    char *bufEnd = mDumpBuffer+mDumpBufferFill;
+    char *nl;
+    while ((nl = (char *)memchr(line, '\n', bufEnd-line))!=NULL) {
+      if (!mDumpLineOverflow) processDumpLine(line, nl-line);
+      mDumpLineOverflow = false;
+      line = nl+1;
+    }
+    size_t rest = bufEnd-line;
+    if (rest>=DUMP_BUFFER_SIZE) {
+      // line too long for the buffer, skip it
+      mDumpLineOverflow = true;
+      rest = 0;
+    }
+    else if (rest>0 && line!=mDumpBuffer) {
+      memmove(mDumpBuffer, line, rest);
+    }
+    mDumpBufferFill = rest;
+  }
+}
+
+
+void WifiTrack::processDumpLine(char *aLine, size_t aLen)
+{
+  aLine[aLen] = 0; // replaces the line end, so line can be logged
+  OLOG(LOG_DEBUG, "TCPDUMP: %s", aLine);
+  WTSighting sighting;
+  if (WTFrameDecoder::parseTcpdumpLine(aLine, aLen, mScanBeacons, sighting)) {
+    sighting.timestamp = MainLoop::now();
+    handleSighting(sighting);
+  }
+}
+
+
+void WifiTrack::startNativeCapture()
+{
+  ErrorPtr err = mCapture.open(mMonitorIf, mScanBeacons);
+  if (Error::notOK(err)) {
+    OLOG(LOG_ERR, "Cannot start native capture on '%s': %s", mMonitorIf.c_str(), Error::text(err));
+    mRestartTicket.executeOnce(boost::bind(&WifiTrack::startScanner, this), 15*Second);
+    return;
+  }
+  OLOG(LOG_NOTICE, "Started native capture on '%s'", mMonitorIf.c_str());
+  MainLoop::currentMainLoop().registerPollHandler(mCapture.fd(), POLLIN, boost::bind(&WifiTrack::captureHandler, this, _1, _2));
+}
+
+
+void WifiTrack::stopNativeCapture()
+{
+  if (mCapture.fd()>=0) {
+    MainLoop::currentMainLoop().unregisterPollHandler(mCapture.fd());
+    mCapture.close();
+  }
+}
+
+
+#define MAX_FRAMES_PER_POLL 256 ///< max frames to process before returning to the mainloop
+
+bool WifiTrack::captureHandler(int aFD, int aPollFlags)
+{
+  FEATURE_STALL_GUARD;
+  if (aPollFlags & POLLIN) {
+    ErrorPtr err;
+    const uint8_t *frame;
+    for (int i=0; i<MAX_FRAMES_PER_POLL; i++) {
+      size_t len = mCapture.receive(frame, err);
+      if (len==0) break;
+      WTSighting sighting;
+      if (!WTFrameDecoder::decodeRadiotap(frame, len, sighting)) continue;
+      // same as the packet filter passed to tcpdump
+      if (mMinRssi!=0 && sighting.rssi!=0 && sighting.rssi<=mMinRssi) continue;
+      sighting.timestamp = MainLoop::now();
+      handleSighting(sighting);
+    }
+    if (Error::notOK(err)) {
+      OLOG(LOG_ERR, "native capture error: %s -> restarting", Error::text(err));
+      restartScanner();
+    }
+  }
+  else if (aPollFlags & (POLLERR|POLLHUP)) {
+    OLOG(LOG_ERR, "native capture socket error -> restarting");
+    restartScanner();
+  }
+  return true;
+}
+
+
+#define REPLAY_PACKETS_PER_STEP 500 ///< packets replayed per mainloop cycle
+
+void WifiTrack::startPcapReplay()
+{
+  ErrorPtr err = mPcapReplay.open(mPcapFile);
+  if (Error::notOK(err)) {
+    OLOG(LOG_ERR, "Cannot replay pcap file: %s", Error::text(err));
+    return;
+  }
+  OLOG(LOG_NOTICE, "Replaying captured packets from '%s'", mPcapFile.c_str());
+  mReplayTicket.executeOnce(boost::bind(&WifiTrack::pcapReplayStep, this, _1));
+}
+
+
+void WifiTrack::pcapReplayStep(MLTimer &aTimer)
+{
+  FEATURE_STALL_GUARD;
+  const uint8_t *data;
+  size_t len;
+  MLMicroSeconds ts;
+  for (int i=0; i<REPLAY_PACKETS_PER_STEP; i++) {
+    if (!mPcapReplay.nextPacket(data, len, ts)) {
+      OLOG(LOG_NOTICE, "Replay of '%s' complete", mPcapFile.c_str());
+      mPcapReplay.close();
+      return;
+    }
+    WTSighting sighting;
+    if (!WTFrameDecoder::decodePacket(mPcapReplay.linkType(), data, len, sighting)) continue;
+    if (sighting.beacon && !mScanBeacons) continue;
+    sighting.timestamp = MainLoop::now();
+    handleSighting(sighting);
+  }
+  MainLoop::currentMainLoop().retriggerTimer(aTimer, 0);
+}
+
+
+void WifiTrack::handleSighting(const WTSighting &aSighting)
+{
+  #if IN_THREAD
+  if (mUseThread) {
+    // pass to aggregation thread
+    WTSightingRecord rec;
+    rec.set(aSighting);
+    bool wakeup;
+    if (!mSightingQueue.push(rec, &wakeup)) {
+      mDroppedSightings++;
+      return;
+    }
+    if (wakeup) {
+      // aggregation thread has declared itself idle, wake it up
+      uint8_t b = 0;
+      if (write(mWakeFds[1], &b, 1)<0) {
+        // pipe full (EAGAIN) means a wakeup is already pending
+      }
+    }
+    return;
+  }
+  #endif // IN_THREAD
+  recordSighting(aSighting);
+}
+
+
+void WifiTrack::postEvent(JsonObjectPtr aMessage)
+{
+  #if IN_THREAD
+  if (!inMainThread()) {
+    // we are in the aggregation thread, events must be sent from main thread
+    mPendingEvents.push_back(aMessage);
+    return;
+  }
+  #endif // IN_THREAD
+  sendEventMessage(aMessage);
+}
+
+
+void WifiTrack::recordSighting(const WTSighting &aSighting)
+{
+  if (!aSighting.beacon && aSighting.rssi<mMinProcessRssi) {
+    FOCUSOLOG("Too weak: RSSI=%d<%d, MAC=%s, SSID='%s'", aSighting.rssi, mMinProcessRssi, macAddressToString(aSighting.mac,':').c_str(), aSighting.ssidStr().c_str());
+    return;
+  }
+  int rssi = aSighting.rssi;
+  bool beacon = aSighting.beacon;
+  WTSSidPtr s;
+  WTMacPtr m;
+  bool newSSID = false;
+  // record
+  MLMicroSeconds now = aSighting.timestamp;
+  // - SSID
+  bool newSSidForMac = false;
+  s = internSsid(WTSSidKey(aSighting.ssid, aSighting.ssidLen), &newSSID);
+  if (beacon) {
+    // just record beacon sighting
+    if (s->beaconSeenLast==Never) {
+      OLOG(LOG_INFO, "New Beacon found: RSSI=%d, SSID='%s'", rssi, s->ssid.c_str());
+    }
+    s->beaconSeenLast = now;
+    s->beaconRssi = rssi;
+    markDirty(s);
+  }
+  else {
+    // process probe request
+    uint64_t mac = aSighting.mac;
+    FOCUSOLOG("RSSI=%d, MAC=%s, SSID='%s'", rssi, macAddressToString(mac,':').c_str(), s->ssid.c_str());
+    s->seenLast = now;
+    s->seenCount++;
+    markDirty(s);
+    // - MAC
+    if (mCollapseRandomMacs && isRandomizedMac(mac)) {
+      // randomized MAC, changes all the time -> record on the proxy MAC for the device, if any
+      m = collapsedMac(mac, s, now);
+    }
+    else {
+      m = mMacs.find(mac);
+      if (!m) {
+        // unknown, create
+        if (!s->ssid.empty() || mRememberWithoutSsid) {
+          m = newMac(mac);
+          mMacs.insert(m);
+        }
+      }
+    }
+    if (m) {
+      m->seenCount++;
+      m->seenLast = now;
+      if (m->seenFirst==Never) m->seenFirst = now;
+      m->lastRssi = rssi;
+      if (rssi>m->bestRssi) m->bestRssi = rssi;
+      if (rssi<m->worstRssi) m->worstRssi = rssi;
+      markDirty(m);
+      // - connection (if not empty ssid or empty ssids are allowed)
+      if (!s->ssid.empty() || mRememberWithoutSsid) {
+        newSSidForMac = m->addSsid(s->id);
+        s->addMac(m);
+        if (newSSidForMac) addToPairIndex(m, s);
+      }
+      // process sighting
+      if (mAggregatePersons) {
+        if (mMeasureAggregation) {
+          MLMicroSeconds t = MainLoop::now();
+          processSighting(m, s, newSSidForMac);
+          mAggregationTime += MainLoop::now()-t;
+        }
+        else {
+          processSighting(m, s, newSSidForMac);
+        }
+      }
+    }
+  }
+  checkEviction(now);
+  pruneEphemeralMacs(now);
+  if (mReportSightings && mApiNotify && mSightingEventsWanted) {
+    JsonObjectPtr message = JsonObject::newObj();
+    JsonObjectPtr sighting = JsonObject::newObj();
+    sighting->add("type", JsonObject::newString(beacon ? "beacon" : "probe"));
+    sighting->add("newSSID", JsonObject::newBool(newSSID));
+    if (m) {
+      sighting->add("MAC", JsonObject::newString(macAddressToString(m->mac,':')));
+      sighting->add("MACsightings", JsonObject::newInt64(m->seenCount));
+      sighting->add("OUIname", JsonObject::newString(ouiNameOf(m)));
+      sighting->add("rssi", JsonObject::newInt32(m->lastRssi));
+      sighting->add("worstRssi", JsonObject::newInt32(m->worstRssi));
+      sighting->add("bestRssi", JsonObject::newInt32(m->bestRssi));
+    }
+    if (s) {
+      sighting->add("SSID", JsonObject::newString(s->ssid));
+      sighting->add("SSIDsightings", JsonObject::newInt64(s->seenCount));
+      sighting->add("hidden", JsonObject::newBool(s->hidden));
+      sighting->add("beaconRssi", JsonObject::newInt32(s->beaconRssi));
     }
+    message->add("sighting", sighting);
+    postEvent(message);
   }
-  OLOG(LOG_NOTICE, "Loaded %lu OUIs with %lu distinct names", mOuis.size(), nameMap.size());
 }
 
 
+WTMacPtr WifiTrack::newMac(uint64_t aMac)
+{
+  WTMacPtr m = WTMacPtr(new WTMac);
+  m->id = mNextMacId++;
+  m->mac = aMac;
+  m->ouiName = ouiName(aMac);
+  m->ouiResolved = mOuisReady;
+  return m;
+}
 
-// MARK: ==== wifitrack operation
 
-void WifiTrack::initOperation()
+WTPersonPtr WifiTrack::newPerson()
 {
-  mRestartTicket.cancel(); // cancel pending restarts
-  OLOG(LOG_NOTICE, "initializing wifitrack");
-  // display
-  if (mDirectDisplay) {
-    mDisp = boost::dynamic_pointer_cast<DispMatrix>(FeatureApi::sharedApi()->getFeature("dispmatrix"));
-    if (mDisp) {
-      mDisp->setNeedContentHandler(boost::bind(&WifiTrack::needContentHandler, this));
-    }
-  }
-  // network scanning
-  #if defined(__APPLE__) && CREATE_OUI_TABLE
-  createOUItable();
-  #endif
-  ErrorPtr err;
-  loadOUIs();
-  #ifdef __APPLE__
-  //uint64_t testMac = 0x40A36BC12345ll;
-  //printf("%llX = %s", testMac, ouiName(testMac));
-  #endif
-  err = load(Application::sharedApplication()->tempPath(WIFITRACK_STATE_FILE_NAME));
-  if (Error::isOK(err)) {
-    OLOG(LOG_NOTICE, ">>> loaded data from temp file");
-  }
-  else {
-    // try persistent path
-    err = load(Application::sharedApplication()->dataPath(WIFITRACK_STATE_FILE_NAME));
-    if (Error::isOK(err)) {
-      OLOG(LOG_NOTICE, ">>> loaded data from persistent data file");
-    }
-  }
-  if (Error::isOK(err)) {
-    // assume data secured
-    mLastTempAutoSave = MainLoop::now();
-    mLastDataAutoSave = mLastTempAutoSave;
-  }
-  else {
-    OLOG(LOG_ERR, "could not load state: %s", Error::text(err));
-  }
-  #if IN_THREAD
-  if (mUseThread) {
-    // put entire wifi scanning into background thread
-    pthread_mutex_init(&mReportMutex, NULL);
-    mWifiTrackingThread = MainLoop::currentMainLoop().executeInThread(
-      boost::bind(&WifiTrack::wifiTrackingThread, this, _1),
-      boost::bind(&WifiTrack::wifiTrackingThreadSignal, this, _1, _2)
-    );
-    return;
-  }
-  #endif // IN_THREAD
-  // single threaded
-  OLOG(LOG_NOTICE, "- Starting wifi scanner (single threaded)");
-  startScanner();
+  WTPersonPtr p = WTPersonPtr(new WTPerson);
+  p->id = mNextPersonId++;
+  return p;
 }
 
 
-#if IN_THREAD
-
-void WifiTrack::wifiTrackingThread(ChildThreadWrapper &aThread)
+WTSSidPtr WifiTrack::internSsid(const WTSSidKey &aKey, bool *aNewP)
 {
-  // create mainloop
-  OLOG(LOG_INFO, "Start of wifi tracking thread routine")
-  aThread.threadMainLoop();
-  // start scanner, will schedule first mainloop timers
-  startScanner();
-  // now start the thread's mainloop
-  aThread.threadMainLoop().run();
-  OLOG(LOG_INFO, "End of wifi tracking thread routine")
+  WTSSidPtr s = mSsids.find(aKey); // no string allocation for known SSIDs
+  if (aNewP) *aNewP = !s;
+  if (!s) {
+    // unknown, create
+    s = WTSSidPtr(new WTSSid);
+    s->ssid.assign(aKey.str, aKey.len);
+    s->id = (uint32_t)mSsidById.size();
+    mSsidById.push_back(s);
+    mSsids.insert(s);
+  }
+  return s;
 }
 
 
-void WifiTrack::wifiTrackingThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode)
+void WifiTrack::addToPairIndex(WTMacPtr aMac, WTSSidPtr aSSid)
 {
-  OLOG(LOG_DEBUG, "Received signal from child thread: %d", aSignalCode);
-  if (aSignalCode==threadSignalUserSignal) {
-    // means a new RFID was detected
-    // - get the message object
-    pthread_mutex_lock(&mReportMutex);
-    JsonObjectPtr message = mEncounterMessage;
-    mEncounterMessage.reset();
-    pthread_mutex_unlock(&mReportMutex);
-    // - send it
-    sendEventMessage(message);
+  // aMac now shares aSSid with all other MACs of aSSid
+  // Note: too common SSIDs do not indicate relationship, so these are not counted
+  if (aSSid->macs.size()>=mTooCommonMacCount) return;
+  for (WTMacList::iterator mpos = aSSid->macs.begin(); mpos!=aSSid->macs.end(); ++mpos) {
+    if (*mpos==aMac) continue;
+    mPairIndex.increment(macPairKey(*aMac, **mpos));
   }
-  else if (aSignalCode==threadSignalCompleted) {
-    OLOG(LOG_INFO, "Tracking thread reports having ended");
-    mWifiTrackingThread.reset();
+}
+
+
+void WifiTrack::rebuildPairIndex()
+{
+  mPairIndex.clear();
+  for (std::vector<WTSSidPtr>::iterator spos = mSsidById.begin(); spos!=mSsidById.end(); ++spos) {
+    WTSSidPtr s = *spos;
+    if (!s || s->macs.size()>=mTooCommonMacCount) continue; // evicted or too common
+    for (WTMacList::iterator m1 = s->macs.begin(); m1!=s->macs.end(); ++m1) {
+      WTMacList::iterator m2 = m1;
+      for (++m2; m2!=s->macs.end(); ++m2) {
+        mPairIndex.increment(macPairKey(**m1, **m2));
+      }
+    }
   }
+  OLOG(LOG_INFO, "Rebuilt MAC pair index: %lu MAC pairs share SSIDs", mPairIndex.size());
 }
 
-#endif // IN_THREAD
 
+// MARK: ==== person clustering
 
+WTPersonPtr WifiTrack::personOf(WTMacPtr aMac)
+{
+  WTPersonPtr p = aMac->person;
+  if (!p || !p->mergedInto) return p; // no person or person is a root
+  // find root
+  WTPersonPtr root = p->mergedInto;
+  while (root->mergedInto) root = root->mergedInto;
+  // path compression
+  while (p!=root) {
+    WTPersonPtr next = p->mergedInto;
+    p->mergedInto = root;
+    p = next;
+  }
+  aMac->person = root;
+  return root;
+}
 
 
-void WifiTrack::startScanner()
+void WifiTrack::addMacToPerson(WTMacPtr aMac, WTPersonPtr aPerson)
 {
-  if (!mMonitorIf.empty()) {
-    string cmd = string_format("tcpdump -e -i %s -s 256", mMonitorIf.c_str());
-    if (mScanBeacons) {
-      string_format_append(cmd, " \\( type mgt subtype probe-req or subtype beacon \\)");
+  aMac->person = aPerson;
+  aMac->nextInPerson = NULL;
+  aMac->prevInPerson = aPerson->lastMac;
+  if (aPerson->lastMac) aPerson->lastMac->nextInPerson = aMac.get();
+  else aPerson->firstMac = aMac.get();
+  aPerson->lastMac = aMac.get();
+  aPerson->macCount++;
+}
+
+
+WTPersonPtr WifiTrack::mergePersons(WTPersonPtr aPerson, WTPersonPtr aOther)
+{
+  // union by size: smaller person gets merged into larger one
+  WTPersonPtr root = aPerson;
+  WTPersonPtr child = aOther;
+  if (child->macCount>root->macCount) {
+    root = aOther;
+    child = aPerson;
+  }
+  // appearance: oldest person wins, provided it has already been shown and is not hidden
+  WTPersonPtr older = child->seenFirst!=Never && (root->seenFirst==Never || child->seenFirst<root->seenFirst) ? child : root;
+  WTPersonPtr appearance = older->shownLast!=Never && !older->hidden ? older : root;
+  OLOG(LOG_NOTICE, "--- Persons '%s' (%d/%s, MACs=%lu) and '%s' (%d/%s, MACs=%lu) are the same -> merged, using appearance '%s' (%d/%s)",
+    root->name.c_str(), root->imageIndex, pixelToWebColor(root->color, true).c_str(), root->macCount,
+    child->name.c_str(), child->imageIndex, pixelToWebColor(child->color, true).c_str(), child->macCount,
+    appearance->name.c_str(), appearance->imageIndex, pixelToWebColor(appearance->color, true).c_str()
+  );
+  if (appearance!=root) {
+    root->color = appearance->color;
+    root->imageIndex = appearance->imageIndex;
+    root->name = appearance->name;
+  }
+  if (root->name.empty()) root->name = child->name;
+  root->hidden = root->hidden || child->hidden;
+  // statistics
+  root->seenCount += child->seenCount;
+  if (older==child) root->seenFirst = child->seenFirst; // inherit age
+  if (child->seenLast>root->seenLast) {
+    root->seenLast = child->seenLast;
+    root->lastRssi = child->lastRssi;
+  }
+  if (child->shownLast!=Never && (root->shownLast==Never || child->shownLast>root->shownLast)) root->shownLast = child->shownLast;
+  if (root->bestRssi<child->bestRssi) root->bestRssi = child->bestRssi;
+  if (root->worstRssi>child->worstRssi) root->worstRssi = child->worstRssi;
+  // splice MAC lists
+  if (child->firstMac) {
+    if (root->lastMac) {
+      root->lastMac->nextInPerson = child->firstMac;
+      child->firstMac->prevInPerson = root->lastMac;
     }
     else {
-      string_format_append(cmd, " \\( type mgt subtype probe-req \\)");
+      root->firstMac = child->firstMac;
     }
-    if (mMinRssi!=0 && mRadiotapDBOffset!=0) {
-      uint16_t m = mMinRssi & 0xFF;
-      // Note: offset into radiotap to get rssi is specific to set of radio tap fields supported by the wifi driver
-      string_format_append(cmd, " and \\( radio[0x%x] \\> 0x%02X \\)", mRadiotapDBOffset , m);
+    root->lastMac = child->lastMac;
+  }
+  root->macCount += child->macCount;
+  child->firstMac = NULL;
+  child->lastMac = NULL;
+  child->macCount = 0;
+  // link
+  child->mergedInto = root;
+  mPersons.erase(child);
+  return root;
+}
+
+
+// MARK: ==== randomized MACs
+
+WTMacPtr WifiTrack::collapsedMac(uint64_t aMac, WTSSidPtr aSSid, MLMicroSeconds aNow)
+{
+  WTMacPtr m = mMacs.find(aMac);
+  if (m && !m->proxy) return m; // recorded as a regular MAC (before collapsing was enabled)
+  WTEphemeralMacPtr e = mEphemeralMacs.find(aMac);
+  if (!e) {
+    e = WTEphemeralMacPtr(new WTEphemeralMac);
+    e->mac = aMac;
+    mEphemeralMacs.insert(e);
+  }
+  e->seenLast = aNow;
+  if (e->proxy && mMacs.find(e->proxy->mac)!=e->proxy) e->proxy.reset(); // proxy was evicted
+  if (!e->proxy) {
+    // empty (wildcard) probes and SSIDs known to many MACs do not identify a device
+    if (aSSid->ssid.empty() || aSSid->macs.size()>=mTooCommonMacCount) return WTMacPtr();
+    // SSID fingerprint: a proxy that has already probed the same rare SSID is most likely the same device
+    // (with a previous randomized MAC). If there are several, the most recently seen one is the best guess
+    for (WTMacList::iterator pos = aSSid->macs.begin(); pos!=aSSid->macs.end(); ++pos) {
+      if ((*pos)->proxy && (!e->proxy || (*pos)->seenLast>e->proxy->seenLast)) e->proxy = *pos;
     }
-    #ifdef __APPLE__
-    OLOG(LOG_WARNING, "hardcoded access to mixloop/hermel/35c3 chatty wifi device");
-    //#warning "hardcoded access to mixloop/hermel/35c3 chatty wifi device"
-    //cmd = "ssh -p 22 root@hermel-40a36bc18907.local. \"tcpdump -e -i moni0 -s 2000 type mgt subtype probe-req\"";
-    //cmd = "ssh -p 22 root@1a8479bcaf76.cust.devices.plan44.ch \"" + cmd + "\""; // original chatty wifi hardware
-    cmd = "SSH_AUTH_SOCK=/private/tmp/com.apple.launchd.WLKxsPpKxd/Listeners SECURITYSESSIONID=186b3 /usr/bin/ssh -p 22 root@20bf65c5c362549f80922f97716abf8b00.p44lc.devices.plan44.ch \"" + cmd + "\""; // P44-xxm-mini 39c3 bluebox
-    #endif // __APPLE__
-    int resultFd = -1;
-    OLOG(LOG_NOTICE, "Starting tcpdump: %s", cmd.c_str());
-    mDumpPid = MainLoop::currentMainLoop().fork_and_system(boost::bind(&WifiTrack::dumpEnded, this, _1), cmd.c_str(), true, &resultFd);
-    if (mDumpPid>=0 && resultFd>=0) {
-      mDumpStream = FdCommPtr(new FdComm(MainLoop::currentMainLoop()));
-      mDumpStream->setFd(resultFd);
-      mDumpStream->setReceiveHandler(boost::bind(&WifiTrack::gotDumpLine, this, _1), '\n');
+    if (!e->proxy) {
+      // new device, the first randomized MAC seen names its proxy
+      e->proxy = m ? m : newMac(aMac);
+      e->proxy->proxy = true;
+      mMacs.insert(e->proxy);
     }
+    mCollapsedMacs++;
+    FOCUSOLOG("randomized MAC %s via '%s' -> collapsed into proxy MAC %s",
+      macAddressToString(aMac,':').c_str(),
+      aSSid->ssid.c_str(),
+      macAddressToString(e->proxy->mac,':').c_str()
+    );
   }
-  // ready
-  setInitialized();
+  return e->proxy;
 }
 
 
-void WifiTrack::dumpEnded(ErrorPtr aError)
+void WifiTrack::pruneEphemeralMacs(MLMicroSeconds aNow)
 {
-  OLOG(LOG_NOTICE, "tcpdump terminated with status: %s", Error::text(aError));
-  mRestartTicket.executeOnce(boost::bind(&WifiTrack::startScanner, this), 5*Second);
+  if (aNow<mLastEphemeralPrune+EPHEMERAL_PRUNE_INTERVAL && mLastEphemeralPrune<=aNow) return;
+  mLastEphemeralPrune = aNow;
+  std::vector<uint64_t> expired;
+  for (WTEphemeralMacStore::const_iterator pos = mEphemeralMacs.begin(); pos!=mEphemeralMacs.end(); ++pos) {
+    if ((*pos)->seenLast<aNow-mEphemeralTTL) expired.push_back((*pos)->mac);
+  }
+  for (std::vector<uint64_t>::iterator pos = expired.begin(); pos!=expired.end(); ++pos) {
+    mEphemeralMacs.erase(*pos);
+  }
 }
 
 
-void WifiTrack::restartScanner()
+// MARK: ==== aging and eviction
+
+size_t WifiTrack::memoryEstimate()
 {
-  if (mDumpPid>=0) {
-    kill(mDumpPid, SIGTERM);
-    mDumpPid = -1;
-    // killing tcpdump should cause dumpEnded() and automatic restart
+  size_t mem = mMacs.size()*WT_MAC_COST + mSsids.size()*WT_SSID_COST + mPersons.size()*WT_PERSON_COST + mPairIndex.size()*WT_PAIR_COST;
+  mem += mSsidById.size()*sizeof(WTSSidPtr);
+  mem += mEphemeralMacs.size()*WT_EPHEMERAL_COST;
+  for (WTMacStore::const_iterator pos = mMacs.begin(); pos!=mMacs.end(); ++pos) {
+    mem += (*pos)->ssids.size()*WT_LINK_COST;
   }
-  // anyway, if not restarted after 15 seconds, try anyway
-  mRestartTicket.executeOnce(boost::bind(&WifiTrack::startScanner, this), 15*Second);
+  return mem;
 }
 
 
+bool WifiTrack::evictable(WTMacPtr aMac, MLMicroSeconds aSeenBefore)
+{
+  if (aMac->seenLast>=aSeenBefore || aMac->hidden) return false;
+  // MACs of persons the user has named or hidden are kept, too
+  WTPersonPtr p = personOf(aMac);
+  return !p || (!p->hidden && p->name.empty());
+}
 
 
-void WifiTrack::gotDumpLine(ErrorPtr aError)
+/// sort order for eviction: MACs seen only once (typically randomized ones) first, then least recently seen first
+static bool colderMac(const WTMacPtr &aA, const WTMacPtr &aB)
 {
-  if (!Error::isOK(aError)) {
-    OLOG(LOG_ERR, "error reading from tcp output stream: %s", Error::text(aError));
-    return;
+  bool aSingle = aA->seenCount<=1;
+  bool bSingle = aB->seenCount<=1;
+  if (aSingle!=bSingle) return aSingle;
+  return aA->seenLast<aB->seenLast;
+}
+
+
+void WifiTrack::checkEviction(MLMicroSeconds aNow)
+{
+  if (mMaxMemory<=0 && mMaxMacAge<=0) return; // no eviction
+  if (aNow<mLastEvictionCheck+EVICTION_CHECK_INTERVAL && mLastEvictionCheck<=aNow) return;
+  mLastEvictionCheck = aNow;
+  if (mSnapshotWriter.isOpen()) return; // do not evict objects a running snapshot will still write, try next time
+  long macsBefore = mEvictedMacs;
+  long ssidsBefore = mEvictedSsids;
+  MLMicroSeconds seenBefore = aNow-mEvictMinAge; // anything seen more recently is kept
+  std::vector<WTSSidPtr> orphans;
+  // candidates
+  std::vector<WTMacPtr> candidates;
+  for (WTMacStore::const_iterator pos = mMacs.begin(); pos!=mMacs.end(); ++pos) {
+    if (evictable(*pos, seenBefore)) candidates.push_back(*pos);
   }
-  string line;
-  if (mDumpStream->receiveDelimitedString(line)) {
-    OLOG(LOG_DEBUG, "TCPDUMP: %s", line.c_str());
-    // 17:40:22.356367 1.0 Mb/s 2412 MHz 11b -75dBm signal -75dBm signal antenna 0 -109dBm signal antenna 1 BSSID:5c:49:79:6d:28:1a (oui Unknown) DA:5c:49:79:6d:28:1a (oui Unknown) SA:c8:bc:c8:be:0d:0a (oui Unknown) Probe Request (iWay_Fiber_bu725) [1.0* 2.0* 5.5* 11.0* 6.0 9.0 12.0 18.0 Mbit]
-    bool decoded = false;
-    bool beacon = false;
-    int rssi = 0;
-    uint64_t mac = 0;
-    string ssid;
-    size_t s,e;
-    // - rssi (signal)
-    e = line.find(" signal ");
-    if (e!=string::npos) {
-      s = line.rfind(" ", e-1);
-      if (s!=string::npos) {
-        sscanf(line.c_str()+s+1, "%d", &rssi);
-      }
-      if (mScanBeacons) {
-        s = line.find("Beacon (", s);
-        if (s!=string::npos) {
-          // Is a beacon, get SSID
-          s += 8;
-          e = line.find(") ", s);
-          ssid = line.substr(s, e-s);
-          decoded = true;
-          beacon = true;
-        }
-      }
-      if (!decoded) {
-        // must be Probe Request
-        // - sender MAC (source address)
-        s = line.find("SA:");
-        if (s!=string::npos) {
-          mac = stringToMacAddress(line.c_str()+s+3);
-          // - name of SSID probed
-          s = line.find("Probe Request (", s);
-          if (s!=string::npos) {
-            s += 15;
-            e = line.find(") ", s);
-            ssid = line.substr(s, e-s);
-            // - check min rssi
-            if (rssi<mMinProcessRssi) {
-              FOCUSOLOG("Too weak: RSSI=%d<%d, MAC=%s, SSID='%s'", rssi, mMinProcessRssi, macAddressToString(mac,':').c_str(), ssid.c_str());
-            }
-            else {
-              decoded = true;
-            }
-          }
-        }
-      }
+  // age based eviction
+  if (mMaxMacAge>0) {
+    MLMicroSeconds cutoff = aNow-mMaxMacAge;
+    std::vector<WTMacPtr>::iterator keep = candidates.begin();
+    for (std::vector<WTMacPtr>::iterator pos = candidates.begin(); pos!=candidates.end(); ++pos) {
+      if ((*pos)->seenLast<cutoff) evictMac(*pos, &orphans);
+      else *keep++ = *pos;
     }
-    if (decoded) {
-      WTSSidPtr s;
-      WTMacPtr m;
-      bool newSSID = false;
-      // record
-      MLMicroSeconds now = MainLoop::now();
-      // - SSID
-      bool newSSidForMac = false;
-      WTSSidMap::iterator ssidPos = mSsids.find(ssid);
-      if (ssidPos!=mSsids.end()) {
-        s = ssidPos->second;
-      }
-      else {
-        // unknown, create
-        newSSID = true;
-        s = WTSSidPtr(new WTSSid);
-        s->ssid = ssid;
-        mSsids[ssid] = s;
-      }
-      if (beacon) {
-        // just record beacon sighting
-        if (s->beaconSeenLast==Never) {
-          OLOG(LOG_INFO, "New Beacon found: RSSI=%d, SSID='%s'", rssi, ssid.c_str());
-        }
-        s->beaconSeenLast = now;
-        s->beaconRssi = rssi;
-      }
-      else {
-        // process probe request
-        FOCUSOLOG("RSSI=%d, MAC=%s, SSID='%s'", rssi, macAddressToString(mac,':').c_str(), ssid.c_str());
-        s->seenLast = now;
-        s->seenCount++;
-        // - MAC
-        WTMacMap::iterator macPos = mMacs.find(mac);
-        if (macPos!=mMacs.end()) {
-          m = macPos->second;
-        }
-        else {
-          // unknown, create
-          if (!s->ssid.empty() || mRememberWithoutSsid) {
-            m = WTMacPtr(new WTMac);
-            m->mac = mac;
-            m->ouiName = ouiName(mac);
-            mMacs[mac] = m;
-          }
-        }
-        if (m) {
-          m->seenCount++;
-          m->seenLast = now;
-          if (m->seenFirst==Never) m->seenFirst = now;
-          m->lastRssi = rssi;
-          if (rssi>m->bestRssi) m->bestRssi = rssi;
-          if (rssi<m->worstRssi) m->worstRssi = rssi;
-          // - connection (if not empty ssid or empty ssids are allowed)
-          if (!s->ssid.empty() || mRememberWithoutSsid) {
-            if (m->ssids.find(s)==m->ssids.end()) {
-              newSSidForMac = true;
-              m->ssids.insert(s);
-            }
-            s->macs.insert(m);
-          }
-          // process sighting
-          if (mAggregatePersons) {
-            processSighting(m, s, newSSidForMac);
-          }
-        }
+    candidates.erase(keep, candidates.end());
+    // SSIDs without MACs (e.g. only seen in beacons) age as well
+    for (std::vector<WTSSidPtr>::iterator pos = mSsidById.begin(); pos!=mSsidById.end(); ++pos) {
+      WTSSidPtr s = *pos;
+      if (s && s->macs.empty() && !s->hidden && s->seenLast<cutoff && s->beaconSeenLast<cutoff) evictSsid(s);
+    }
+  }
+  // memory budget
+  if (mMaxMemory>0) {
+    size_t budget = (size_t)mMaxMemory*1024;
+    size_t mem = memoryEstimate();
+    if (mem>budget) {
+      // evict coldest MACs until 10% below budget, to avoid evicting in every check
+      size_t target = budget-budget/10;
+      std::sort(candidates.begin(), candidates.end(), colderMac);
+      for (std::vector<WTMacPtr>::iterator pos = candidates.begin(); pos!=candidates.end() && mem>target; ++pos) {
+        size_t cost = WT_MAC_COST+(*pos)->ssids.size()*WT_LINK_COST;
+        evictMac(*pos, &orphans);
+        mem -= cost<mem ? cost : mem;
       }
-      if (mReportSightings && mApiNotify) {
-        JsonObjectPtr message = JsonObject::newObj();
-        JsonObjectPtr sighting = JsonObject::newObj();
-        sighting->add("type", JsonObject::newString(beacon ? "beacon" : "probe"));
-        sighting->add("newSSID", JsonObject::newBool(newSSID));
-        if (m) {
-          sighting->add("MAC", JsonObject::newString(macAddressToString(m->mac,':')));
-          sighting->add("MACsightings", JsonObject::newInt64(m->seenCount));
-          sighting->add("OUIname", JsonObject::newString(m->ouiName));
-          sighting->add("rssi", JsonObject::newInt32(m->lastRssi));
-          sighting->add("worstRssi", JsonObject::newInt32(m->worstRssi));
-          sighting->add("bestRssi", JsonObject::newInt32(m->bestRssi));
-        }
-        if (s) {
-          sighting->add("SSID", JsonObject::newString(s->ssid));
-          sighting->add("SSIDsightings", JsonObject::newInt64(s->seenCount));
-          sighting->add("hidden", JsonObject::newBool(s->hidden));
-          sighting->add("beaconRssi", JsonObject::newInt32(s->beaconRssi));
-        }
-        message->add("sighting", sighting);
-        sendEventMessage(message);
+      if (mem>budget) {
+        OLOG(LOG_WARNING, "memory budget of %d kB exceeded (%lu kB) by MACs that must not be evicted yet", mMaxMemory, (unsigned long)(mem/1024));
       }
     }
   }
+  // SSIDs that lost all their MACs
+  for (std::vector<WTSSidPtr>::iterator pos = orphans.begin(); pos!=orphans.end(); ++pos) {
+    WTSSidPtr s = *pos;
+    if (s->macs.empty() && !s->hidden && s->seenLast<seenBefore && s->beaconSeenLast<seenBefore && mSsidById[s->id]==s) evictSsid(s);
+  }
+  if (mEvictedMacs!=macsBefore || mEvictedSsids!=ssidsBefore) {
+    OLOG(LOG_NOTICE, "evicted %ld MACs and %ld SSIDs, now %lu MACs, %lu SSIDs, %lu persons",
+      mEvictedMacs-macsBefore, mEvictedSsids-ssidsBefore, mMacs.size(), mSsids.size(), mPersons.size()
+    );
+  }
+}
+
+
+void WifiTrack::evictMac(WTMacPtr aMac, std::vector<WTSSidPtr> *aOrphansP)
+{
+  // unlink from SSIDs and the pair index
+  // Note: pairs must be erased for all SSIDs, regardless of their current size. SSIDs that are too
+  //   common now might have counted pairs while they were not, and erasing a pair not in the index is harmless
+  for (WTSSidIdList::iterator spos = aMac->ssids.begin(); spos!=aMac->ssids.end(); ++spos) {
+    WTSSidPtr s = mSsidById[*spos];
+    for (WTMacList::iterator mpos = s->macs.begin(); mpos!=s->macs.end(); ++mpos) {
+      if (*mpos!=aMac) mPairIndex.erase(macPairKey(*aMac, **mpos));
+    }
+    s->removeMac(aMac);
+    if (s->macs.empty() && aOrphansP) aOrphansP->push_back(s);
+  }
+  aMac->ssids.clear();
+  // unlink from person
+  WTPersonPtr p = personOf(aMac);
+  if (p) {
+    if (aMac->prevInPerson) aMac->prevInPerson->nextInPerson = aMac->nextInPerson;
+    else p->firstMac = aMac->nextInPerson;
+    if (aMac->nextInPerson) aMac->nextInPerson->prevInPerson = aMac->prevInPerson;
+    else p->lastMac = aMac->prevInPerson;
+    aMac->nextInPerson = NULL;
+    aMac->prevInPerson = NULL;
+    aMac->person.reset();
+    p->macCount--;
+    if (p->macCount==0) {
+      mPersons.erase(p);
+      mEvictedPersons++;
+    }
+  }
+  mMacs.erase(aMac->mac);
+  mEvictedMacs++;
+  logRemoval("delmac", macAddressToString(aMac->mac, ':'));
+}
+
+
+void WifiTrack::evictSsid(WTSSidPtr aSSid)
+{
+  mSsids.erase(aSSid->ssid);
+  mSsidById[aSSid->id].reset(); // ids are not reused
+  mEvictedSsids++;
+  logRemoval("delssid", aSSid->ssid);
+}
+
+
+void WifiTrack::logRemoval(const char *aWhat, const string aKey)
+{
+  // written right away, so it precedes entries for objects re-created later with the same key
+  if (!mChangeLog) return;
+  JsonObjectPtr e = JsonObject::newObj();
+  e->add(aWhat, JsonObject::newString(aKey));
+  appendChange(e);
 }
 
 
 void WifiTrack::processSighting(WTMacPtr aMac, WTSSidPtr aSSid, bool aNewSSidForMac)
 {
-  WTPersonPtr person = aMac->person; // default to already existing, if any
+  FEATURE_STALL_GUARD;
+  WTPersonPtr person = personOf(aMac); // default to already existing, if any
   // log
   if (FOCUSOLOGENABLED) {
     string s;
     const char* sep = "";
-    for (WTSSidSet::iterator pos = aMac->ssids.begin(); pos!=aMac->ssids.end(); ++pos) {
-      string sstr = (*pos)->ssid;
+    for (WTSSidIdList::iterator pos = aMac->ssids.begin(); pos!=aMac->ssids.end(); ++pos) {
+      WTSSidPtr ssid = mSsidById[*pos];
+      string sstr = ssid->ssid;
       if (sstr.empty()) sstr = "<undefined>";
-      string_format_append(s, "%s%s (%ld)", sep, sstr.c_str(), (*pos)->seenCount);
+      string_format_append(s, "%s%s (%ld)", sep, sstr.c_str(), ssid->seenCount);
       sep = ", ";
     }
     FOCUSOLOG(
       "Sighted%s: MAC=%s, %s (%ld), RSSI=%d,%d,%d : %s",
       person ? " and already has person" : "",
       macAddressToString(aMac->mac,':').c_str(),
-      nonNullCStr(aMac->ouiName),
+      nonNullCStr(ouiNameOf(aMac)),
       aMac->seenCount,
       aMac->worstRssi, aMac->lastRssi, aMac->bestRssi,
       s.c_str()
@@ -1107,35 +2842,27 @@ void WifiTrack::processSighting(WTMacPtr aMac, WTSSidPtr aSSid, bool aNewSSidFor
   if (aNewSSidForMac && aSSid->macs.size()<mTooCommonMacCount) {
     // a new SSID for this Mac, not too commonly used
     FOCUSOLOG("- not too common (only %lu MACs)", aSSid->macs.size());
-    WTMacSet relatedMacs;
-    WTMacPtr mostCommonMac;
+    std::vector<WTMacPtr> relatedMacs;
     WTPersonPtr mostProbablePerson;
     if (aMac->ssids.size()>=mMinCommonSsidCount) {
       // has enough ssids overall -> try to find related MACs
       // - search all macs that know the new ssid
       int maxCommonSsids = 0;
-      for (WTMacSet::iterator mpos = aSSid->macs.begin(); mpos!=aSSid->macs.end(); ++mpos) {
+      for (WTMacList::iterator mpos = aSSid->macs.begin(); mpos!=aSSid->macs.end(); ++mpos) {
         // - see how many other ssids this mac shares with the other one
         if (*mpos==aMac) continue; // avoid comparing with myself!
-        if ((*mpos)->ssids.size()<mMinCommonSsidCount) continue; // shortcut, candidate does not have enough ssids to possibly match at all -> next
-        int commonSsids = 1; // we have at least aSSid in common by definition when we get here!
-        for (WTSSidSet::iterator spos = (*mpos)->ssids.begin(); spos!=(*mpos)->ssids.end(); ++spos) {
-          if (*spos==aSSid) continue; // shortcut, we know that we have aSSid in common
-  //        if ((*spos)->macs.size()>=tooCommonMacCount) continue; // this is a too common ssid, don't count (maybe we still should %%%)
-          if (aMac->ssids.find(*spos)!=aMac->ssids.end()) {
-            commonSsids++;
-          }
-        }
+        int commonSsids = mPairIndex.count(macPairKey(*aMac, **mpos)); // includes aSSid by definition
         if (commonSsids<mMinCommonSsidCount) continue; // not a candidate
         OLOG(LOG_INFO, "- This MAC %s has %d SSIDs in common with %s -> link to same person",
           macAddressToString(aMac->mac,':').c_str(),
           commonSsids,
           macAddressToString((*mpos)->mac,':').c_str()
         );
-        relatedMacs.insert(*mpos); // is a candidate
+        relatedMacs.push_back(*mpos); // is a candidate
         if (commonSsids>maxCommonSsids) {
-          mostCommonMac = *mpos; // this is the mac with most common ssids
-          if (mostCommonMac->person) mostProbablePerson = mostCommonMac->person; // this is the person of the mac with the most common ssids -> most likely the correct one
+          maxCommonSsids = commonSsids;
+          WTPersonPtr p = personOf(*mpos);
+          if (p) mostProbablePerson = p; // this is the person of the mac with the most common ssids -> most likely the correct one
         }
       }
     }
@@ -1143,73 +2870,43 @@ void WifiTrack::processSighting(WTMacPtr aMac, WTSSidPtr aSSid, bool aNewSSidFor
     if (!person) {
       if (mostProbablePerson) {
         person = mostProbablePerson;
+        addMacToPerson(aMac, person);
+        OLOG(LOG_NOTICE, "+++ MAC %s, %s via '%s' (just sighted) -> now linked to person '%s' (%d/%s), MACs=%lu",
+          macAddressToString(aMac->mac,':').c_str(),
+          nonNullCStr(ouiNameOf(aMac)),
+          aSSid->ssid.c_str(),
+          person->name.c_str(),
+          person->imageIndex,
+          pixelToWebColor(person->color, true).c_str(),
+          person->macCount
+        );
       }
       else {
         // none of the related macs has a person, or we have no related macs at all -> we need to create a person
-        person = WTPersonPtr(new WTPerson);
+        person = newPerson();
         mPersons.insert(person);
         person->imageIndex = rand() % mNumPersonImages;
         person->color = hsbToPixel(rand() % 360);
         // link to this mac (without logging, as this happens for every new Mac seen)
-        aMac->person = person;
-        person->macs.insert(aMac);
+        addMacToPerson(aMac, person);
       }
     }
-    if (person) {
-      // assign to all macs found related
-      if (person->macs.insert(aMac).second) {
-        OLOG(LOG_NOTICE, "+++ MAC %s, %s via '%s' (just sighted) -> now linked to person '%s' (%d/%s), MACs=%lu",
-          macAddressToString(aMac->mac,':').c_str(),
-          nonNullCStr(aMac->ouiName),
-          aSSid->ssid.c_str(),
+    // link all macs found related
+    for (std::vector<WTMacPtr>::iterator mpos = relatedMacs.begin(); mpos!=relatedMacs.end(); ++mpos) {
+      WTPersonPtr otherPerson = personOf(*mpos);
+      if (!otherPerson) {
+        addMacToPerson(*mpos, person);
+        OLOG(LOG_NOTICE, "+++ Found other MAC %s, %s related -> now linked to person '%s' (%d/%s), MACs=%lu",
+          macAddressToString((*mpos)->mac,':').c_str(),
+          nonNullCStr(ouiNameOf(*mpos)),
           person->name.c_str(),
           person->imageIndex,
           pixelToWebColor(person->color, true).c_str(),
-          person->macs.size()
+          person->macCount
         );
       }
-      for (WTMacSet::iterator mpos = relatedMacs.begin(); mpos!=relatedMacs.end(); ++mpos) {
-        WTPersonPtr oldPerson = (*mpos)->person;
-        if (oldPerson && oldPerson!=person) {
-          oldPerson->macs.erase(*mpos); // remove this mac from the person
-          if (oldPerson->macs.size()==0) {
-            mPersons.erase(oldPerson); // delete person with zero macs assigned
-            if (oldPerson->seenFirst<person->seenFirst && !oldPerson->hidden && oldPerson->shownLast!=Never) {
-              // now orphaned person was older -> clone its appearance to maintain continuity as much as possible
-              person->color = oldPerson->color;
-              person->imageIndex = oldPerson->imageIndex;
-              person->name = oldPerson->name;
-              person->seenCount += oldPerson->seenCount; // cumulate count
-              person->seenFirst = oldPerson->seenFirst; // inherit age
-              if (person->bestRssi<oldPerson->bestRssi) person->bestRssi = oldPerson->bestRssi;
-              if (person->worstRssi>oldPerson->worstRssi) person->worstRssi = oldPerson->worstRssi;
-              OLOG(LOG_NOTICE, "--- Using older appearance '%s' (%d/%s) for new combined person from now on",
-                oldPerson->name.c_str(),
-                oldPerson->imageIndex,
-                pixelToWebColor(oldPerson->color, true).c_str()
-              );
-            }
-            else {
-              OLOG(LOG_NOTICE, "--- Person '%s' (%d/%s) not linked to a MAC any more -> deleted",
-                oldPerson->name.c_str(),
-                oldPerson->imageIndex,
-                pixelToWebColor(oldPerson->color, true).c_str()
-              );
-            }
-          }
-        }
-        // assign new person
-        (*mpos)->person = person;
-        if (person->macs.insert(*mpos).second) {
-          OLOG(LOG_NOTICE, "+++ Found other MAC %s, %s related -> now linked to person '%s' (%d/%s), MACs=%lu",
-            macAddressToString((*mpos)->mac,':').c_str(),
-            nonNullCStr((*mpos)->ouiName),
-            person->name.c_str(),
-            person->imageIndex,
-            pixelToWebColor(person->color, true).c_str(),
-            person->macs.size()
-          );
-        }
+      else if (otherPerson!=person) {
+        person = mergePersons(person, otherPerson);
       }
     }
   }
@@ -1222,15 +2919,16 @@ void WifiTrack::processSighting(WTMacPtr aMac, WTSSidPtr aSSid, bool aNewSSidFor
     if (person->bestRssi<person->lastRssi) person->bestRssi = person->lastRssi;
     if (person->worstRssi>person->lastRssi) person->worstRssi = person->lastRssi;
     if (person->seenFirst==Never) person->seenFirst = person->seenLast;
+    markDirty(person);
     OLOG(person->hidden || aMac->hidden ? LOG_DEBUG : LOG_INFO, "=== Recognized person%s, '%s', (%d/%s), linked MACs=%lu, via ssid='%s', MAC=%s, %s%s (%d, best: %d)",
       person->hidden ? " (hidden)" : "",
       person->name.c_str(),
       person->imageIndex,
       pixelToWebColor(person->color, true).c_str(),
-      person->macs.size(),
+      person->macCount,
       aSSid->ssid.c_str(),
       macAddressToString(aMac->mac,':').c_str(),
-      nonNullCStr(aMac->ouiName),
+      nonNullCStr(ouiNameOf(aMac)),
       aMac->hidden ? " (hidden)" : "",
       aMac->lastRssi,
       aMac->bestRssi
@@ -1243,11 +2941,12 @@ void WifiTrack::processSighting(WTMacPtr aMac, WTSSidPtr aSSid, bool aNewSSidFor
         // pick SSID with the least mac links as most relevant (because: unique) name
         long minMacs = 999999999;
         WTSSidPtr relevantSSid;
-        for (WTMacSet::iterator mpos = person->macs.begin(); mpos!=person->macs.end(); ++mpos) {
-          for (WTSSidSet::iterator spos = (*mpos)->ssids.begin(); spos!=(*mpos)->ssids.end(); ++spos) {
-            if (!(*spos)->hidden && (*spos)->macs.size()<minMacs && !(*spos)->ssid.empty()) {
-              minMacs = (*spos)->macs.size();
-              relevantSSid = (*spos);
+        for (WTMac *m = person->firstMac; m; m = m->nextInPerson) {
+          for (WTSSidIdList::iterator spos = m->ssids.begin(); spos!=m->ssids.end(); ++spos) {
+            WTSSidPtr ssid = mSsidById[*spos];
+            if (!ssid->hidden && ssid->macs.size()<minMacs && !ssid->ssid.empty()) {
+              minMacs = ssid->macs.size();
+              relevantSSid = ssid;
             }
           }
         }
@@ -1264,27 +2963,15 @@ void WifiTrack::processSighting(WTMacPtr aMac, WTSSidPtr aSSid, bool aNewSSidFor
           person->imageIndex,
           pixelToWebColor(person->color, true).c_str(),
           macAddressToString(aMac->mac,':').c_str(),
-          nonNullCStr(aMac->ouiName),
+          nonNullCStr(ouiNameOf(aMac)),
           aSSid->ssid.c_str(),
           person->lastRssi,
           person->bestRssi
         );
-        displayEncounter("hi", person->imageIndex, person->color, nameToShow!=aSSid->ssid ? nameToShow : "", nonNullCStr(aMac->ouiName), aSSid->ssid);
+        displayEncounter("hi", person->imageIndex, person->color, nameToShow!=aSSid->ssid ? nameToShow : "", nonNullCStr(ouiNameOf(aMac)), aSSid->ssid);
       }
     }
   }
-  // check for regular saves
-  MLMicroSeconds now = MainLoop::now();
-  if (mSaveTempInterval!=Never && now>mLastTempAutoSave+mSaveTempInterval) {
-    mLastTempAutoSave = now;
-    OLOG(LOG_NOTICE,">>> auto-saving data to temp file")
-    save(Application::sharedApplication()->tempPath(WIFITRACK_STATE_FILE_NAME));
-  }
-  if (mSaveDataInterval!=Never && now>mLastDataAutoSave+mSaveDataInterval) {
-    mLastDataAutoSave = now;
-    OLOG(LOG_NOTICE,">>> auto-saving data to (persistent) data file")
-    save(Application::sharedApplication()->dataPath(WIFITRACK_STATE_FILE_NAME));
-  }
 }
 
 
@@ -1339,23 +3026,14 @@ void WifiTrack::displayEncounter(string aIntro, int aImageIndex, PixelColor aCol
     personinfo->add("HASTARGET", JsonObject::newString(aTarget.size()>0 ? "1" : "0"));
     personinfo->add("TARGET", JsonObject::newString(aTarget));
     message->add("personinfo", personinfo);
-    #if IN_THREAD
-    if (mUseThread && mWifiTrackingThread) {
-      // detections runs in separate thread, must notify parent thread
-      pthread_mutex_lock(&mReportMutex);
-      mEncounterMessage = message;
-      pthread_mutex_unlock(&mReportMutex);
-      mWifiTrackingThread->signalParentThread(threadSignalUserSignal);
-      return;
-    }
-    #endif // IN_THREAD
-    sendEventMessage(message);
+    postEvent(message);
   }
 }
 
 
 bool WifiTrack::needContentHandler()
 {
+  FEATURE_STALL_GUARD;
   if (!mLoadingContent) {
     mLoadingContent = true;
     FOCUSOLOG("Display needs content - calling wifipause script");
@@ -1375,11 +3053,219 @@ void WifiTrack::contentLoaded()
 }
 
 
+void WifiTrack::eventSubscriptionsChanged()
+{
+  // evaluated here in the main thread, the aggregation thread must not walk the API's connections
+  mSightingEventsWanted = eventWanted("sighting");
+}
+
+
+// MARK: ==== command line tools
+
+static ErrorPtr readFile(const string aPath, string &aContents)
+{
+  FILE *f = fopen(aPath.c_str(), "r");
+  if (!f) return SysError::errNo();
+  char buf[16384];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f))>0) aContents.append(buf, n);
+  fclose(f);
+  return ErrorPtr();
+}
+
+
 ErrorPtr WifiTrack::runTool()
 {
-  // FIXME: tdb
-  #warning tbd
-  return TextError::err("Not yet implemented");
+  CmdLineApp *a = CmdLineApp::sharedCmdLineApp();
+  string tool;
+  string input;
+  if (!a->getStringOption("wifitool", tool)) {
+    return TextError::err("missing --wifitool <toolname>");
+  }
+  if (!a->getStringOption("wifitoolinput", input)) {
+    return TextError::err("missing --wifitoolinput <file>");
+  }
+  string output;
+  a->getStringOption("wifitooloutput", output);
+  if (tool=="parsebench") return parseBenchmark(input);
+  if (tool=="replay") return replayTool(input, output);
+  if (tool=="ouitable") return ouiTableTool(input, output);
+  return TextError::err("unknown wifitool '%s'", tool.c_str());
+}
+
+
+ErrorPtr WifiTrack::ouiTableTool(const string aSource, const string aOutput)
+{
+  if (aOutput.empty()) return TextError::err("missing --wifitooloutput <file>");
+  size_t entries = 0;
+  size_t names = 0;
+  ErrorPtr err = WTOuiTable::generate(aSource, aOutput, &entries, &names);
+  if (Error::notOK(err)) return err;
+  // verify by opening it
+  WTOuiTable table;
+  err = table.open(aOutput);
+  if (Error::notOK(err)) return err;
+  printf("OUI table %s generated from %s\n", aOutput.c_str(), aSource.c_str());
+  printf("- entries: %zu, distinct names: %zu\n", entries, names);
+  // lookup speed, for pseudo random MACs
+  const long lookups = 1000000;
+  long found = 0;
+  uint64_t mac = 0x0123456789ABULL;
+  MLMicroSeconds t = MainLoop::now();
+  for (long i=0; i<lookups; i++) {
+    mac = (mac*6364136223846793005ULL+1442695040888963407ULL) & 0xFFFFFFFFFFFFULL;
+    if (table.lookup(mac & 0xFCFFFFFFFFFFULL)) found++; // globally administered unicast only
+  }
+  MLMicroSeconds elapsed = MainLoop::now()-t;
+  printf("- lookup: %.1f nS (%ld of %ld random MACs found)\n", (double)elapsed*1000/lookups, found, lookups);
+  return Error::ok();
+}
+
+
+#define BENCHMARK_MIN_TIME (2*Second)
+
+ErrorPtr WifiTrack::parseBenchmark(const string aTcpdumpLog)
+{
+  // load entire log, and index lines
+  string log;
+  ErrorPtr err = readFile(aTcpdumpLog, log);
+  if (Error::notOK(err)) return err;
+  std::vector<size_t> lineStarts;
+  size_t pos = 0;
+  while (pos<log.size()) {
+    lineStarts.push_back(pos);
+    pos = log.find('\n', pos);
+    if (pos==string::npos) pos = log.size();
+    pos++;
+  }
+  lineStarts.push_back(log.size()+1);
+  size_t numLines = lineStarts.size()-1;
+  if (numLines==0) return TextError::err("no lines in '%s'", aTcpdumpLog.c_str());
+  // parse repeatedly until minimal benchmark time has passed
+  long probes = 0;
+  long beacons = 0;
+  long passes = 0;
+  long checksum = 0; // prevents optimizing away the results
+  MLMicroSeconds started = MainLoop::now();
+  MLMicroSeconds elapsed;
+  do {
+    probes = 0;
+    beacons = 0;
+    for (size_t i=0; i<numLines; i++) {
+      WTSighting sighting;
+      if (WTFrameDecoder::parseTcpdumpLine(log.c_str()+lineStarts[i], lineStarts[i+1]-lineStarts[i]-1, true, sighting)) {
+        if (sighting.beacon) beacons++; else probes++;
+        checksum += sighting.rssi + sighting.ssidLen + (long)(sighting.mac & 0xFF);
+      }
+    }
+    passes++;
+    elapsed = MainLoop::now()-started;
+  } while (elapsed<BENCHMARK_MIN_TIME);
+  double totalLines = (double)numLines*passes;
+  printf("tcpdump line parser benchmark: %s\n", aTcpdumpLog.c_str());
+  printf("- lines: %zu (%ld probe requests, %ld beacons, %zu other), %zu bytes\n", numLines, probes, beacons, numLines-probes-beacons, log.size());
+  printf("- passes: %ld in %.3f seconds (checksum %ld)\n", passes, (double)elapsed/Second, checksum);
+  printf("- per line: %.1f nS\n", (double)elapsed*1000/totalLines);
+  printf("- throughput: %.0f lines/S, %.1f MB/S\n", totalLines*Second/elapsed, (double)log.size()*passes/elapsed);
+  return Error::ok();
+}
+
+ErrorPtr WifiTrack::replayTool(const string aInput, const string aOutput)
+{
+  ErrorPtr err;
+  WTPcapFile pcap;
+  string log;
+  bool isPcap = Error::isOK(pcap.open(aInput));
+  if (!isPcap) {
+    // must be a tcpdump text log then
+    err = readFile(aInput, log);
+    if (Error::notOK(err)) return err;
+  }
+  // prepare
+  if (mOuiNames) loadOUIs(false);
+  mSaveTempInterval = Never; // no autosaving during replay
+  mSaveDataInterval = Never;
+  mMeasureAggregation = true;
+  mAggregationTime = 0;
+  // simulated time: packet timestamps are converted to mainloop time, so dumps show the original times
+  MLMicroSeconds unixTimeOffset = MainLoop::unixtime()-MainLoop::now();
+  // - tcpdump logs only have the time of day, which we assume to be today
+  time_t t = (time_t)(MainLoop::unixtime()/Second);
+  struct tm tm;
+  localtime_r(&t, &tm);
+  tm.tm_hour = 0; tm.tm_min = 0; tm.tm_sec = 0;
+  MLMicroSeconds midnight = (MLMicroSeconds)mktime(&tm)*Second-unixTimeOffset;
+  MLMicroSeconds lastTimeOfDay = Never;
+  MLMicroSeconds firstTs = Never;
+  MLMicroSeconds lastTs = Never;
+  // replay
+  long packets = 0;
+  long probes = 0;
+  long beacons = 0;
+  MLMicroSeconds decodeTime = 0;
+  MLMicroSeconds recordTime = 0;
+  MLMicroSeconds started = MainLoop::now();
+  const char *lp = log.c_str();
+  const char *logEnd = lp+log.size();
+  while (true) {
+    MLMicroSeconds t0 = MainLoop::now();
+    WTSighting sighting;
+    bool decoded;
+    if (isPcap) {
+      const uint8_t *data;
+      size_t len;
+      MLMicroSeconds ts;
+      if (!pcap.nextPacket(data, len, ts)) break;
+      decoded = WTFrameDecoder::decodePacket(pcap.linkType(), data, len, sighting);
+      sighting.timestamp = ts-unixTimeOffset;
+    }
+    else {
+      if (lp>=logEnd) break;
+      const char *le = (const char *)memchr(lp, '\n', logEnd-lp);
+      if (!le) le = logEnd;
+      decoded = WTFrameDecoder::parseTcpdumpLine(lp, le-lp, mScanBeacons, sighting);
+      // - HH:MM:SS.uuuuuu at the beginning of the line
+      int h, m, sec, us;
+      if (decoded && sscanf(lp, "%d:%d:%d.%d", &h, &m, &sec, &us)==4) {
+        MLMicroSeconds tod = (((MLMicroSeconds)h*60+m)*60+sec)*Second+us;
+        if (lastTimeOfDay!=Never && tod<lastTimeOfDay-Hour) midnight += Day; // wrapped past midnight
+        lastTimeOfDay = tod;
+        sighting.timestamp = midnight+tod;
+      }
+      else {
+        sighting.timestamp = lastTs!=Never ? lastTs : MainLoop::now();
+      }
+      lp = le+1;
+    }
+    packets++;
+    MLMicroSeconds t1 = MainLoop::now();
+    decodeTime += t1-t0;
+    if (!decoded || (sighting.beacon && !mScanBeacons)) continue;
+    if (sighting.beacon) beacons++; else probes++;
+    if (firstTs==Never) firstTs = sighting.timestamp;
+    lastTs = sighting.timestamp;
+    recordSighting(sighting);
+    recordTime += MainLoop::now()-t1;
+  }
+  MLMicroSeconds elapsed = MainLoop::now()-started;
+  mMeasureAggregation = false;
+  if (elapsed<=0) elapsed = 1;
+  // report
+  printf("wifitrack replay of %s (%s)\n", aInput.c_str(), isPcap ? "pcap" : "tcpdump log");
+  printf("- packets: %ld (%ld probe requests, %ld beacons, %ld other/undecodable)\n", packets, probes, beacons, packets-probes-beacons);
+  printf("- simulated time span: %.1f seconds\n", firstTs==Never ? 0.0 : (double)(lastTs-firstTs)/Second);
+  printf("- processing time: %.3f seconds, %.0f packets/S\n", (double)elapsed/Second, (double)packets*Second/elapsed);
+  printf("- read/decode: %.3f seconds (%.0f nS/packet)\n", (double)decodeTime/Second, packets ? (double)decodeTime*1000/packets : 0.0);
+  printf("- record sightings: %.3f seconds (%.0f nS/sighting)\n", (double)(recordTime-mAggregationTime)/Second, probes+beacons ? (double)(recordTime-mAggregationTime)*1000/(probes+beacons) : 0.0);
+  printf("- person aggregation: %.3f seconds (%.0f nS/probe request)\n", (double)mAggregationTime/Second, probes ? (double)mAggregationTime*1000/probes : 0.0);
+  printf("- result: %zu persons, %zu MACs, %zu SSIDs\n", mPersons.size(), mMacs.size(), mSsids.size());
+  printf("- randomized MACs: %ld collapsed into proxy MACs, %zu ephemeral records\n", mCollapsedMacs, mEphemeralMacs.size());
+  if (!aOutput.empty()) {
+    err = dataDump()->saveToFile(aOutput.c_str());
+    if (Error::notOK(err)) return err;
+    printf("- state saved to %s\n", aOutput.c_str());
+  }
+  return Error::ok();
 }
 
 #endif // ENABLE_FEATURE_WIFITRACK
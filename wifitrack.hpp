@@ -27,6 +27,11 @@
 
 #include "p44view.hpp"
 #include "dispmatrix.hpp"
+#include "wificapture.hpp"
+#include "wtstore.hpp"
+#include "wtqueue.hpp"
+#include "wtsnapshot.hpp"
+#include "wtoui.hpp"
 
 #include <math.h>
 #include <set>
@@ -42,15 +47,14 @@ namespace p44 {
   class WTPerson;
   typedef boost::intrusive_ptr<WTPerson> WTPersonPtr;
 
-  typedef std::map<uint64_t, WTMacPtr> WTMacMap;
-  typedef std::map<string, WTSSidPtr> WTSSidMap;
-
-  typedef std::set<WTMacPtr> WTMacSet;
-  typedef std::set<WTSSidPtr> WTSSidSet;
+  typedef std::vector<WTMacPtr> WTMacList; ///< list of MACs sorted by MAC id
+  typedef std::vector<uint32_t> WTSSidIdList; ///< sorted list of SSID ids
   typedef std::set<WTPersonPtr> WTPersonSet;
 
 
   typedef std::map<uint32_t, const char*> OUIMap;
+  typedef std::map<uint32_t, string> OUIHotMap; ///< oui24 -> vendor name
+  typedef std::map<string, const char*> OUINameMap;
 
 
 
@@ -60,6 +64,7 @@ namespace p44 {
 
     WTMac();
 
+    uint32_t id; ///< dense id, used to form MAC pair keys
     MLMicroSeconds seenLast;
     MLMicroSeconds seenFirst;
     long seenCount;
@@ -67,11 +72,24 @@ namespace p44 {
     int bestRssi;
     int worstRssi;
     uint64_t mac;
-    const char *ouiName;
+    const char *ouiName; ///< vendor name, might be preliminary (from hot OUI cache) as long as ouiResolved is not set
+    bool ouiResolved; ///< set when ouiName was looked up in the full OUI table
     bool hidden;
+    bool dirty; ///< changed since last written to the change log
+    bool proxy; ///< represents a device using randomized MACs (collapsed by SSID fingerprint)
+
+    WTSSidIdList ssids; ///< ids of the SSIDs probed by this MAC
+    WTPersonPtr person; ///< person, might be one that was merged into another person since, use WifiTrack::personOf()
+    WTMac *nextInPerson; ///< next MAC of the same person
+    WTMac *prevInPerson; ///< previous MAC of the same person
+
+    /// @param aSsidId SSID id
+    /// @return true if this MAC has probed for the SSID
+    bool hasSsid(uint32_t aSsidId) const;
 
-    WTSSidSet ssids;
-    WTPersonPtr person;
+    /// @param aSsidId SSID id to add
+    /// @return true if SSID was new for this MAC
+    bool addSsid(uint32_t aSsidId);
   };
 
 
@@ -81,17 +99,86 @@ namespace p44 {
 
     WTSSid();
 
+    uint32_t id; ///< dense id, index into WifiTrack::mSsidById
     MLMicroSeconds seenLast;
     long seenCount;
     string ssid;
     bool hidden;
+    bool dirty; ///< changed since last written to the change log
 
     int beaconRssi;
     MLMicroSeconds beaconSeenLast;
 
-    WTMacSet macs;
+    WTMacList macs; ///< MACs that have probed for this SSID. As MAC ids are increasing, new MACs are usually appended
+
+    /// @param aMac MAC to add
+    /// @return true if MAC was new for this SSID
+    bool addMac(WTMacPtr aMac);
+
+    /// @param aMac MAC to remove
+    /// @return true if MAC was linked to this SSID
+    bool removeMac(WTMacPtr aMac);
+
+  };
+
+
+  /// key operations for storing WTMacs in a HashStore, keyed by MAC address
+  struct WTMacKeyOps
+  {
+    typedef uint64_t Key;
+    static Key key(const WTMac &aMac) { return aMac.mac; }
+    static uint32_t hash(const Key &aKey) { return hashUInt64(aKey); }
+    static bool matches(const WTMac &aMac, const Key &aKey) { return aMac.mac==aKey; }
+    static bool less(const WTMac &aA, const WTMac &aB) { return aA.mac<aB.mac; }
+  };
+  typedef HashStore<WTMac, WTMacKeyOps> WTMacStore;
+
+
+  /// short-lived record of a randomized (locally administered) MAC, mapping it to its proxy WTMac
+  class WTEphemeralMac : public P44Obj
+  {
+  public:
+
+    WTEphemeralMac() : mac(0), seenLast(Never) {};
+
+    uint64_t mac;
+    MLMicroSeconds seenLast;
+    WTMacPtr proxy; ///< the MAC representing the device, NULL as long as no identifying SSID was seen
+
+  };
+  typedef boost::intrusive_ptr<WTEphemeralMac> WTEphemeralMacPtr;
+
+  /// key operations for storing WTEphemeralMacs in a HashStore, keyed by MAC address
+  struct WTEphemeralMacKeyOps
+  {
+    typedef uint64_t Key;
+    static Key key(const WTEphemeralMac &aMac) { return aMac.mac; }
+    static uint32_t hash(const Key &aKey) { return hashUInt64(aKey); }
+    static bool matches(const WTEphemeralMac &aMac, const Key &aKey) { return aMac.mac==aKey; }
+    static bool less(const WTEphemeralMac &aA, const WTEphemeralMac &aB) { return aA.mac<aB.mac; }
+  };
+  typedef HashStore<WTEphemeralMac, WTEphemeralMacKeyOps> WTEphemeralMacStore;
+
+
+  /// SSID lookup key, allows looking up SSIDs without constructing a string
+  struct WTSSidKey
+  {
+    const char *str;
+    size_t len;
+    WTSSidKey(const char *aStr, size_t aLen) : str(aStr), len(aLen) {};
+    WTSSidKey(const string &aStr) : str(aStr.c_str()), len(aStr.size()) {};
+  };
 
+  /// key operations for storing WTSSids in a HashStore, keyed by SSID
+  struct WTSSidKeyOps
+  {
+    typedef WTSSidKey Key;
+    static Key key(const WTSSid &aSSid) { return WTSSidKey(aSSid.ssid); }
+    static uint32_t hash(const Key &aKey) { return hashBytes(aKey.str, aKey.len); }
+    static bool matches(const WTSSid &aSSid, const Key &aKey) { return aSSid.ssid.size()==aKey.len && memcmp(aSSid.ssid.c_str(), aKey.str, aKey.len)==0; }
+    static bool less(const WTSSid &aA, const WTSSid &aB) { return aA.ssid<aB.ssid; }
   };
+  typedef HashStore<WTSSid, WTSSidKeyOps> WTSSidStore;
 
 
 
@@ -101,6 +188,7 @@ namespace p44 {
 
     WTPerson();
 
+    uint32_t id; ///< unique (but not persistent) id, used as cursor for paged dumps
     MLMicroSeconds seenLast;
     MLMicroSeconds seenFirst;
     long seenCount;
@@ -112,10 +200,14 @@ namespace p44 {
     int imageIndex;
     string name;
     bool hidden;
+    bool dirty; ///< changed since last written to the change log
 
     MLMicroSeconds shownLast;
 
-    WTMacSet macs;
+    WTPersonPtr mergedInto; ///< set when this person was merged into another one (disjoint set forest)
+    WTMac *firstMac; ///< list of MACs of this person (only valid for non-merged persons)
+    WTMac *lastMac;
+    size_t macCount;
 
   };
 
@@ -127,20 +219,35 @@ namespace p44 {
     typedef Feature inherited;
 
     string mMonitorIf;
+    bool mNativeCapture; ///< if set, frames are captured and decoded directly rather than via tcpdump
+    WTPacketSocket mCapture; ///< native capture
+    string mPcapFile; ///< if set, packets are replayed from this pcap file instead of being captured
+    WTPcapFile mPcapReplay;
+    MLTicket mReplayTicket;
     int mDumpPid;
     FdCommPtr mDumpStream;
+    #define DUMP_BUFFER_SIZE 4096 ///< max length of a tcpdump line
+    char mDumpBuffer[DUMP_BUFFER_SIZE+1]; ///< tcpdump output is parsed in place here (+1 for terminator)
+    size_t mDumpBufferFill;
+    bool mDumpLineOverflow; ///< set when skipping a too long line
 
     MLTicket mRestartTicket;
 
-    WTMacMap mMacs;
-    WTSSidMap mSsids;
+    WTMacStore mMacs;
+    WTSSidStore mSsids;
+    std::vector<WTSSidPtr> mSsidById; ///< all SSIDs, by id
+    uint32_t mNextMacId;
+    uint32_t mNextPersonId;
+    WTPairCounter mPairIndex; ///< number of shared (not too common) SSIDs per MAC pair
     WTPersonSet mPersons;
 
-    OUIMap mOuis;
+    OUIMap mOuis; ///< OUIs from oui.txt, only used when there is no precompiled table
+    WTOuiTable mOuiTable; ///< precompiled OUI table (oui.bin)
 
     // settings
     bool mOuiNames;
     bool mReportSightings;
+    std::atomic<bool> mSightingEventsWanted; ///< cached eventWanted("sighting"), as recordSighting() might run outside the main thread
     bool mAggregatePersons;
     bool mRememberWithoutSsid;
     MLMicroSeconds mMinShowInterval;
@@ -160,21 +267,88 @@ namespace p44 {
     MLMicroSeconds mLastTempAutoSave;
     MLMicroSeconds mLastDataAutoSave;
 
+    // incremental persistence: snapshot + append-only change log
+    uint32_t mGeneration; ///< generation of the current change log (a snapshot of generation N is followed by log N)
+    FILE *mChangeLog; ///< current change log, opened for appending
+    long mChangeLogBytes; ///< current size of the change log
+    long mSnapshotBytes; ///< size of the last snapshot written
+    bool mCompactionWanted; ///< set when a new snapshot should be written as soon as possible
+    std::vector<WTSSidPtr> mDirtySsids; ///< SSIDs to write to the change log
+    std::vector<WTMacPtr> mDirtyMacs; ///< MACs to write to the change log
+    std::vector<WTPersonPtr> mDirtyPersons; ///< persons to write to the change log
+    WTSnapshotWriter mSnapshotWriter; ///< snapshot being written in chunks
+    bool mSnapshotCompaction; ///< set if snapshot being written replaces older change logs
+    int mSnapshotPhase; ///< 0=ssids, 1=macs, 2=persons
+    size_t mSnapshotIdx; ///< next object to write in current phase
+    std::vector<WTSSidPtr> mSnapshotSsids; ///< SSIDs that existed when snapshot was started
+    std::vector<WTMacPtr> mSnapshotMacs; ///< MACs that existed when snapshot was started
+    std::vector<uint32_t> mSnapshotMacIdx; ///< MAC id -> index in mSnapshotMacs
+    std::vector<WTPersonPtr> mSnapshotPersons; ///< persons that existed when snapshot was started
+    MLTicket mSnapshotTicket;
+    MLTicket mAutoSaveTicket; ///< autosaving always runs in the main thread
+
     bool mDirectDisplay; ///< if set, local dispmatrix is used for display
     bool mApiNotify; ///< if set, send persons back to feature API client
     DispMatrixPtr mDisp;
     bool mLoadingContent;
 
+    bool mMeasureAggregation; ///< if set, time spent in processSighting() is accumulated in mAggregationTime
+    MLMicroSeconds mAggregationTime;
+
+    // aging and eviction
+    int mMaxMemory; ///< memory budget in kB for tracking data (estimated), 0=unlimited
+    MLMicroSeconds mMaxMacAge; ///< MACs not seen for longer than this are evicted, 0=never
+    MLMicroSeconds mEvictMinAge; ///< MACs and SSIDs seen more recently than this are never evicted
+    MLMicroSeconds mLastEvictionCheck;
+    long mEvictedMacs;
+    long mEvictedSsids;
+    long mEvictedPersons;
+
+    // randomized MACs
+    bool mCollapseRandomMacs; ///< if set, randomized MACs are collapsed into proxy MACs
+    MLMicroSeconds mEphemeralTTL; ///< how long a randomized MAC is remembered after it was last seen
+    WTEphemeralMacStore mEphemeralMacs; ///< recently seen randomized MACs
+    MLMicroSeconds mLastEphemeralPrune;
+    long mCollapsedMacs; ///< number of randomized MACs collapsed into proxies
+
+    // NDJSON export
+    FILE *mExportFile;
+    string mExportPath;
+    bool mExportOUINames;
+    int mExportPhase; ///< 0=SSIDs, 1=MACs, 2=persons
+    size_t mExportIdx; ///< next object to export in the current phase
+    std::vector<WTSSidPtr> mExportSsids; ///< SSIDs that existed when export was started (NULL for evicted ids)
+    std::vector<WTMacPtr> mExportMacs; ///< MACs that existed when export was started
+    std::vector<WTPersonPtr> mExportPersons; ///< persons that existed when export was started
+    long mExportEntries;
+    MLTicket mExportTicket;
+
+    // OUI loading
+    bool mOuisReady; ///< set when full OUI table (oui.bin or oui.txt) is available
+    OUIHotMap mHotOuis; ///< small cache of vendors seen before, used until full table is ready
+    FILE *mOuiLoadFile; ///< oui.txt being loaded in background
+    OUIMap mLoadingOuis; ///< OUIs loaded so far, moved to mOuis when complete
+    OUINameMap mLoadingOuiNames; ///< distinct names loaded so far
+    MLTicket mOuiLoadTicket;
+
     #if IN_THREAD
     bool mUseThread;
-    ChildThreadWrapperPtr mWifiTrackingThread;
-    JsonObjectPtr mEncounterMessage;
-    pthread_mutex_t mReportMutex;
+    ChildThreadWrapperPtr mWifiTrackingThread; ///< capture and parsing
+    ChildThreadWrapperPtr mAggregationThread; ///< recording sightings and person aggregation
+    ChildThreadWrapper *mAggregationThreadP; ///< for use from within the aggregation thread only
+    std::atomic<int> mRunningThreads; ///< number of thread routines not yet ended
+    WTSpscRing<WTSightingRecord> mSightingQueue; ///< tracking thread -> aggregation thread
+    int mWakeFds[2]; ///< pipe to wake up the aggregation thread when sightings get queued
+    std::atomic<long> mDroppedSightings; ///< sightings lost because aggregation could not keep up
+    WTSpscRing<JsonObjectPtr> mEventQueue; ///< aggregation thread -> main thread
+    std::list<JsonObjectPtr> mPendingEvents; ///< events not yet passed to mEventQueue (aggregation thread only)
+    MLTicket mPendingEventsTicket;
+    pthread_mutex_t mDataMutex; ///< protects tracking data from concurrent access by API (main thread) and aggregation thread
     #endif // IN_THREAD
 
   public:
 
-    WifiTrack(const string aMonitorIf, int aRadiotapDBOffset, bool doStart);
+    WifiTrack(const string aMonitorIf, int aRadiotapDBOffset, bool aNativeCapture, bool doStart);
     virtual ~WifiTrack();
 
     /// reset the feature to uninitialized/re-initializable state
@@ -185,12 +359,6 @@ namespace p44 {
     /// @return error if any, NULL if ok
     virtual ErrorPtr initialize(JsonObjectPtr aInitData) override;
 
-    /// handle request
-    /// @param aRequest the API request to process
-    /// @return NULL to send nothing at return (but possibly later via aRequest->sendResponse),
-    ///   Error::ok() to just send a empty response, or error to report back
-    virtual ErrorPtr processRequest(ApiRequestPtr aRequest) override;
-
     /// @return status information object for initialized feature, bool false for uninitialized
     virtual JsonObjectPtr status() override;
 
@@ -198,34 +366,129 @@ namespace p44 {
     /// @return error if tool fails, ok otherwise
     virtual ErrorPtr runTool() override;
 
+    /// update cached interest in sighting events
+    virtual void eventSubscriptionsChanged() override;
+
   private:
 
     void initOperation();
     void startScanner();
     void restartScanner();
-
-    void loadOUIs();
+    void startTcpdump();
+    void startNativeCapture();
+    void stopNativeCapture();
+    bool captureHandler(int aFD, int aPollFlags);
+    void startPcapReplay();
+    void pcapReplayStep(MLTimer &aTimer);
+
+    void loadOUIs(bool aInBackground);
+    bool loadOUIsStep(int aMaxLines);
+    void ouiLoadStep(MLTimer &aTimer);
+    void ouisReady();
+    void loadHotOUIs();
+    void saveHotOUIs();
     const char* ouiName(uint64_t aMac);
+    const char* ouiNameOf(WTMacPtr aMac);
 
     ErrorPtr save(const string aPath);
     ErrorPtr load(const string aPath);
 
     JsonObjectPtr dataDump(bool aSsids = true, bool aMacs = true, bool aPersons = true, bool aOUINames = false, bool aPersonSsids = false);
+    JsonObjectPtr ssidJson(WTSSidPtr aSSid, MLMicroSeconds aUnixTimeOffset);
+    JsonObjectPtr macJson(WTMacPtr aMac, MLMicroSeconds aUnixTimeOffset, bool aOUIName);
+    JsonObjectPtr personJson(WTPersonPtr aPerson, MLMicroSeconds aUnixTimeOffset, bool aSsids);
     ErrorPtr dataImport(JsonObjectPtr aData);
+    /// get a page of objects in key order, with memory proportional to the page size
+    /// @param aAfterCursor if set, only objects with a key greater than aCursor are returned
+    /// @param aCursor the key of the last object of the previous page
+    /// @param aCount max number of objects to return
+    /// @param aPage will receive the objects
+    void ssidPage(bool aAfterCursor, const string &aCursor, size_t aCount, std::vector<WTSSidPtr> &aPage);
+    void macPage(bool aAfterCursor, uint64_t aCursor, size_t aCount, std::vector<WTMacPtr> &aPage);
+    void personPage(bool aAfterCursor, uint32_t aCursor, size_t aCount, std::vector<WTPersonPtr> &aPage);
+    /// @param aAccumulate if set, counts and time ranges are combined with existing data (merging state files),
+    ///   otherwise values are set (replaying the change log)
+    void importSsid(const string aSsid, JsonObjectPtr aSsidObj, bool aAccumulate, MLMicroSeconds aUnixTimeOffset);
+    void importMac(const string aMac, JsonObjectPtr aMacObj, bool aAccumulate, MLMicroSeconds aUnixTimeOffset);
+    void importPerson(JsonObjectPtr aPersonObj, bool aAccumulate, MLMicroSeconds aUnixTimeOffset);
+
+    string changeLogPath(uint32_t aGeneration);
+    void markDirty(WTSSidPtr aSSid);
+    void markDirty(WTMacPtr aMac);
+    void markDirty(WTPersonPtr aPerson);
+    ErrorPtr loadState();
+    ErrorPtr loadSnapshot(const string aPath);
+    ErrorPtr replayChangeLog(const string aPath, long &aEntries);
+    void openChangeLog();
+    void closeChangeLog();
+    void appendChange(JsonObjectPtr aEntry);
+    void flushChanges();
+    void autoSaveTimer(MLTimer &aTimer);
+    void checkAutoSave();
+    void startSnapshot(const string aPath, bool aCompaction);
+    void snapshotStep(MLTimer &aTimer);
+    void finishSnapshot();
+    void releaseSnapshotObjects();
+    void stopPersistence();
+    void exportStep(MLTimer &aTimer);
+    void endExport(ErrorPtr aError);
 
     void dumpEnded(ErrorPtr aError);
-    void gotDumpLine(ErrorPtr aError);
-
+    void gotDumpData(ErrorPtr aError);
+    void processDumpLine(char *aLine, size_t aLen);
+    void handleSighting(const WTSighting &aSighting);
+    void recordSighting(const WTSighting &aSighting);
+    void postEvent(JsonObjectPtr aMessage);
+
+    WTMacPtr newMac(uint64_t aMac);
+    WTPersonPtr newPerson();
+    WTSSidPtr internSsid(const WTSSidKey &aKey, bool *aNewP = NULL);
+    void addToPairIndex(WTMacPtr aMac, WTSSidPtr aSSid);
+    void rebuildPairIndex();
+    WTPersonPtr personOf(WTMacPtr aMac);
+    void addMacToPerson(WTMacPtr aMac, WTPersonPtr aPerson);
+    WTPersonPtr mergePersons(WTPersonPtr aPerson, WTPersonPtr aOther);
+    WTMacPtr collapsedMac(uint64_t aMac, WTSSidPtr aSSid, MLMicroSeconds aNow);
+    void pruneEphemeralMacs(MLMicroSeconds aNow);
+    size_t memoryEstimate();
+    bool evictable(WTMacPtr aMac, MLMicroSeconds aSeenBefore);
+    void checkEviction(MLMicroSeconds aNow);
+    void evictMac(WTMacPtr aMac, std::vector<WTSSidPtr> *aOrphansP);
+    void evictSsid(WTSSidPtr aSSid);
+    void logRemoval(const char *aWhat, const string aKey);
     void processSighting(WTMacPtr aMac, WTSSidPtr aSSid, bool aNewSSidForMac);
 
+    ErrorPtr dumpCmd(ApiRequestPtr aRequest);
+    ErrorPtr dumpPageCmd(ApiRequestPtr aRequest);
+    ErrorPtr exportCmd(ApiRequestPtr aRequest);
+    ErrorPtr saveCmd(ApiRequestPtr aRequest);
+    ErrorPtr loadCmd(ApiRequestPtr aRequest);
+    ErrorPtr testCmd(ApiRequestPtr aRequest);
+    ErrorPtr hideCmd(ApiRequestPtr aRequest);
+    ErrorPtr renameCmd(ApiRequestPtr aRequest);
+    ErrorPtr restartCmd(ApiRequestPtr aRequest);
+    ErrorPtr minRssiProp(JsonObjectPtr aValue);
+    ErrorPtr scanBeaconsProp(JsonObjectPtr aValue);
+    ErrorPtr tooCommonMacCountProp(JsonObjectPtr aValue);
+
+    ErrorPtr parseBenchmark(const string aTcpdumpLog);
+    ErrorPtr replayTool(const string aInput, const string aOutput);
+    ErrorPtr ouiTableTool(const string aSource, const string aOutput);
+
     void displayEncounter(string aIntro, int aImageIndex, PixelColor aColor, string aName, string aBrand, string aTarget);
 
     bool needContentHandler();
     void contentLoaded();
 
     #if IN_THREAD
+    void stopThreads();
     void wifiTrackingThread(ChildThreadWrapper &aThread);
     void wifiTrackingThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode);
+    void aggregationThread(ChildThreadWrapper &aThread);
+    void aggregationThreadSignal(ChildThreadWrapper &aChildThread, ThreadSignals aSignalCode);
+    bool sightingsQueuedHandler(int aFD, int aPollFlags);
+    void processQueuedSightings();
+    void flushEvents();
     #endif
 
   };
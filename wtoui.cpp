@@ -0,0 +1,312 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "wtoui.hpp"
+
+#if ENABLE_FEATURE_WIFITRACK
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <vector>
+
+using namespace p44;
+
+
+/// binary search for an entry
+/// @return entry with the key, NULL if none
+template<class E, class K> static inline const E *findEntry(const E *aEntries, uint32_t aCount, K aKey)
+{
+  if (aCount==0) return NULL;
+  // find last entry with key<=aKey, with only the loop condition as a branch
+  const E *base = aEntries;
+  while (aCount>1) {
+    uint32_t half = aCount/2;
+    base = base[half].key<=aKey ? base+half : base;
+    aCount -= half;
+  }
+  return base->key==aKey ? base : NULL;
+}
+
+
+WTOuiTable::WTOuiTable() :
+  mFd(-1),
+  mData(NULL),
+  mSize(0),
+  mHeader(NULL),
+  mOui36(NULL),
+  mOui28(NULL),
+  mOui24(NULL),
+  mNames(NULL)
+{
+}
+
+
+WTOuiTable::~WTOuiTable()
+{
+  close();
+}
+
+
+void WTOuiTable::close()
+{
+  if (mData) {
+    munmap((void *)mData, mSize);
+    mData = NULL;
+  }
+  if (mFd>=0) {
+    ::close(mFd);
+    mFd = -1;
+  }
+  mSize = 0;
+  mHeader = NULL;
+}
+
+
+size_t WTOuiTable::size() const
+{
+  if (!mHeader) return 0;
+  return mHeader->num36+mHeader->num28+mHeader->num24;
+}
+
+
+ErrorPtr WTOuiTable::open(const string aPath)
+{
+  close();
+  mFd = ::open(aPath.c_str(), O_RDONLY);
+  if (mFd<0) return SysError::errNo();
+  struct stat st;
+  if (fstat(mFd, &st)<0) {
+    ErrorPtr err = SysError::errNo();
+    close();
+    return err;
+  }
+  if (st.st_size<(off_t)sizeof(WTOuiHeader)) {
+    close();
+    return TextError::err("'%s' is too short for an OUI table", aPath.c_str());
+  }
+  void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, mFd, 0);
+  if (m==MAP_FAILED) {
+    ErrorPtr err = SysError::errNo();
+    close();
+    return err;
+  }
+  mData = (const uint8_t *)m;
+  mSize = st.st_size;
+  madvise(m, mSize, MADV_RANDOM);
+  mHeader = (const WTOuiHeader *)mData;
+  if (mHeader->magic!=WT_OUI_MAGIC || mHeader->version!=WT_OUI_VERSION) {
+    close();
+    return TextError::err("'%s' is not an OUI table of version %d", aPath.c_str(), WT_OUI_VERSION);
+  }
+  uint64_t offs = sizeof(WTOuiHeader);
+  mOui36 = (const WTOuiEntry36 *)(mData+offs);
+  offs += (uint64_t)mHeader->num36*sizeof(WTOuiEntry36);
+  mOui28 = (const WTOuiEntry *)(mData+offs);
+  offs += (uint64_t)mHeader->num28*sizeof(WTOuiEntry);
+  mOui24 = (const WTOuiEntry *)(mData+offs);
+  offs += (uint64_t)mHeader->num24*sizeof(WTOuiEntry);
+  mNames = (const char *)(mData+offs);
+  offs += mHeader->nameBytes;
+  if (offs!=mSize || !validate()) {
+    close();
+    return TextError::err("'%s' is truncated or corrupt", aPath.c_str());
+  }
+  return ErrorPtr();
+}
+
+
+bool WTOuiTable::validate() const
+{
+  const WTOuiHeader &h = *mHeader;
+  if (h.nameBytes==0 || mNames[h.nameBytes-1]!=0) return false; // all names must be terminated
+  for (uint32_t i=0; i<h.num36; i++) {
+    if (mOui36[i].name>=h.nameBytes || (i>0 && mOui36[i].key<=mOui36[i-1].key)) return false;
+  }
+  for (uint32_t i=0; i<h.num28; i++) {
+    if (mOui28[i].name>=h.nameBytes || (i>0 && mOui28[i].key<=mOui28[i-1].key)) return false;
+  }
+  for (uint32_t i=0; i<h.num24; i++) {
+    if (mOui24[i].name>=h.nameBytes || (i>0 && mOui24[i].key<=mOui24[i-1].key)) return false;
+  }
+  return true;
+}
+
+
+const char *WTOuiTable::lookup(uint64_t aMac) const
+{
+  if (!mHeader) return NULL;
+  const WTOuiEntry36 *e36 = findEntry(mOui36, mHeader->num36, (uint64_t)(aMac>>12));
+  if (e36) return mNames+e36->name;
+  const WTOuiEntry *e = findEntry(mOui28, mHeader->num28, (uint32_t)(aMac>>20));
+  if (!e) e = findEntry(mOui24, mHeader->num24, (uint32_t)(aMac>>24));
+  return e ? mNames+e->name : NULL;
+}
+
+
+// MARK: ===== table generation
+
+/// shorten wireshark short names like "IeeeRegi" or "SamsungE" to their first word
+static string shortName(string aName)
+{
+  bool capallowed = true;
+  for (size_t i=0; i<aName.size(); i++) {
+    char c = aName[i];
+    if (!capallowed && isupper(c)) {
+      aName.erase(i);
+      break;
+    }
+    // more caps only after non-alphanum
+    capallowed = !isalpha(c) || isupper(c);
+  }
+  return aName;
+}
+
+
+ErrorPtr WTOuiTable::generate(const string aSource, const string aOutput, size_t *aEntriesP, size_t *aNamesP)
+{
+  typedef std::map<uint64_t, string> PrefixMap;
+  PrefixMap prefixes[3]; // /36, /28, /24
+  std::map<uint8_t, uint32_t> groups; // oui.txt format: group byte -> oui24
+  FILE *f = fopen(aSource.c_str(), "r");
+  if (!f) return SysError::errNo();
+  string line;
+  while (string_fgetline(f, line)) {
+    if (line.size()<1 || line[0]=='#') continue; // skip comments and empty lines
+    string s;
+    string name;
+    const char *cursor = line.c_str();
+    if (!nextPart(cursor, s, '\t', true)) continue;
+    if (!nextPart(cursor, name, '\t', true) || name.empty()) continue;
+    if (s.find_first_of(":-")!=string::npos) {
+      // wireshark manuf: xx:xx:xx[:xx:xx:xx/nn]  shortname  longname
+      int msz = 24;
+      size_t n = s.find("/");
+      if (n!=string::npos) {
+        sscanf(s.c_str()+n+1, "%d", &msz);
+        s.erase(n);
+      }
+      string mb = hexToBinaryString(s.c_str(), false, 6);
+      if (mb.size()<3 || mb.size()>6) continue;
+      uint64_t mac = 0;
+      for (size_t i=0; i<mb.size(); i++) {
+        mac |= (uint64_t)((uint8_t)mb[i])<<(8*(5-i));
+      }
+      if (name=="IeeeRegi") continue; // block is subdivided, no vendor
+      name = shortName(name);
+      if (msz==36) prefixes[0][mac>>12] = name;
+      else if (msz==28) prefixes[1][mac>>20] = name;
+      else prefixes[2][mac>>24] = name;
+    }
+    else {
+      // oui.txt: hhhhhh  name  or  hhhhhh  *gg  (group header, see createOUItable() in wifitrack.cpp)
+      uint32_t msrch;
+      if (sscanf(s.c_str(), "%x", &msrch)!=1) continue;
+      if (name[0]=='*') {
+        uint32_t gbyte;
+        if (sscanf(name.c_str()+1, "%u", &gbyte)!=1) continue;
+        groups[(uint8_t)gbyte] = msrch;
+        continue;
+      }
+      uint8_t gbyte = msrch>>24;
+      if (gbyte==0) {
+        prefixes[2][msrch] = name;
+        continue;
+      }
+      std::map<uint8_t, uint32_t>::iterator gpos = groups.find(gbyte);
+      if (gpos==groups.end()) continue; // unknown group
+      if (gbyte & 0x80) prefixes[0][((uint64_t)gpos->second<<12) | (msrch & 0xFFF)] = name;
+      else prefixes[1][((uint64_t)gpos->second<<4) | (msrch & 0xF)] = name;
+    }
+  }
+  fclose(f);
+  // deduplicated names
+  typedef std::map<string, uint32_t> NameMap;
+  NameMap names;
+  string blob;
+  std::vector<WTOuiEntry36> oui36;
+  std::vector<WTOuiEntry> oui2x[2];
+  for (int t=0; t<3; t++) {
+    for (PrefixMap::iterator pos = prefixes[t].begin(); pos!=prefixes[t].end(); ++pos) {
+      uint32_t offs;
+      NameMap::iterator npos = names.find(pos->second);
+      if (npos!=names.end()) {
+        offs = npos->second;
+      }
+      else {
+        offs = (uint32_t)blob.size();
+        blob.append(pos->second);
+        blob.push_back(0);
+        names[pos->second] = offs;
+      }
+      if (t==0) {
+        WTOuiEntry36 e;
+        memset(&e, 0, sizeof(e));
+        e.key = pos->first;
+        e.name = offs;
+        oui36.push_back(e);
+      }
+      else {
+        WTOuiEntry e;
+        e.key = (uint32_t)pos->first;
+        e.name = offs;
+        oui2x[t-1].push_back(e);
+      }
+    }
+  }
+  if (blob.empty()) return TextError::err("no OUIs found in '%s'", aSource.c_str());
+  WTOuiHeader h;
+  memset(&h, 0, sizeof(h));
+  h.magic = WT_OUI_MAGIC;
+  h.version = WT_OUI_VERSION;
+  h.num36 = (uint32_t)oui36.size();
+  h.num28 = (uint32_t)oui2x[0].size();
+  h.num24 = (uint32_t)oui2x[1].size();
+  h.nameBytes = (uint32_t)blob.size();
+  // write
+  string tmpPath = aOutput+".tmp";
+  f = fopen(tmpPath.c_str(), "w");
+  if (!f) return SysError::errNo();
+  fwrite(&h, sizeof(h), 1, f);
+  if (!oui36.empty()) fwrite(&oui36[0], sizeof(WTOuiEntry36), oui36.size(), f);
+  if (!oui2x[0].empty()) fwrite(&oui2x[0][0], sizeof(WTOuiEntry), oui2x[0].size(), f);
+  if (!oui2x[1].empty()) fwrite(&oui2x[1][0], sizeof(WTOuiEntry), oui2x[1].size(), f);
+  fwrite(blob.c_str(), 1, blob.size(), f);
+  ErrorPtr err;
+  if (ferror(f)) err = SysError::errNo();
+  if (fclose(f)!=0 && Error::isOK(err)) err = SysError::errNo();
+  if (Error::isOK(err) && rename(tmpPath.c_str(), aOutput.c_str())!=0) err = SysError::errNo();
+  if (Error::notOK(err)) {
+    unlink(tmpPath.c_str());
+    return err;
+  }
+  if (aEntriesP) *aEntriesP = oui36.size()+oui2x[0].size()+oui2x[1].size();
+  if (aNamesP) *aNamesP = names.size();
+  return ErrorPtr();
+}
+
+#endif // ENABLE_FEATURE_WIFITRACK
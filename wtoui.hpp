@@ -0,0 +1,122 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __p44features_wtoui_hpp__
+#define __p44features_wtoui_hpp__
+
+#include "p44features_common.hpp"
+
+#if ENABLE_FEATURE_WIFITRACK
+
+#define WT_OUI_MAGIC 0x314F5457 ///< "WTO1"
+#define WT_OUI_VERSION 1
+
+namespace p44 {
+
+  // Precompiled OUI table (oui.bin)
+  // Layout: header, /36 entries, /28 entries, /24 entries (each sorted by key), name blob (null terminated,
+  //   deduplicated strings). Keys are the first 36, 28 or 24 bits of the MAC, right aligned.
+  // @note host byte order, generate the table on (or for) the target with the `ouitable` wifitool
+
+  struct WTOuiHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num36;
+    uint32_t num28;
+    uint32_t num24;
+    uint32_t nameBytes;
+    uint32_t reserved[2];
+  };
+
+  struct WTOuiEntry36
+  {
+    uint64_t key;
+    uint32_t name; ///< offset into name blob
+    uint32_t reserved;
+  };
+
+  struct WTOuiEntry
+  {
+    uint32_t key;
+    uint32_t name; ///< offset into name blob
+  };
+
+
+  /// read-only access to a precompiled OUI table, memory mapped
+  class WTOuiTable
+  {
+    int mFd;
+    const uint8_t *mData;
+    size_t mSize;
+
+    const WTOuiHeader *mHeader;
+    const WTOuiEntry36 *mOui36;
+    const WTOuiEntry *mOui28;
+    const WTOuiEntry *mOui24;
+    const char *mNames;
+
+  public:
+
+    WTOuiTable();
+    ~WTOuiTable();
+
+    /// open and validate a precompiled OUI table
+    /// @param aPath path to the table
+    /// @return error if file cannot be opened or is not a valid table
+    ErrorPtr open(const string aPath);
+
+    /// close the table
+    /// @note invalidates all names returned by lookup()
+    void close();
+
+    /// @return true if table is open
+    bool isOpen() const { return mData!=NULL; }
+
+    /// @return number of entries in the table
+    size_t size() const;
+
+    /// look up the vendor name of a MAC, most specific prefix (/36, /28, /24) first
+    /// @param aMac the MAC address
+    /// @return vendor name (valid as long as table is open), NULL if none
+    const char *lookup(uint64_t aMac) const;
+
+    /// generate a table
+    /// @param aSource path of the source, which can be a wireshark `manuf` file, or an `oui.txt` as used by loadOUIs()
+    /// @param aOutput path of the table to write
+    /// @param aEntriesP if not NULL, receives the number of entries written
+    /// @param aNamesP if not NULL, receives the number of distinct names
+    /// @return error if source cannot be read or table cannot be written
+    static ErrorPtr generate(const string aSource, const string aOutput, size_t *aEntriesP = NULL, size_t *aNamesP = NULL);
+
+  private:
+
+    bool validate() const;
+
+  };
+
+} // namespace p44
+
+#endif // ENABLE_FEATURE_WIFITRACK
+
+#endif /* __p44features_wtoui_hpp__ */
@@ -0,0 +1,123 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44features_wtqueue_hpp__
+#define __p44features_wtqueue_hpp__
+
+#include "p44features_common.hpp"
+
+#include <vector>
+#include <atomic>
+#include <algorithm>
+
+namespace p44 {
+
+  /// Lock-free single producer / single consumer ring buffer
+  /// @note push() must only be called from one thread, pop() only from one (other) thread
+  template<class T> class WTSpscRing
+  {
+    std::vector<T> mBuffer; ///< size is a power of 2
+    size_t mMask;
+    std::atomic<size_t> mHead; ///< next position to read (written by consumer only)
+    std::atomic<size_t> mTail; ///< next position to write (written by producer only)
+    std::atomic<bool> mConsumerIdle; ///< set by the consumer before it sleeps, cleared by the producer that wakes it
+
+  public:
+
+    /// @param aCapacity capacity, will be rounded up to a power of 2
+    WTSpscRing(size_t aCapacity) : mHead(0), mTail(0), mConsumerIdle(true)
+    {
+      size_t sz = 2;
+      while (sz<aCapacity) sz <<= 1;
+      mBuffer.resize(sz);
+      mMask = sz-1;
+    };
+
+    /// @return capacity of the ring
+    size_t capacity() const { return mBuffer.size(); }
+
+    /// @return number of items in the ring (only a snapshot when called from a thread other than producer or consumer)
+    size_t size() const { return mTail.load(std::memory_order_acquire)-mHead.load(std::memory_order_acquire); }
+
+    /// @return true if ring is empty (same restrictions as size())
+    bool empty() const { return size()==0; }
+
+    /// add item (producer side)
+    /// @param aItem the item to add. It is moved into the ring (swapped with the empty slot), so the producer
+    ///   does not keep a reference that it could release while the consumer already uses the item.
+    ///   Unchanged when the ring is full.
+    /// @param aWakeupP if not NULL, set to true if the consumer has declared itself idle (see idle()) and must be
+    ///   woken up now. Only one push() reports this for every idle() of the consumer.
+    /// @return false if ring is full
+    bool push(T &aItem, bool *aWakeupP = NULL)
+    {
+      size_t tail = mTail.load(std::memory_order_relaxed);
+      size_t head = mHead.load(std::memory_order_acquire);
+      if (tail-head>=mBuffer.size()) return false; // full
+      std::swap(mBuffer[tail & mMask], aItem); // slot is empty, so aItem is empty afterwards
+      // Note: seq_cst store of mTail and load of mConsumerIdle pair with the opposite order in idle(), so either
+      //   the consumer sees the new item, or we see the consumer idle (or both, which just causes a spurious wakeup)
+      mTail.store(tail+1, std::memory_order_seq_cst);
+      if (aWakeupP) {
+        *aWakeupP = mConsumerIdle.load(std::memory_order_seq_cst) && mConsumerIdle.exchange(false, std::memory_order_seq_cst);
+      }
+      return true;
+    }
+
+    /// remove item (consumer side)
+    /// @param aItem will receive the item (moved out of the ring, the slot is left empty)
+    /// @return false if ring is empty
+    bool pop(T &aItem)
+    {
+      size_t head = mHead.load(std::memory_order_relaxed);
+      if (head==mTail.load(std::memory_order_acquire)) return false; // empty
+      aItem = T(); // release whatever aItem held before, in the consumer's thread
+      std::swap(aItem, mBuffer[head & mMask]);
+      mHead.store(head+1, std::memory_order_release);
+      return true;
+    }
+
+    /// declare the consumer idle (consumer side), to be called after popping everything and before going to sleep
+    /// @return true if the consumer may sleep (the next push() will request a wakeup), false if items were
+    ///   pushed in the meantime, which must be popped first
+    bool idle()
+    {
+      mConsumerIdle.store(true, std::memory_order_seq_cst);
+      if (mTail.load(std::memory_order_seq_cst)==mHead.load(std::memory_order_relaxed)) return true;
+      mConsumerIdle.store(false, std::memory_order_seq_cst);
+      return false;
+    }
+
+    /// remove all items
+    /// @note must only be called while neither producer nor consumer are active
+    void clear()
+    {
+      T item;
+      while (pop(item)) {};
+      mConsumerIdle.store(true);
+    }
+
+  };
+
+} // namespace p44
+
+#endif /* __p44features_wtqueue_hpp__ */
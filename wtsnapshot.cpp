@@ -0,0 +1,285 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#include "wtsnapshot.hpp"
+
+#if ENABLE_FEATURE_WIFITRACK
+
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace p44;
+
+
+// MARK: ===== WTSnapshotWriter
+
+WTSnapshotWriter::WTSnapshotWriter() :
+  mFile(NULL),
+  mSsidsWritten(0),
+  mMacsWritten(0),
+  mPersonsWritten(0),
+  mBytes(0)
+{
+  memset(&mHeader, 0, sizeof(mHeader));
+}
+
+
+WTSnapshotWriter::~WTSnapshotWriter()
+{
+  abort();
+}
+
+
+ErrorPtr WTSnapshotWriter::open(const string aPath, uint32_t aGeneration, uint32_t aNumSsids, uint32_t aNumMacs, uint32_t aNumPersons)
+{
+  abort();
+  mPath = aPath;
+  string tmpPath = mPath+".tmp";
+  mFile = fopen(tmpPath.c_str(), "w");
+  if (!mFile) return SysError::errNo();
+  memset(&mHeader, 0, sizeof(mHeader));
+  mHeader.magic = WT_SNAPSHOT_MAGIC;
+  mHeader.version = WT_SNAPSHOT_VERSION;
+  mHeader.generation = aGeneration;
+  mHeader.numSsids = aNumSsids;
+  mHeader.numMacs = aNumMacs;
+  mHeader.numPersons = aNumPersons;
+  mSsidsWritten = 0;
+  mMacsWritten = 0;
+  mPersonsWritten = 0;
+  // header will be rewritten with the adjacency and string table sizes when finishing
+  fwrite(&mHeader, sizeof(mHeader), 1, mFile);
+  return ErrorPtr();
+}
+
+
+uint32_t WTSnapshotWriter::addString(const string &aStr)
+{
+  uint32_t offs = (uint32_t)mStrings.size();
+  mStrings.append(aStr);
+  return offs;
+}
+
+
+void WTSnapshotWriter::writeSsid(WTSnapshotSsid &aRec, const string &aName)
+{
+  aRec.nameOffset = addString(aName);
+  aRec.nameLen = (uint16_t)aName.size();
+  fwrite(&aRec, sizeof(aRec), 1, mFile);
+  mSsidsWritten++;
+}
+
+
+void WTSnapshotWriter::writeMac(WTSnapshotMac &aRec, const std::vector<uint32_t> &aSsids)
+{
+  aRec.firstSsid = (uint32_t)mMacSsids.size();
+  aRec.numSsids = (uint32_t)aSsids.size();
+  mMacSsids.insert(mMacSsids.end(), aSsids.begin(), aSsids.end());
+  fwrite(&aRec, sizeof(aRec), 1, mFile);
+  mMacsWritten++;
+}
+
+
+void WTSnapshotWriter::writePerson(WTSnapshotPerson &aRec, const string &aName, const std::vector<uint32_t> &aMacs)
+{
+  aRec.nameOffset = addString(aName);
+  aRec.nameLen = (uint16_t)aName.size();
+  aRec.firstMac = (uint32_t)mPersonMacs.size();
+  aRec.numMacs = (uint32_t)aMacs.size();
+  mPersonMacs.insert(mPersonMacs.end(), aMacs.begin(), aMacs.end());
+  fwrite(&aRec, sizeof(aRec), 1, mFile);
+  mPersonsWritten++;
+}
+
+
+ErrorPtr WTSnapshotWriter::finish()
+{
+  if (!mFile) return TextError::err("no snapshot being written");
+  ErrorPtr err;
+  if (mSsidsWritten!=mHeader.numSsids || mMacsWritten!=mHeader.numMacs || mPersonsWritten!=mHeader.numPersons) {
+    err = TextError::err("snapshot incomplete");
+  }
+  else {
+    mHeader.numMacSsids = (uint32_t)mMacSsids.size();
+    mHeader.numPersonMacs = (uint32_t)mPersonMacs.size();
+    mHeader.stringBytes = (uint32_t)mStrings.size();
+    if (!mMacSsids.empty()) fwrite(&mMacSsids[0], sizeof(uint32_t), mMacSsids.size(), mFile);
+    if (!mPersonMacs.empty()) fwrite(&mPersonMacs[0], sizeof(uint32_t), mPersonMacs.size(), mFile);
+    fwrite(mStrings.c_str(), 1, mStrings.size(), mFile);
+    long size = ftell(mFile);
+    if (fseek(mFile, 0, SEEK_SET)!=0 || fwrite(&mHeader, sizeof(mHeader), 1, mFile)!=1 || fflush(mFile)!=0 || ferror(mFile)) {
+      err = SysError::errNo();
+    }
+    else {
+      mBytes = size;
+    }
+  }
+  if (fclose(mFile)!=0 && Error::isOK(err)) err = SysError::errNo();
+  mFile = NULL;
+  string tmpPath = mPath+".tmp";
+  if (Error::isOK(err) && rename(tmpPath.c_str(), mPath.c_str())!=0) err = SysError::errNo();
+  if (Error::notOK(err)) unlink(tmpPath.c_str());
+  release();
+  return err;
+}
+
+
+void WTSnapshotWriter::abort()
+{
+  if (mFile) {
+    fclose(mFile);
+    mFile = NULL;
+    unlink((mPath+".tmp").c_str());
+  }
+  release();
+}
+
+
+void WTSnapshotWriter::release()
+{
+  std::vector<uint32_t>().swap(mMacSsids);
+  std::vector<uint32_t>().swap(mPersonMacs);
+  string().swap(mStrings);
+}
+
+
+// MARK: ===== WTSnapshotFile
+
+WTSnapshotFile::WTSnapshotFile() :
+  mFd(-1),
+  mData(NULL),
+  mSize(0),
+  mHeader(NULL),
+  mSsids(NULL),
+  mMacs(NULL),
+  mPersons(NULL),
+  mMacSsids(NULL),
+  mPersonMacs(NULL),
+  mStrings(NULL)
+{
+}
+
+
+WTSnapshotFile::~WTSnapshotFile()
+{
+  close();
+}
+
+
+void WTSnapshotFile::close()
+{
+  if (mData) {
+    munmap((void *)mData, mSize);
+    mData = NULL;
+  }
+  if (mFd>=0) {
+    ::close(mFd);
+    mFd = -1;
+  }
+  mSize = 0;
+  mHeader = NULL;
+}
+
+
+ErrorPtr WTSnapshotFile::open(const string aPath)
+{
+  close();
+  mFd = ::open(aPath.c_str(), O_RDONLY);
+  if (mFd<0) return SysError::errNo();
+  struct stat st;
+  if (fstat(mFd, &st)<0) {
+    ErrorPtr err = SysError::errNo();
+    close();
+    return err;
+  }
+  if (st.st_size<(off_t)sizeof(WTSnapshotHeader)) {
+    close();
+    return TextError::err("'%s' is too short for a wifitrack snapshot", aPath.c_str());
+  }
+  void *m = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, mFd, 0);
+  if (m==MAP_FAILED) {
+    ErrorPtr err = SysError::errNo();
+    close();
+    return err;
+  }
+  mData = (const uint8_t *)m;
+  mSize = st.st_size;
+  madvise(m, mSize, MADV_SEQUENTIAL);
+  mHeader = (const WTSnapshotHeader *)mData;
+  if (mHeader->magic!=WT_SNAPSHOT_MAGIC) {
+    close();
+    return TextError::err("'%s' is not a wifitrack snapshot", aPath.c_str());
+  }
+  if (mHeader->version!=WT_SNAPSHOT_VERSION) {
+    uint32_t v = mHeader->version;
+    close();
+    return TextError::err("'%s' has unsupported snapshot version %u", aPath.c_str(), v);
+  }
+  // sections
+  uint64_t offs = sizeof(WTSnapshotHeader);
+  mSsids = (const WTSnapshotSsid *)(mData+offs);
+  offs += (uint64_t)mHeader->numSsids*sizeof(WTSnapshotSsid);
+  mMacs = (const WTSnapshotMac *)(mData+offs);
+  offs += (uint64_t)mHeader->numMacs*sizeof(WTSnapshotMac);
+  mPersons = (const WTSnapshotPerson *)(mData+offs);
+  offs += (uint64_t)mHeader->numPersons*sizeof(WTSnapshotPerson);
+  mMacSsids = (const uint32_t *)(mData+offs);
+  offs += (uint64_t)mHeader->numMacSsids*sizeof(uint32_t);
+  mPersonMacs = (const uint32_t *)(mData+offs);
+  offs += (uint64_t)mHeader->numPersonMacs*sizeof(uint32_t);
+  mStrings = (const char *)(mData+offs);
+  offs += mHeader->stringBytes;
+  if (offs!=mSize || !validate()) {
+    close();
+    return TextError::err("'%s' is truncated or corrupt", aPath.c_str());
+  }
+  return ErrorPtr();
+}
+
+
+bool WTSnapshotFile::validate() const
+{
+  const WTSnapshotHeader &h = *mHeader;
+  for (uint32_t i=0; i<h.numSsids; i++) {
+    if ((uint64_t)mSsids[i].nameOffset+mSsids[i].nameLen>h.stringBytes) return false;
+  }
+  for (uint32_t i=0; i<h.numMacs; i++) {
+    if ((uint64_t)mMacs[i].firstSsid+mMacs[i].numSsids>h.numMacSsids) return false;
+  }
+  for (uint32_t i=0; i<h.numMacSsids; i++) {
+    if (mMacSsids[i]>=h.numSsids) return false;
+  }
+  for (uint32_t i=0; i<h.numPersons; i++) {
+    if ((uint64_t)mPersons[i].nameOffset+mPersons[i].nameLen>h.stringBytes) return false;
+    if ((uint64_t)mPersons[i].firstMac+mPersons[i].numMacs>h.numPersonMacs) return false;
+  }
+  for (uint32_t i=0; i<h.numPersonMacs; i++) {
+    if (mPersonMacs[i]>=h.numMacs) return false;
+  }
+  return true;
+}
+
+#endif // ENABLE_FEATURE_WIFITRACK
@@ -0,0 +1,245 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+
+#ifndef __p44features_wtsnapshot_hpp__
+#define __p44features_wtsnapshot_hpp__
+
+#include "p44features_common.hpp"
+
+#if ENABLE_FEATURE_WIFITRACK
+
+#include <vector>
+
+#define WT_SNAPSHOT_MAGIC 0x31535457 ///< "WTS1"
+#define WT_SNAPSHOT_VERSION 2 ///< 2: Never is stored as 0
+
+#define WT_SNAPSHOT_HIDDEN 0x01 ///< flag for hidden SSIDs, MACs and persons
+#define WT_SNAPSHOT_UNUSED 0x02 ///< flag for SSID records of evicted SSIDs (record index = SSID id)
+#define WT_SNAPSHOT_PROXY 0x04 ///< flag for MACs representing devices using randomized MACs
+
+namespace p44 {
+
+  // Binary snapshot of the wifitrack state
+  // Layout: header, SSID records, MAC records, person records, MAC->SSID adjacency (uint32 SSID record indices),
+  //   person->MAC adjacency (uint32 MAC record indices), string table (SSIDs and person names, not null terminated).
+  // @note all values are in host byte order, as snapshots are not meant to be moved to other machines
+  //   (the JSON dump is the export format). Times are unix time in microseconds, 0 for Never
+  //   (see wtSnapshotTime() and wtMainloopTime()).
+  // @note all record sizes are multiples of 8, so all records are naturally aligned in the memory mapped file
+
+  /// @param aTime mainloop time
+  /// @param aUnixTimeOffset offset from mainloop time to unix time
+  /// @return time for storing in a snapshot (unix time, 0 for Never)
+  inline int64_t wtSnapshotTime(MLMicroSeconds aTime, MLMicroSeconds aUnixTimeOffset)
+  {
+    return aTime==Never ? 0 : aTime+aUnixTimeOffset;
+  }
+
+  /// @param aTime time as stored in a snapshot
+  /// @param aUnixTimeOffset offset from mainloop time to unix time
+  /// @return mainloop time (Never if stored as 0)
+  inline MLMicroSeconds wtMainloopTime(int64_t aTime, MLMicroSeconds aUnixTimeOffset)
+  {
+    return aTime==0 ? Never : aTime-aUnixTimeOffset;
+  }
+
+
+  struct WTSnapshotHeader
+  {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t generation; ///< generation of the change log that continues this snapshot
+    uint32_t numSsids;
+    uint32_t numMacs;
+    uint32_t numPersons;
+    uint32_t numMacSsids; ///< number of entries in the MAC->SSID adjacency array
+    uint32_t numPersonMacs; ///< number of entries in the person->MAC adjacency array
+    uint32_t stringBytes; ///< size of the string table
+    uint32_t reserved;
+  };
+
+  struct WTSnapshotSsid
+  {
+    int64_t seenLast;
+    int64_t beaconSeenLast;
+    int64_t seenCount;
+    uint32_t nameOffset; ///< offset of the SSID in the string table
+    uint16_t nameLen;
+    int16_t beaconRssi;
+    uint32_t flags;
+    uint32_t reserved;
+  };
+
+  struct WTSnapshotMac
+  {
+    uint64_t mac;
+    int64_t seenLast;
+    int64_t seenFirst;
+    int64_t seenCount;
+    uint32_t firstSsid; ///< index of first entry in the MAC->SSID adjacency array
+    uint32_t numSsids;
+    int16_t lastRssi;
+    int16_t bestRssi;
+    int16_t worstRssi;
+    uint16_t flags;
+  };
+
+  struct WTSnapshotPerson
+  {
+    int64_t seenLast;
+    int64_t seenFirst;
+    int64_t seenCount;
+    uint32_t firstMac; ///< index of first entry in the person->MAC adjacency array
+    uint32_t numMacs; ///< 0 for persons that were merged into others while the snapshot was written
+    uint32_t nameOffset; ///< offset of the name in the string table
+    uint16_t nameLen;
+    int16_t lastRssi;
+    int16_t bestRssi;
+    int16_t worstRssi;
+    int32_t imageIndex;
+    uint8_t color[4]; ///< r,g,b,a
+    uint32_t flags;
+  };
+
+
+  /// writes a snapshot record by record, so it can be spread over many mainloop cycles
+  /// @note records must be written in order (all SSIDs, then all MACs, then all persons).
+  ///   The snapshot is written to a temporary file which replaces the target only when complete.
+  class WTSnapshotWriter
+  {
+    FILE *mFile;
+    string mPath;
+    WTSnapshotHeader mHeader;
+    uint32_t mSsidsWritten;
+    uint32_t mMacsWritten;
+    uint32_t mPersonsWritten;
+    std::vector<uint32_t> mMacSsids;
+    std::vector<uint32_t> mPersonMacs;
+    string mStrings;
+    long mBytes;
+
+  public:
+
+    WTSnapshotWriter();
+    ~WTSnapshotWriter();
+
+    /// start writing a snapshot
+    /// @param aPath final path of the snapshot
+    /// @param aGeneration change log generation to record in the snapshot
+    /// @param aNumSsids number of SSID records that will be written
+    /// @param aNumMacs number of MAC records that will be written
+    /// @param aNumPersons number of person records that will be written
+    /// @return error if the temporary file cannot be created
+    ErrorPtr open(const string aPath, uint32_t aGeneration, uint32_t aNumSsids, uint32_t aNumMacs, uint32_t aNumPersons);
+
+    /// @return true if a snapshot is being written
+    bool isOpen() const { return mFile!=NULL; }
+
+    /// @return final path of the snapshot being written
+    const string &path() const { return mPath; }
+
+    /// write a SSID record
+    /// @param aRec the record (name offset and length are set by this method)
+    /// @param aName the SSID
+    void writeSsid(WTSnapshotSsid &aRec, const string &aName);
+
+    /// write a MAC record
+    /// @param aRec the record (SSID list info is set by this method)
+    /// @param aSsids indices of the SSID records this MAC is linked to
+    void writeMac(WTSnapshotMac &aRec, const std::vector<uint32_t> &aSsids);
+
+    /// write a person record
+    /// @param aRec the record (name and MAC list info are set by this method)
+    /// @param aName the person's name
+    /// @param aMacs indices of the MAC records of this person
+    void writePerson(WTSnapshotPerson &aRec, const string &aName, const std::vector<uint32_t> &aMacs);
+
+    /// complete the snapshot and move it to its final path
+    /// @return error if not all records announced in open() were written, or writing failed
+    ErrorPtr finish();
+
+    /// abort writing the snapshot, the temporary file is deleted
+    void abort();
+
+    /// @return size of the last snapshot completed with finish()
+    long bytes() const { return mBytes; }
+
+  private:
+
+    uint32_t addString(const string &aStr);
+    void release();
+
+  };
+
+
+  /// read-only access to a snapshot, memory mapped
+  /// @note open() validates all offsets and indices, so the records can be used without further checks
+  class WTSnapshotFile
+  {
+    int mFd;
+    const uint8_t *mData;
+    size_t mSize;
+
+    const WTSnapshotHeader *mHeader;
+    const WTSnapshotSsid *mSsids;
+    const WTSnapshotMac *mMacs;
+    const WTSnapshotPerson *mPersons;
+    const uint32_t *mMacSsids;
+    const uint32_t *mPersonMacs;
+    const char *mStrings;
+
+  public:
+
+    WTSnapshotFile();
+    ~WTSnapshotFile();
+
+    /// open and validate a snapshot
+    /// @param aPath path of the snapshot
+    /// @return error if the file cannot be opened or is not a valid snapshot
+    ErrorPtr open(const string aPath);
+
+    /// close the file
+    void close();
+
+    const WTSnapshotHeader &header() const { return *mHeader; }
+    const WTSnapshotSsid &ssid(uint32_t aIdx) const { return mSsids[aIdx]; }
+    const WTSnapshotMac &mac(uint32_t aIdx) const { return mMacs[aIdx]; }
+    const WTSnapshotPerson &person(uint32_t aIdx) const { return mPersons[aIdx]; }
+    /// @return SSID record index for MAC->SSID adjacency entry
+    uint32_t macSsid(uint32_t aIdx) const { return mMacSsids[aIdx]; }
+    /// @return MAC record index for person->MAC adjacency entry
+    uint32_t personMac(uint32_t aIdx) const { return mPersonMacs[aIdx]; }
+    /// @return pointer to string in the string table (not null terminated)
+    const char *str(uint32_t aOffset) const { return mStrings+aOffset; }
+
+  private:
+
+    bool validate() const;
+
+  };
+
+} // namespace p44
+
+#endif // ENABLE_FEATURE_WIFITRACK
+
+#endif /* __p44features_wtsnapshot_hpp__ */
@@ -0,0 +1,172 @@
+//  SPDX-License-Identifier: GPL-3.0-or-later
+//
+//  Copyright (c) 2026 plan44.ch / Lukas Zeller, Zurich, Switzerland
+//
+//  Author: Lukas Zeller <luz@plan44.ch>
+//
+//  This file is part of p44features.
+//
+//  p44features is free software: you can redistribute it and/or modify
+//  it under the terms of the GNU General Public License as published by
+//  the Free Software Foundation, either version 3 of the License, or
+//  (at your option) any later version.
+//
+//  p44features is distributed in the hope that it will be useful,
+//  but WITHOUT ANY WARRANTY; without even the implied warranty of
+//  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+//  GNU General Public License for more details.
+//
+//  You should have received a copy of the GNU General Public License
+//  along with p44features. If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __p44features_wtstore_hpp__
+#define __p44features_wtstore_hpp__
+
+#include "p44features_common.hpp"
+#include "hashstore.hpp"
+
+#include <vector>
+#include <algorithm>
+
+namespace p44 {
+
+  /// Collects the (up to) aCount smallest items offered in any order, using a bounded max-heap,
+  /// so memory stays proportional to the page size, not to the number of items offered
+  template<class T, class Less> class WTPageCollector
+  {
+    std::vector<T> mHeap;
+    size_t mCount;
+    Less mLess;
+
+  public:
+
+    /// @param aCount max number of items to collect
+    WTPageCollector(size_t aCount) : mCount(aCount) { mHeap.reserve(aCount); };
+
+    /// offer an item
+    void add(const T &aItem)
+    {
+      if (mHeap.size()<mCount) {
+        mHeap.push_back(aItem);
+        std::push_heap(mHeap.begin(), mHeap.end(), mLess);
+      }
+      else if (mCount>0 && mLess(aItem, mHeap.front())) {
+        // smaller than the largest collected so far: replace it
+        std::pop_heap(mHeap.begin(), mHeap.end(), mLess);
+        mHeap.back() = aItem;
+        std::push_heap(mHeap.begin(), mHeap.end(), mLess);
+      }
+    }
+
+    /// @param aItems will receive the collected items in ascending order (collector is empty afterwards)
+    void sorted(std::vector<T> &aItems)
+    {
+      std::sort_heap(mHeap.begin(), mHeap.end(), mLess);
+      aItems.clear();
+      aItems.swap(mHeap);
+    }
+
+  };
+
+
+  /// Open addressing (linear probing) hash map from non-zero 64bit keys to counts
+  class WTPairCounter
+  {
+    struct Slot
+    {
+      uint64_t key; ///< 0 for empty slot
+      uint32_t count;
+    };
+    typedef std::vector<Slot> SlotVector;
+
+    SlotVector mSlots; ///< size is zero or a power of 2
+    size_t mMask;
+    size_t mCount;
+
+  public:
+
+    WTPairCounter() : mMask(0), mCount(0) {};
+
+    /// @return number of keys with a count
+    size_t size() const { return mCount; }
+
+    /// remove all counts
+    void clear() { mSlots.clear(); mMask = 0; mCount = 0; }
+
+    /// @param aKey the key (must not be 0)
+    /// @return current count for the key, 0 if none
+    uint32_t count(uint64_t aKey) const
+    {
+      if (mCount==0) return 0;
+      for (size_t i = hashUInt64(aKey) & mMask; mSlots[i].key; i = (i+1) & mMask) {
+        if (mSlots[i].key==aKey) return mSlots[i].count;
+      }
+      return 0;
+    }
+
+    /// @param aKey the key (must not be 0)
+    /// @return new count for the key
+    uint32_t increment(uint64_t aKey)
+    {
+      if ((mCount+1)*4>mSlots.size()*3) grow(); // keep load factor below 0.75
+      size_t i = hashUInt64(aKey) & mMask;
+      while (mSlots[i].key) {
+        if (mSlots[i].key==aKey) return ++mSlots[i].count;
+        i = (i+1) & mMask;
+      }
+      mSlots[i].key = aKey;
+      mSlots[i].count = 1;
+      mCount++;
+      return 1;
+    }
+
+    /// @param aKey the key to remove
+    /// @return true if key had a count
+    bool erase(uint64_t aKey)
+    {
+      if (mCount==0) return false;
+      size_t i = hashUInt64(aKey) & mMask;
+      while (true) {
+        if (!mSlots[i].key) return false;
+        if (mSlots[i].key==aKey) break;
+        i = (i+1) & mMask;
+      }
+      // backward shift deletion (see HashStore::erase())
+      size_t j = i;
+      while (true) {
+        j = (j+1) & mMask;
+        if (!mSlots[j].key) break;
+        size_t home = hashUInt64(mSlots[j].key) & mMask;
+        if (i<=j ? (home<=i || home>j) : (home<=i && home>j)) {
+          mSlots[i] = mSlots[j];
+          i = j;
+        }
+      }
+      mSlots[i].key = 0;
+      mCount--;
+      return true;
+    }
+
+  private:
+
+    void grow()
+    {
+      SlotVector old;
+      old.swap(mSlots);
+      Slot empty = { 0, 0 };
+      mSlots.resize(old.size()>0 ? old.size()*2 : 64, empty);
+      mMask = mSlots.size()-1;
+      for (SlotVector::iterator pos = old.begin(); pos!=old.end(); ++pos) {
+        if (!pos->key) continue;
+        size_t i = hashUInt64(pos->key) & mMask;
+        while (mSlots[i].key) i = (i+1) & mMask;
+        mSlots[i] = *pos;
+      }
+    }
+
+  };
+
+} // namespace p44
+
+#endif /* __p44features_wtstore_hpp__ */